@@ -0,0 +1,472 @@
+/**
+Stress test and benchmark of calling mocks from many threads.
+
+Each mode runs with 1, 2, 4... threads up to the number of cores, every thread
+calling through `ut_premock_stress_add` in a loop, and reports calls per
+second and how that scales with the number of threads:
+
+- dispatch: the default implementation, nothing replaced
+- scopes:   each thread installs and removes its own REPLACE all the time
+- spy:      one Spy shared by all threads, recording concurrently
+- mock:     one Mock shared by all threads, recording and handing out
+            return values concurrently
+- shared:   one Spy shared by all threads, recording into a SharedCallRing
+            as it would for child processes. At most 4M calls in total so
+            that the ring stays small.
+
+The modes after those check the results while the threads are still calling:
+
+- collect:    one Spy recording concurrently, its calls collected over and
+              over while the threads append to their logs
+- within:     one Spy recording concurrently, waited on by expectCalledWithin
+- timed:      one Spy timing its calls, inherited with InheritMocks, its
+              latencies merged while the threads are timed
+- snapshots:  each thread installs and removes its own REPLACE all the time
+              and starts threads that inherit it through InheritMocks or
+              install a MockSnapshot of it
+- locks:      a LockProfile inherited by threads taking shared mutexes and a
+              rwlock, its stats taken while they do. At most 1M locks in
+              total.
+- trace:      a ChromeTrace of the calls, inherited by the threads, its events
+              counted and its JSON written while they're made. At most 256k
+              calls in total.
+- runner:     a ParallelRunner running tests that replace the mock and check
+              that they start from its default
+- interposed: threads started with pthread_create, through the interposer,
+              inheriting a Spy with InheritMocks and passing it on
+
+The results are checked after every run and the exit code is non-zero if any
+were wrong. Built as `stress_cpp` and, with ThreadSanitizer, `stress_tsan`,
+which must report no data races:
+
+    ./stress_cpp [calls per thread] [max threads]
+ */
+
+#include "premock_fork.hpp"
+#include "premock_contention.hpp"
+#include "premock_runner.hpp"
+#include "premock_thread.hpp"
+#include "premock_trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+extern "C" int stress_add(int a, int b) { return a + b; }
+
+extern "C" {
+    DECL_MOCK(stress_add);
+    IMPL_MOCK_DEFAULT(2, stress_add);
+
+    IMPL_MOCK_INHERITANCE();
+
+    IMPL_MOCK_DEFAULT(4, pthread_create);
+    IMPL_MOCK_DEFAULT(2, pthread_join);
+    IMPL_MOCK_DEFAULT(1, pthread_detach);
+    IMPL_MOCK_DEFAULT(0, pthread_self);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_lock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_trylock);
+    IMPL_MOCK_DEFAULT(2, pthread_mutex_timedlock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_unlock);
+    IMPL_MOCK_DEFAULT(2, pthread_cond_wait);
+    IMPL_MOCK_DEFAULT(3, pthread_cond_timedwait);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_signal);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_broadcast);
+    IMPL_MOCK_DEFAULT(0, sched_yield);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_rdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_tryrdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_wrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_trywrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_unlock);
+}
+
+
+namespace {
+
+// how long a run took and how many calls it made in total
+struct Run {
+    std::chrono::nanoseconds elapsed;
+    size_t calls;
+};
+
+void check(bool condition, const std::string& what) {
+    if(!condition) throw MockException("Stress check failed: " + what);
+}
+
+// Runs body(thread index) on threads threads at once after each has installed
+// snapshot, if any, and returns how long the slowest took. If there's a watch,
+// this thread calls it over and over until they've all finished.
+std::chrono::nanoseconds timeThreads(size_t threads, const MockSnapshot* snapshot,
+                                     const std::function<void(size_t)>& body,
+                                     const std::function<void()>& watch) {
+    std::atomic<size_t> ready{0}, finished{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> pool;
+    for(size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            if(snapshot) snapshot->install();
+            ++ready;
+            while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            body(t);
+            ++finished;
+        });
+    }
+    while(ready.load() < threads) std::this_thread::yield();
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    if(watch) {
+        do {
+            watch();
+            std::this_thread::yield();
+        } while(finished.load() < threads);
+    }
+    for(auto& thread: pool) thread.join();
+    return std::chrono::steady_clock::now() - start;
+}
+
+std::chrono::nanoseconds runThreads(size_t threads, const MockSnapshot& snapshot,
+                                    const std::function<void(size_t)>& body,
+                                    const std::function<void()>& watch = {}) {
+    return timeThreads(threads, &snapshot, body, watch);
+}
+
+// the same with threads that inherit this one's mocks when they start, as
+// the threads of the code under test would
+std::chrono::nanoseconds runThreads(size_t threads, const InheritMocks&,
+                                    const std::function<void(size_t)>& body,
+                                    const std::function<void()>& watch = {}) {
+    return timeThreads(threads, nullptr, body, watch);
+}
+
+// the default implementation, called calls times by each thread
+void callDefault(int calls) {
+    for(int i = 0; i < calls; ++i) ut_premock_stress_add(i, 1);
+}
+
+size_t occurrences(const std::string& text, const std::string& what) {
+    size_t count = 0;
+    for(auto pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + what.size())) ++count;
+    return count;
+}
+
+Run dispatch(size_t threads, int calls) {
+    std::vector<long long> sums(threads, 0);
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t t) {
+        long long sum = 0;
+        for(int i = 0; i < calls; ++i) sum += ut_premock_stress_add(i, 1);
+        sums[t] = sum;
+    });
+    const auto expected = static_cast<long long>(calls) * (calls + 1) / 2;
+    for(const auto sum: sums) check(sum == expected, "default implementation sum");
+    return Run{elapsed, threads * calls};
+}
+
+Run scopes(size_t threads, int calls) {
+    std::vector<int> wrong(threads, 0);
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t t) {
+        for(int i = 0; i < calls; i += 64) {
+            REPLACE(stress_add, [](int a, int b) { return a - b; });
+            for(int j = 0; j < 64; ++j) wrong[t] += ut_premock_stress_add(j, j) != 0;
+        }
+        wrong[t] += ut_premock_stress_add(1, 1) != 2; // the default again
+    });
+    for(const auto count: wrong) check(count == 0, "replaced implementation results");
+    return Run{elapsed, threads * calls};
+}
+
+Run spying(size_t threads, int calls) {
+    auto s = SPY(stress_add);
+    s.recordConcurrently();
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t) {
+        for(int i = 0; i < calls; ++i) ut_premock_stress_add(i, 1);
+    });
+    check(s.sequenceNumbers().size() == threads * calls, "calls recorded by the spy");
+    check(std::is_sorted(s.sequenceNumbers().begin(), s.sequenceNumbers().end()), "spy call order");
+    s.expectCalled(threads * calls);
+    return Run{elapsed, threads * calls};
+}
+
+Run mocking(size_t threads, int calls) {
+    auto m = MOCK(stress_add);
+    m.returnValue(1, 2, 3, 4, 5, 6, 7, 8, 0);
+    m.returnConcurrently();
+    m.recordConcurrently();
+    std::vector<long long> sums(threads, 0);
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t t) {
+        long long sum = 0;
+        for(int i = 0; i < calls; ++i) sum += ut_premock_stress_add(i, 1);
+        sums[t] = sum;
+    });
+    long long sum = 0;
+    for(const auto s: sums) sum += s;
+    check(sum == 36, "each scripted return value taken once");
+    m.expectCalled(threads * calls);
+    return Run{elapsed, threads * calls};
+}
+
+Run sharing(size_t threads, int calls) {
+    calls = std::min(calls, (1 << 22) / static_cast<int>(threads));
+    auto s = SPY(stress_add);
+    recordAcrossProcesses(s, threads * calls);
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t) {
+        for(int i = 0; i < calls; ++i) ut_premock_stress_add(i, 1);
+    });
+    s.expectCalled(threads * calls);
+    return Run{elapsed, threads * calls};
+}
+
+Run collecting(size_t threads, int calls) {
+    auto s = SPY(stress_add);
+    s.recordConcurrently();
+    // every sequence number collected so far, each collect's in order
+    std::vector<std::uint64_t> sequence;
+    const auto collectNew = [&] {
+        const auto& collected = s.sequenceNumbers();
+        check(collected.size() >= sequence.size(), "calls collected so far");
+        const auto fresh = collected.begin() + static_cast<std::ptrdiff_t>(sequence.size());
+        check(std::is_sorted(fresh, collected.end()), "order of the calls collected together");
+        sequence.insert(sequence.end(), fresh, collected.end());
+    };
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t) { callDefault(calls); }, collectNew);
+    collectNew();
+    check(sequence.size() == threads * calls, "calls collected by the spy");
+    std::sort(sequence.begin(), sequence.end());
+    check(std::adjacent_find(sequence.begin(), sequence.end()) == sequence.end(), "calls collected once");
+    s.expectCalled(threads * calls);
+    return Run{elapsed, threads * calls};
+}
+
+Run waiting(size_t threads, int calls) {
+    auto s = SPY(stress_add);
+    s.recordConcurrently();
+    bool waited = false;
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t) { callDefault(calls); }, [&] {
+        if(waited) return;
+        waited = true;
+        s.expectCalledWithin(threads * calls, std::chrono::minutes{10});
+    });
+    s.expectCalled(0); // nothing left over
+    return Run{elapsed, threads * calls};
+}
+
+Run timing(size_t threads, int calls) {
+    auto s = SPY(stress_add);
+    s.recordConcurrently();
+    s.timeCalls();
+    InheritMocks inherit;
+    std::uint64_t seen = 0;
+    const auto elapsed = runThreads(threads, inherit, [&](size_t) { callDefault(calls); }, [&] {
+        const auto timed = s.latencies().count();
+        check(timed >= seen && timed <= threads * calls, "calls timed so far");
+        seen = timed;
+    });
+    check(s.latencies().count() == threads * calls, "calls timed by the spy");
+    s.expectCalled(threads * calls);
+    return Run{elapsed, threads * calls};
+}
+
+Run snapshots(size_t threads, int calls) {
+    std::vector<int> wrong(threads, 0);
+    int wrongHere = 0;
+    const auto elapsed = runThreads(threads, MockSnapshot{}, [&](size_t t) {
+        const int offset = static_cast<int>(t) + 1;
+        for(int i = 0; i < calls; i += 64) {
+            REPLACE(stress_add, [offset](int a, int b) { return a * b + offset; });
+            if(i % 4096 == 0) {
+                const MockSnapshot snapshot;
+                int childWrong = 0;
+                std::thread{[&] {
+                    childWrong += ut_premock_stress_add(2, 3) != 2 + 3; // not inherited
+                    snapshot.install();
+                    childWrong += ut_premock_stress_add(2, 3) != 2 * 3 + offset;
+                }}.join();
+                InheritMocks inherit;
+                std::thread{[&] { childWrong += ut_premock_stress_add(2, 3) != 2 * 3 + offset; }}.join();
+                wrong[t] += childWrong;
+            }
+            for(int j = 0; j < 64; ++j) wrong[t] += ut_premock_stress_add(j, 2) != j * 2 + offset;
+        }
+        wrong[t] += ut_premock_stress_add(1, 1) != 2; // the default again
+    }, [&] {
+        // the other threads' scopes come and go without affecting this one
+        wrongHere += ut_premock_stress_add(1, 1) != 2;
+    });
+    check(wrongHere == 0, "default implementation while other threads replace it");
+    for(const auto count: wrong) check(count == 0, "replaced and inherited implementation results");
+    return Run{elapsed, threads * calls};
+}
+
+Run locking(size_t threads, int calls) {
+    calls = std::min(calls, (1 << 20) / static_cast<int>(threads));
+    static pthread_mutex_t mutexes[] = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+                                        PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+    static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+    static long long counters[4];
+    for(auto& counter: counters) counter = 0;
+
+    LockProfile locks;
+    InheritMocks inherit;
+    const auto acquisitions = [&locks] {
+        std::uint64_t total = 0;
+        for(const auto& lock: locks.stats()) total += lock.acquisitions;
+        return total;
+    };
+    std::uint64_t seen = 0;
+    const auto elapsed = runThreads(threads, inherit, [&](size_t t) {
+        for(int i = 0; i < calls; ++i) {
+            if(i % 8 == 7) {
+                mock_pthread_rwlock_rdlock(&rwlock);
+                mock_pthread_rwlock_unlock(&rwlock);
+            } else {
+                const auto lock = (t + i) % 4;
+                mock_pthread_mutex_lock(&mutexes[lock]);
+                ++counters[lock];
+                mock_pthread_mutex_unlock(&mutexes[lock]);
+            }
+        }
+    }, [&] {
+        const auto total = acquisitions();
+        check(total >= seen && total <= threads * calls, "lock acquisitions profiled so far");
+        seen = total;
+    });
+
+    long long counted = 0;
+    for(const auto counter: counters) counted += counter;
+    check(counted == static_cast<long long>(threads) * (calls - calls / 8), "increments under the mutexes");
+    check(acquisitions() == threads * calls, "lock acquisitions profiled");
+    for(const auto& lock: locks.stats()) {
+        check(lock.contended <= lock.acquisitions && lock.failedTries == 0, "contended acquisitions");
+        check(lock.hold.count() == lock.acquisitions, "hold times, one per acquisition");
+    }
+    return Run{elapsed, threads * calls};
+}
+
+Run tracing(size_t threads, int calls) {
+    calls = std::min(calls, (1 << 18) / static_cast<int>(threads));
+    const auto total = threads * calls;
+    ChromeTrace trace;
+    auto s = TRACE_CALLS(stress_add, trace);
+    InheritMocks inherit;
+    size_t seen = 0;
+    int polls = 0;
+    const auto elapsed = runThreads(threads, inherit, [&](size_t) { callDefault(calls); }, [&] {
+        const auto events = trace.events();
+        check(events >= seen && events <= total, "calls traced so far");
+        seen = events;
+        if(++polls % 64) return; // the JSON is slow to write
+        const auto json = trace.json();
+        const auto written = occurrences(json, "\"name\":\"stress_add\"");
+        check(written >= events && written <= total, "events in the trace so far");
+        check(json.compare(0, 16, "{\"traceEvents\":[") == 0 && json.back() == '\n', "trace JSON so far");
+    });
+    check(trace.events() == total, "calls traced");
+    check(occurrences(trace.json(), "\"name\":\"stress_add\"") == total, "events in the trace");
+    return Run{elapsed, total};
+}
+
+Run running(size_t threads, int calls) {
+    const size_t tests = threads * 16;
+    const int callsPerTest = std::max(1, calls / 16);
+    // what the workers would start with if the runner didn't reset them
+    REPLACE(stress_add, [](int, int) { return -1; });
+    InheritMocks inherit;
+    ParallelRunner runner{threads};
+    for(size_t k = 0; k < tests; ++k) {
+        const int offset = static_cast<int>(k);
+        runner.add("stress " + std::to_string(k), [callsPerTest, offset] {
+            check(ut_premock_stress_add(1, 1) == 2, "default implementation at the start of a test");
+            REPLACE(stress_add, [offset](int a, int b) { return a + b + offset; });
+            int wrong = 0;
+            for(int i = 0; i < callsPerTest; ++i) wrong += ut_premock_stress_add(i, 1) != i + 1 + offset;
+            check(wrong == 0, "replaced implementation results in a test");
+        });
+    }
+    const auto results = runner.run();
+    results.verify();
+    check(results.passed == tests, "tests passed");
+    return Run{results.elapsed, tests * callsPerTest};
+}
+
+// what the threads started with pthread_create run
+struct Interposed {
+    int calls;
+    long long sum;
+    int grandchild;
+};
+
+void* interposedWorker(void* arg) {
+    auto& worker = *static_cast<Interposed*>(arg);
+    for(int i = 0; i < worker.calls; ++i) worker.sum += ut_premock_stress_add(i, 1);
+    // started through the interposer too, and inherits the same spy
+    std::thread{[&worker] { worker.grandchild = ut_premock_stress_add(1, 1); }}.join();
+    return nullptr;
+}
+
+Run interposing(size_t threads, int calls) {
+    auto s = SPY(stress_add);
+    s.recordConcurrently();
+    std::vector<Interposed> workers(threads, Interposed{calls, 0, 0});
+    std::vector<pthread_t> ids(threads);
+    const auto start = std::chrono::steady_clock::now();
+    {
+        InheritMocks inherit;
+        for(size_t t = 0; t < threads; ++t)
+            check(pthread_create(&ids[t], nullptr, &interposedWorker, &workers[t]) == 0, "pthread_create");
+    }
+    for(const auto id: ids) check(pthread_join(id, nullptr) == 0, "pthread_join");
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto expected = static_cast<long long>(calls) * (calls + 1) / 2;
+    for(const auto& worker: workers) check(worker.sum == expected && worker.grandchild == 2, "spied on results");
+    // only recorded if the spy was inherited by children and grandchildren
+    s.expectCalled(threads * calls + threads);
+    return Run{elapsed, threads * calls};
+}
+
+}
+
+
+int main(int argc, char* argv[]) {
+    const int calls = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const size_t maxThreads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) :
+        std::max(1u, std::thread::hardware_concurrency());
+
+    struct Mode {
+        const char* name;
+        Run (*run)(size_t, int);
+    };
+    const Mode modes[] = {{"dispatch", dispatch}, {"scopes", scopes}, {"spy", spying}, {"mock", mocking},
+                          {"shared", sharing}, {"collect", collecting}, {"within", waiting},
+                          {"timed", timing}, {"snapshots", snapshots}, {"locks", locking}, {"trace", tracing},
+                          {"runner", running}, {"interposed", interposing}};
+
+    std::vector<size_t> threadCounts;
+    for(size_t threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    try {
+        printf("%-10s %8s %14s %9s\n", "mode", "threads", "calls/s", "scaling");
+        for(const auto& mode: modes) {
+            double single = 0;
+            for(const auto threads: threadCounts) {
+                const auto run = mode.run(threads, calls);
+                const auto seconds = std::chrono::duration<double>(run.elapsed).count();
+                const auto rate = static_cast<double>(run.calls) / seconds;
+                if(threads == 1) single = rate;
+                printf("%-10s %8zu %14.0f %8.2fx\n", mode.name, threads, rate, rate / single);
+            }
+        }
+    } catch(const std::exception& ex) {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+    return 0;
+}
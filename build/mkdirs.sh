@@ -8,3 +8,5 @@ TOP_DIR="$THIS_DIR"/..
 mkdir -p "$TOP_DIR"/objs/example_cpp.objs/example/{cpp,d,deps,src}
 mkdir -p "$TOP_DIR"/objs/example_cpp.objs/example/cpp/{mocks,test}
 mkdir -p "$TOP_DIR"/objs/ut_cpp.objs/tests
+mkdir -p "$TOP_DIR"/objs/stress_cpp.objs/bench
+mkdir -p "$TOP_DIR"/objs/stress_tsan.objs/bench
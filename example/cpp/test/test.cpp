@@ -82,6 +82,21 @@ int main() {
         mock2.expectCalled(3).withValues({make_tuple(98, 1000), make_tuple(8, 11), make_tuple(4, 6)});
     }
 
+    {
+        // other_two still gets called for real: 97 * 1001
+        auto s = SPY(other_two);
+        assertEqual(prod_two(98, 1000), 97097);
+        s.expectCalled().withValues(97, 1001);
+    }
+
+    {
+        // other_one gets called before other_two
+        auto one = MOCK(other_one);
+        auto two = MOCK(other_two);
+        prod_two(1, 2);
+        expectInSequence(one, two);
+    }
+
     {
         //C++ function mocking
         auto m = MOCK(twice);
@@ -77,6 +77,9 @@ TEST(send, for_reals) {
 If neither `REPLACE` nor `MOCK` are used, the original implementation
 will be used.
 
+`SPY(send)` records calls like `MOCK` but forwards them to the implementation
+it displaced instead of replacing it.
+
 ```
  */
 
@@ -93,12 +96,175 @@ will be used.
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <thread>
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#    if defined(_M_X64) || defined(_M_IX86)
+#        define PREMOCK_HAVE_RDTSC
+#    endif
+#elif defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#    define PREMOCK_HAVE_RDTSC
+#elif defined(__unix__)
+#    include <time.h>
+#endif
+
+#if defined(__SANITIZE_THREAD__)
+#    define PREMOCK_TSAN
+#elif defined(__has_feature)
+#    if __has_feature(thread_sanitizer)
+#        define PREMOCK_TSAN
+#    endif
+#endif
+
+/**
+ Anything that records the calls made to a mock, so that the registry can
+ tell how much memory the history takes and calls to different mocks can be
+ put in order
+ */
+class CallHistory {
+public:
+
+    virtual size_t historyBytes() const noexcept = 0;
+
+    /**
+     The sequence numbers of the calls recorded since the last call to
+     `expectCalled`, in ascending order
+     */
+    virtual const std::deque<std::uint64_t>& sequenceNumbers() const = 0;
+
+protected:
+
+    ~CallHistory() = default;
+};
+
+
+/**
+ The part of MockScope that doesn't depend on the mock's type. The active
+ scopes of each thread form an intrusive list, newest last, so that they
+ can be inspected and undone in bulk without allocating.
+ */
+class MockScopeBase {
+public:
+
+    MockScopeBase(const MockScopeBase&) = delete;
+    MockScopeBase& operator=(const MockScopeBase&) = delete;
+
+    /**
+     The mock_ variable this scope replaced
+     */
+    const void* target() const noexcept { return _target; }
+
+    /**
+     Whether this scope's replacement is still in place
+     */
+    bool active() const noexcept { return _active; }
+
+    /**
+     The calls recorded through this scope, if it belongs to a Mock or Spy
+     */
+    const CallHistory* history() const noexcept { return _history; }
+
+    void setHistory(const CallHistory* history) noexcept { _history = history; }
+
+    /**
+     Undoes every scope still active on this thread, newest first, leaving
+     each mock as it was before the first of them. Takes time proportional
+     to the number of active scopes. Returns how many were undone.
+     */
+    static size_t restoreAll() noexcept {
+        size_t restored = 0;
+        while(newest()) {
+            newest()->restore();
+            ++restored;
+        }
+        return restored;
+    }
+
+    /**
+     Calls func with each scope active on this thread, oldest first
+     */
+    template<typename F>
+    static void forEachActive(F func) {
+        auto scope = newest();
+        while(scope && scope->_previous) scope = scope->_previous;
+        for(; scope; scope = scope->_next) func(*scope);
+    }
+
+protected:
+
+    explicit MockScopeBase(const void* target) noexcept:
+        _target{target},
+        _list{&newest()},
+        _previous{newest()} {
+        if(_previous) _previous->_next = this;
+        newest() = this;
+    }
+
+    // takes over other's place in the list
+    MockScopeBase(MockScopeBase&& other) noexcept:
+        _target{other._target},
+        _history{other._history},
+        _active{other._active},
+        _list{other._list},
+        _previous{other._previous},
+        _next{other._next} {
+        if(!_active) return;
+        if(_previous) _previous->_next = this;
+        if(_next) _next->_previous = this; else *_list = this;
+        other._active = false;
+    }
+
+    ~MockScopeBase() {
+        if(_active) unlink();
+    }
+
+    /**
+     Puts back the implementation that was displaced and calls unlink
+     */
+    virtual void restore() noexcept = 0;
+
+    void unlink() noexcept {
+        if(_previous) _previous->_next = _next;
+        if(_next) _next->_previous = _previous; else *_list = _previous;
+        _active = false;
+    }
+
+private:
+
+    const void* _target;
+    const CallHistory* _history = nullptr;
+    bool _active = true;
+    MockScopeBase** _list;
+    MockScopeBase* _previous;
+    MockScopeBase* _next = nullptr;
+
+    static MockScopeBase*& newest() noexcept {
+        static thread_local MockScopeBase* scope = nullptr;
+        return scope;
+    }
+};
+
 
 /**
  RAII class for setting a mock to a callable until the end of scope
  */
 template<typename T>
-class MockScope {
+class MockScope: public MockScopeBase {
 public:
 
     // assumes T is a std::function
@@ -109,23 +275,40 @@ public:
      */
     template<typename F>
     MockScope(T& func, F scopeFunc):
+        MockScopeBase{&func},
         _func{func},
         _oldFunc{std::move(func)} {
 
         _func = std::move(scopeFunc);
     }
 
+    MockScope(MockScope&&) = default;
+
     /**
-     Restore func to its original value
+     Restore func to its original value, unless that was already done
+     by MockScopeBase::restoreAll
      */
     ~MockScope() {
-        _func = std::move(_oldFunc);
+        if(active()) restore();
+    }
+
+    /**
+     The implementation that was in place before this scope replaced it.
+     Useful for callables that want to forward to the "real" function.
+     */
+    const T& displaced() const {
+        return _oldFunc;
     }
 
 private:
 
     T& _func;
     T _oldFunc;
+
+    void restore() noexcept override {
+        _func = std::move(_oldFunc);
+        unlink();
+    }
 };
 
 
@@ -151,6 +334,56 @@ MockScope<T> mockScope(T& func, F scopeFunc) {
  */
 #define REPLACE(func, lambda) auto MAKE_UNIQUE(_) = mockScope(mock_##func, lambda)
 
+
+/**
+ Any number of mocks, each wrapped until the end of scope by a callable that
+ gets the implementation it displaced followed by the arguments, for the
+ classes that watch calls to several mocks at once. The mocks were replaced
+ in order, so they're restored in reverse.
+ */
+class WatchedMocks {
+public:
+
+    WatchedMocks() = default;
+
+    ~WatchedMocks() {
+        while(!_watches.empty()) _watches.pop_back();
+    }
+
+    WatchedMocks(const WatchedMocks&) = delete;
+    WatchedMocks& operator=(const WatchedMocks&) = delete;
+
+    /**
+     Replace func with a call to wrapper(displaced, args...)
+     */
+    template<typename T, typename F>
+    void watch(T& func, F wrapper) {
+        _watches.emplace_back(new Watch<T>{func, std::move(wrapper)});
+    }
+
+private:
+
+    struct WatchBase {
+        virtual ~WatchBase() = default;
+    };
+
+    template<typename T>
+    struct Watch: WatchBase {
+        using ReturnType = typename MockScope<T>::ReturnType;
+
+        template<typename F>
+        Watch(T& func, F wrapper):
+            mockScope{func, [this, wrapper](auto&&... args) -> ReturnType {
+                    return wrapper(mockScope.displaced(), std::forward<decltype(args)>(args)...);
+                }} {
+        }
+
+        MockScope<T> mockScope;
+    };
+
+    std::vector<std::unique_ptr<WatchBase>> _watches;
+};
+
 template<typename T>
 struct Slice {
     void* ptr = nullptr;
@@ -263,153 +496,960 @@ struct CanBeOverwritten<T, std::void_t<decltype(memcpy(std::declval<T>(), std::d
 
 
 /**
- A mock class to verify expectations of how the mock was called.
- Supports verification of the number of times called, setting
- return values and checking the values passed to it.
+ The type return values are stored as. void can't be stored, so void* stands in for it.
  */
-template<typename T>
-class Mock {
-public:
+template<typename R>
+using ReturnValueType = std::conditional_t<std::is_void<R>::value, void*, R>;
 
-    using ReturnType = typename MockScope<T>::ReturnType;
-    using ParamTupleType = typename StdFunctionTraits<T>::TupleType;
-    using OutputTupleType = typename StdFunctionTraits<T>::OutputTupleType;
+
+/**
+ The argument at position I converted to a count, e.g. the length passed to
+ send, or 0 if I is negative. For wrappers that sum sizes across calls.
+ */
+template<int I, typename... A>
+std::enable_if_t<(I < 0), std::uint64_t> countParameter(const A&...) noexcept {
+    return 0;
+}
+
+template<int I, typename... A>
+std::enable_if_t<(I >= 0), std::uint64_t> countParameter(const A&... args) noexcept {
+    return static_cast<std::uint64_t>(std::get<I>(std::tie(args...)));
+}
+
+template<typename V>
+std::enable_if_t<std::is_integral<V>::value, std::uint64_t> countValue(const V& value) noexcept {
+    return std::is_signed<V>::value && static_cast<long long>(value) < 0 ? 0 : static_cast<std::uint64_t>(value);
+}
+
+template<typename V>
+std::enable_if_t<!std::is_integral<V>::value, std::uint64_t> countValue(const V&) noexcept {
+    return 0;
+}
+
+/**
+ The argument at a position only known at runtime converted to a count, or
+ 0 if it's negative or not an integer. For wrappers told which parameter
+ holds the size of a buffer.
+ */
+template<typename... A>
+std::uint64_t countParameterAt(size_t index, const A&... args) noexcept {
+    std::uint64_t count = 0;
+    size_t position = 0;
+    int expand[] = {0, (position++ == index ? (count = countValue(args), 0) : 0)...};
+    (void)expand; (void)position;
+    return count;
+}
+
+
+/**
+ A cheap clock for timing calls: the time stamp counter on x86, otherwise
+ CLOCK_MONOTONIC_RAW where available and the steady clock elsewhere. Ticks
+ are converted to nanoseconds with a factor calibrated once per process,
+ which assumes an invariant TSC (true of any x86 CPU from the last decade).
+ */
+struct CycleClock {
+
+    static std::uint64_t now() noexcept {
+#if defined(PREMOCK_HAVE_RDTSC)
+        return __rdtsc();
+#elif defined(CLOCK_MONOTONIC_RAW)
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+        return static_cast<std::uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<std::uint64_t>(time.tv_nsec);
+#else
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
 
     /**
-     Enables checks on parameter values passed to function invocations
+     How many nanoseconds a tick is. The first call calibrates the clock, which
+     takes a few milliseconds if it's the TSC.
      */
-    class ParamChecker {
-    public:
+    static double nanosecondsPerTick() noexcept {
+        static const double factor = calibrate();
+        return factor;
+    }
 
-        ParamChecker(std::deque<ParamTupleType> v):_values{v} {}
+    static std::uint64_t toNanoseconds(std::uint64_t ticks) noexcept {
+        return static_cast<std::uint64_t>(static_cast<double>(ticks) * nanosecondsPerTick());
+    }
 
-        /**
-         Verifies the parameter values passed in the last invocation
-         */
-        template<typename... A>
-        void withValues(A&&... args) {
-            withValues({std::make_tuple(std::forward<A>(args)...)}, _values.size() - 1, _values.size());
-        }
+private:
 
-        /**
-         Verifies the parameter values passed in all invocations since the last
-         call to `expectCalled`, optionally between the start-th and end-th
-         invocations
-         */
-        void withValues(std::initializer_list<ParamTupleType> args,
-                        size_t start = 0, size_t end = 0) {
+    static double calibrate() noexcept {
+#if defined(PREMOCK_HAVE_RDTSC)
+        using namespace std::chrono;
+        const auto start = steady_clock::now();
+        const auto startTicks = now();
+        auto end = start;
+        while(end - start < milliseconds{10}) end = steady_clock::now();
+        const auto ticks = now() - startTicks;
+        return static_cast<double>(duration_cast<nanoseconds>(end - start).count()) / static_cast<double>(ticks);
+#else
+        return 1.0;
+#endif
+    }
+};
 
-            if(end == 0) end = _values.size();
-            std::deque<ParamTupleType> expected{std::move(args)};
 
-            const auto expectedArgsSize = end - start;
-            if(expected.size() != expectedArgsSize)
-                throw std::logic_error("ParamChecker::withValues called with " +
-                                       capitalize(expected.size(), "value") + ", expected " +
-                                       std::to_string(expectedArgsSize));
+/**
+ A histogram of durations in nanoseconds with logarithmic buckets, in the
+ style of HdrHistogram: values below 64 get their own bucket and above that
+ every power of two is split in 32, so percentiles are accurate to ~3%. All
+ storage is inline so recording never allocates.
+ */
+class LatencyHistogram {
+public:
 
-            for(size_t i = start; i < end; ++i) {
-                const auto& expValues = expected.at(i - start);
-                const auto& actValues = _values.at(i);
-                if(expValues != actValues)
-                    throw MockException(std::string{"Invocation values do not match\n"} +
-                                        "Expected: " + toString(expValues) + "\n" +
-                                        "Actual:   " + toString(actValues) + "\n");
-            }
-        }
+    void record(std::uint64_t nanoseconds) noexcept {
+        ++_counts[bucketIndex(nanoseconds)];
+        ++_count;
+        _total += nanoseconds;
+        _max = std::max(_max, nanoseconds);
+        _min = std::min(_min, nanoseconds);
+    }
 
-    private:
+    std::uint64_t count() const noexcept { return _count; }
+    std::uint64_t total() const noexcept { return _total; }
+    std::uint64_t max() const noexcept { return _max; }
+    std::uint64_t min() const noexcept { return _count ? _min : 0; }
+    double mean() const noexcept { return _count ? static_cast<double>(_total) / _count : 0; }
 
-        std::deque<ParamTupleType> _values;
-        std::string capitalize(int val, const std::string& word) {
-            return val == 1 ? "1 " + word : std::to_string(val) + " " + word + "s";
+    /**
+     The value that a fraction (between 0 and 1) of the recorded values are
+     less than or equal to, to within the bucket precision
+     */
+    std::uint64_t percentile(double fraction) const noexcept {
+        if(_count == 0) return 0;
+        const auto target = std::max<std::uint64_t>(
+            1, static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(_count))));
+        std::uint64_t seen = 0;
+        for(size_t i = 0; i < _counts.size(); ++i) {
+            seen += _counts[i];
+            if(seen >= target) return std::min(bucketHighest(i), _max);
         }
-    };
+        return _max;
+    }
+
+    std::uint64_t p50() const noexcept { return percentile(0.5); }
+    std::uint64_t p99() const noexcept { return percentile(0.99); }
+    std::uint64_t p999() const noexcept { return percentile(0.999); }
 
     /**
-     Constructor. Pass in the mock_ std::function to replace until
-     the end of scope.
+     A one-line summary, e.g. for printing at the end of a load test
      */
-    Mock(T& func):
-        _mockScope{func,
-            [this](auto... args) {
+    std::string report() const {
+        return "calls: " + std::to_string(_count) +
+            ", total: " + std::to_string(_total) + "ns" +
+            ", p50: " + std::to_string(p50()) + "ns" +
+            ", p99: " + std::to_string(p99()) + "ns" +
+            ", p999: " + std::to_string(p999()) + "ns" +
+            ", max: " + std::to_string(_max) + "ns";
+    }
 
-                _values.emplace_back(args...);
+private:
 
-                this->setOutputParameters<sizeof...(args)>(args...);
+    static constexpr int subBucketBits = 5;
+    static constexpr std::uint64_t subBuckets = 1 << subBucketBits;
+    static constexpr std::uint64_t linearLimit = 2 * subBuckets;
 
-                auto ret = _returns.at(0);
-                if(_returns.size() > 1) _returns.pop_front();
+    std::array<std::uint64_t, linearLimit + (64 - subBucketBits - 1) * subBuckets> _counts{};
+    std::uint64_t _count = 0;
+    std::uint64_t _total = 0;
+    std::uint64_t _max = 0;
+    std::uint64_t _min = ~std::uint64_t{0};
 
-                // it may seem odd to cast to the return type here, but the only
-                // reason it's needed is when the mocked function's return type
-                // is void. This makes it work
-                return static_cast<ReturnType>(ret);
-        }},
-    _returns(1) {
+    static int highestBit(std::uint64_t value) noexcept {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while(value >>= 1) ++bit;
+        return bit;
+#endif
+    }
 
+    static size_t bucketIndex(std::uint64_t value) noexcept {
+        if(value < linearLimit) return static_cast<size_t>(value);
+        const auto exponent = highestBit(value);
+        const auto mantissa = (value >> (exponent - subBucketBits)) & (subBuckets - 1);
+        return static_cast<size_t>(linearLimit + (exponent - subBucketBits - 1) * subBuckets + mantissa);
     }
 
-    /**
-     Set the next N return values
-     */
-    template<typename... A>
-    void returnValue(A&&... args) {
-        _returns.clear();
-        returnValueImpl(std::forward<A>(args)...);
+    static std::uint64_t bucketHighest(size_t index) noexcept {
+        if(index < linearLimit) return index;
+        const auto exponent = (index - linearLimit) / subBuckets + subBucketBits + 1;
+        const auto mantissa = (index - linearLimit) % subBuckets;
+        const auto shift = exponent - subBucketBits;
+        return ((subBuckets + mantissa + 1) << shift) - 1;
     }
+};
 
-    /**
-     Set the output parameter at position I
-    */
-    template<int I, typename A>
-    void outputParam(A valuePtr) {
-        outputArray<I>(valuePtr, 1);
+
+/**
+ A log with one writer and either any number of readers or one consumer,
+ none of which lock. The writer publishes entries by incrementing the size of
+ the chunk they're in. Readers see every entry and chunks are never moved or
+ freed until the log is, whereas a consumer sees each entry once and frees
+ the chunks it's done with.
+ */
+template<typename E>
+class ThreadLog {
+public:
+
+    ThreadLog(size_t chunkSize, std::atomic<size_t>& bytes):
+        _chunkSize{chunkSize},
+        _bytes(bytes),
+        _head{newChunk()},
+        _tail{_head} {
     }
 
-    template<size_t I, typename A>
-    void outputArray(A ptr, size_t length) {
-        std::get<I>(_outputs) = Slice<A>{ptr, length * sizeof(*ptr)};
+    ~ThreadLog() {
+        auto chunk = _head;
+        while(chunk) {
+            auto next = chunk->next.load(std::memory_order_acquire);
+            delete chunk;
+            chunk = next;
+        }
     }
 
+    ThreadLog(const ThreadLog&) = delete;
+    ThreadLog& operator=(const ThreadLog&) = delete;
+
     /**
-     Verify the mock was called n times. Returns a ParamChecker so that
-     assertions can be made on the passed in parameter values
+     Appends an entry. Only to be called by the writer.
      */
-    ParamChecker expectCalled(size_t n = 1) {
+    template<typename... A>
+    void emplace(A&&... args) {
+        auto size = _tail->size.load(std::memory_order_relaxed);
+        if(size == _chunkSize) {
+            auto chunk = newChunk();
+            _tail->next.store(chunk, std::memory_order_release);
+            _tail = chunk;
+            size = 0;
+        }
+        new(&_tail->entries[size]) E{std::forward<A>(args)...};
+        _tail->size.store(size + 1, std::memory_order_release);
+    }
 
-        if(_values.size() != n)
-            throw MockException(std::string{"Was not called enough times\n"} +
-                                "Expected: " + std::to_string(n) + "\n" +
-                                "Actual:   " + std::to_string(_values.size()) + "\n");
-        auto ret = _values;
-        _values.clear();
-        return ret;
+    /**
+     Calls func with the entries published so far, oldest first. Returns how
+     many there were. Not to be used on a log that's being consumed.
+     */
+    template<typename F>
+    size_t forEach(F func) const {
+        size_t seen = 0;
+        for(auto chunk = _head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            const auto size = chunk->size.load(std::memory_order_acquire);
+            for(size_t i = 0; i < size; ++i) func(chunk->entries[i]);
+            seen += size;
+        }
+        return seen;
     }
 
-    template<int N, typename A, typename... As>
-    std::enable_if_t<std::is_pointer<std::remove_reference_t<A>>::value && CanBeOverwritten<A>::value>
-    setOutputParameters(A outputParam, As&&... args) {
-        setOutputParametersImpl<N>(std::forward<A>(outputParam));
-        setOutputParameters<N - 1>(std::forward<As>(args)...);
+    /**
+     Calls func with the entries published since the last call, oldest
+     first, and frees the chunks that are all consumed. Only to be called by
+     the one consumer, which may move from the entries.
+     */
+    template<typename F>
+    void consume(F func) {
+        for(;;) {
+            const auto size = _head->size.load(std::memory_order_acquire);
+            for(; _consumed < size; ++_consumed) func(_head->entries[_consumed]);
+            if(size < _chunkSize) return;
+            // the writer has moved on from a full chunk once it links the next
+            const auto next = _head->next.load(std::memory_order_acquire);
+            if(!next) return;
+            delete _head;
+            _bytes.fetch_sub(_chunkSize * sizeof(E), std::memory_order_relaxed);
+            _head = next;
+            _consumed = 0;
+        }
     }
 
 private:
 
-    MockScope<T> _mockScope;
-    // the _returns would be static if'ed out for void return type if it were allowed in C++
-    // since it isn't, we change the return type to void* in that case
-    std::deque<std::conditional_t<std::is_void<ReturnType>::value, void*, ReturnType>> _returns;
-    std::deque<ParamTupleType> _values;
-    OutputTupleType _outputs{};
+    static_assert(alignof(E) <= alignof(std::max_align_t), "Over-aligned log entries aren't supported");
 
-    template<typename A, typename... As>
-    void returnValueImpl(A&& arg, As&&... args) {
-        _returns.emplace_back(arg);
-        returnValueImpl(std::forward<As>(args)...);
-    }
+    struct Chunk {
+        explicit Chunk(size_t capacity):
+            entries{static_cast<E*>(::operator new(capacity * sizeof(E)))} {
+        }
 
-    void returnValueImpl() {}
+        ~Chunk() {
+            const auto count = size.load(std::memory_order_relaxed);
+            for(size_t i = 0; i < count; ++i) entries[i].~E();
+            ::operator delete(entries);
+        }
+
+        E* entries;
+        std::atomic<size_t> size{0};
+        std::atomic<Chunk*> next{nullptr};
+    };
+
+    const size_t _chunkSize;
+    std::atomic<size_t>& _bytes;
+    Chunk* _head; // only changed by the consumer
+    Chunk* _tail;
+    size_t _consumed = 0; // entries of _head already consumed
+
+    Chunk* newChunk() {
+        auto chunk = new Chunk{_chunkSize};
+        _bytes.fetch_add(_chunkSize * sizeof(E), std::memory_order_relaxed);
+        return chunk;
+    }
+};
+
+
+/**
+ One ThreadLog per thread that writes to it. Only the first write from each
+ thread takes a lock, after that the thread finds its log in a small cache.
+ */
+template<typename E>
+class ThreadLogs {
+public:
+
+    explicit ThreadLogs(size_t chunkSize = 1024):
+        _chunkSize{chunkSize},
+        _id{nextId()} {
+    }
+
+    ThreadLogs(const ThreadLogs&) = delete;
+    ThreadLogs& operator=(const ThreadLogs&) = delete;
+
+    /**
+     The calling thread's log
+     */
+    ThreadLog<E>& local() {
+        auto& cached = threadCache()[_id % cacheSize];
+        if(cached.id != _id) cached = CacheEntry{_id, &find()};
+        return *cached.log;
+    }
+
+    /**
+     Calls func with every thread's log, in the order the threads first wrote
+     */
+    template<typename F>
+    void forEachLog(F func) const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        for(const auto& log: _logs) func(static_cast<const ThreadLog<E>&>(*log));
+    }
+
+    /**
+     Calls func with every thread's log for the consumer to consume
+     */
+    template<typename F>
+    void forEachLog(F func) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        for(const auto& log: _logs) func(*log);
+    }
+
+    /**
+     Memory allocated for entries by all threads
+     */
+    size_t bytes() const noexcept { return _bytes.load(std::memory_order_relaxed); }
+
+private:
+
+    static constexpr size_t cacheSize = 8;
+
+    // ids are never reused so a cache entry can't refer to a destroyed log
+    struct CacheEntry {
+        std::uint64_t id = 0;
+        ThreadLog<E>* log = nullptr;
+    };
+
+    const size_t _chunkSize;
+    const std::uint64_t _id;
+    std::atomic<size_t> _bytes{0};
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<ThreadLog<E>>> _logs;
+    std::vector<std::thread::id> _owners;
+
+    static std::uint64_t nextId() noexcept {
+        static std::atomic<std::uint64_t> id{0};
+        return ++id;
+    }
+
+    static std::array<CacheEntry, cacheSize>& threadCache() noexcept {
+        static thread_local std::array<CacheEntry, cacheSize> cache;
+        return cache;
+    }
+
+    // the thread may have written before and lost its cache entry to another log
+    ThreadLog<E>& find() {
+        const auto self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock{_mutex};
+        for(size_t i = 0; i < _owners.size(); ++i)
+            if(_owners[i] == self) return *_logs[i];
+        _logs.emplace_back(new ThreadLog<E>{_chunkSize, _bytes});
+        _owners.push_back(self);
+        return *_logs.back();
+    }
+};
+
+
+/**
+ A sequentially consistent fence. ThreadSanitizer doesn't support fences, so
+ under it this is a read-modify-write of one atomic shared by every caller,
+ which orders the callers the same way as far as they're concerned.
+ */
+inline void fullFence() noexcept {
+#if defined(PREMOCK_TSAN)
+    static std::atomic<int> fence{0};
+    fence.fetch_add(0, std::memory_order_seq_cst);
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+
+/**
+ The next number of a sequence shared by all mocks in all threads, which
+ tells the order calls to different mocks were made in
+ */
+inline std::uint64_t nextCallSequence() noexcept {
+    static std::atomic<std::uint64_t> sequence{0};
+    return sequence.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+/**
+ Somewhere other than a CallRecorder's own history to record calls into, such
+ as memory shared with other processes. The calls are moved into the history
+ when it's looked at.
+ */
+template<typename Tuple>
+class CallSink {
+public:
+
+    virtual ~CallSink() = default;
+
+    virtual void record(const Tuple& values) = 0;
+
+    /**
+     Calls func with each call recorded since the last time, in the order
+     they were made
+     */
+    virtual void collect(const std::function<void(const Tuple&)>& func) = 0;
+
+    virtual size_t bytes() const noexcept = 0;
+};
+
+
+/**
+ Records the parameter values a function is called with so that expectations
+ on them can be verified later. Shared by Mock and Spy.
+ */
+template<typename T>
+class CallRecorder: public CallHistory {
+public:
+
+    using ParamTupleType = typename StdFunctionTraits<T>::TupleType;
+
+    size_t historyBytes() const noexcept override {
+        return _values.size() * sizeof(ParamTupleType) +
+            (_sequence.size() + _timestamps.size()) * sizeof(std::uint64_t) +
+            (_threadLogs ? _threadLogs->bytes() : 0) +
+            (_sink ? _sink->bytes() : 0);
+    }
+
+    /**
+     Throws std::logic_error for calls recorded into a sink, which can't be
+     put in order with the calls to other mocks
+     */
+    const std::deque<std::uint64_t>& sequenceNumbers() const override {
+        if(_sink)
+            throw std::logic_error("Calls recorded into a CallSink, e.g. across processes, have no sequence numbers");
+        collect();
+        return _sequence;
+    }
+
+    /**
+     Record calls from any number of threads from now on. Each thread appends
+     to a log of its own, in chunks of chunkSize calls, and the only atomic
+     operation per call is taking a sequence number. The logs are merged in
+     sequence order when the calls are verified. Must be called before other
+     threads call the mock.
+     */
+    void recordConcurrently(size_t chunkSize = 1024) {
+        if(_threadLogs) return;
+        _threadLogs.reset(new ThreadLogs<Call>{chunkSize});
+        _waiting.reset(new Waiting);
+    }
+
+    /**
+     Record calls into sink from now on instead of the recorder's own
+     history, e.g. a SharedCallRing (premock_fork.hpp) for calls made by
+     child processes. The calls are in the order the sink gives them, but
+     there's nothing to order them with calls to other mocks by, so they
+     can't be passed to callOrder or expectInSequence, and they aren't
+     timestamped.
+     */
+    void recordInto(std::unique_ptr<CallSink<ParamTupleType>> sink) {
+        _sink = std::move(sink);
+    }
+
+    /**
+     Also record when each call was made from now on, in CycleClock ticks
+     */
+    void timestampCalls() {
+        _timestamping = true;
+    }
+
+    /**
+     When the calls recorded since the last call to `expectCalled` were made,
+     in CycleClock ticks. Only calls made after `timestampCalls` have one.
+     */
+    const std::deque<std::uint64_t>& timestamps() const {
+        collect();
+        return _timestamps;
+    }
+
+    /**
+     Enables checks on parameter values passed to function invocations
+     */
+    class ParamChecker {
+    public:
+
+        ParamChecker(std::deque<ParamTupleType> v):_values{std::move(v)} {}
+
+        /**
+         Verifies the parameter values passed in the last invocation
+         */
+        template<typename... A>
+        void withValues(A&&... args) {
+            withValues({std::make_tuple(std::forward<A>(args)...)}, _values.size() - 1, _values.size());
+        }
+
+        /**
+         Verifies the parameter values passed in all invocations since the last
+         call to `expectCalled`, optionally between the start-th and end-th
+         invocations
+         */
+        void withValues(std::initializer_list<ParamTupleType> args,
+                        size_t start = 0, size_t end = 0) {
+
+            if(end == 0) end = _values.size();
+            std::deque<ParamTupleType> expected{std::move(args)};
+
+            const auto expectedArgsSize = end - start;
+            if(expected.size() != expectedArgsSize)
+                throw std::logic_error("ParamChecker::withValues called with " +
+                                       capitalize(expected.size(), "value") + ", expected " +
+                                       std::to_string(expectedArgsSize));
+
+            for(size_t i = start; i < end; ++i) {
+                const auto& expValues = expected.at(i - start);
+                const auto& actValues = _values.at(i);
+                if(expValues != actValues)
+                    throw MockException(std::string{"Invocation values do not match\n"} +
+                                        "Expected: " + toString(expValues) + "\n" +
+                                        "Actual:   " + toString(actValues) + "\n");
+            }
+        }
+
+    private:
+
+        std::deque<ParamTupleType> _values;
+        std::string capitalize(int val, const std::string& word) {
+            return val == 1 ? "1 " + word : std::to_string(val) + " " + word + "s";
+        }
+    };
+
+    /**
+     Verify the mock was called n times. Returns a ParamChecker so that
+     assertions can be made on the passed in parameter values
+     */
+    ParamChecker expectCalled(size_t n = 1) {
+
+        collect();
+        if(_values.size() != n)
+            throw MockException(std::string{"Was not called enough times\n"} +
+                                "Expected: " + std::to_string(n) + "\n" +
+                                "Actual:   " + std::to_string(_values.size()) + "\n");
+        ParamChecker ret{std::move(_values)};
+        _values.clear();
+        _sequence.clear();
+        _timestamps.clear();
+        _collecting.shrink_to_fit();
+        _merged.shrink_to_fit();
+        return ret;
+    }
+
+    /**
+     Like expectCalled, but for calls made by other threads: waits until the
+     mock has been called n times or until timeout runs out, whichever comes
+     first. Needs recordConcurrently to have been called before the calls.
+     */
+    template<typename Rep, typename Period>
+    ParamChecker expectCalledWithin(size_t n, std::chrono::duration<Rep, Period> timeout) {
+        if(!_threadLogs)
+            throw std::logic_error("expectCalledWithin needs recordConcurrently to be called first");
+
+        const auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+        std::unique_lock<std::mutex> lock{_waiting->mutex};
+        for(collect(); _values.size() < n; collect()) {
+            if(std::chrono::steady_clock::now() >= deadline) break;
+            // with the fence in record, every call either is collected below
+            // or sees remaining and counts it down. Calls that do both count
+            // twice, which can only wake this thread early.
+            const auto collected = _values.size();
+            _waiting->remaining.store(static_cast<std::int64_t>(n - collected));
+            fullFence();
+            collect();
+            if(_values.size() >= n) break;
+            const auto newlyCollected = static_cast<std::int64_t>(_values.size() - collected);
+            if(_waiting->remaining.fetch_sub(newlyCollected) <= newlyCollected) continue;
+            _waiting->called.wait_until(lock, deadline);
+        }
+        _waiting->remaining.store(0);
+        lock.unlock();
+
+        return expectCalled(n);
+    }
+
+protected:
+
+    template<typename... A>
+    void record(const A&... args) {
+        if(_sink) {
+            _sink->record(ParamTupleType{args...});
+            return;
+        }
+        if(_threadLogs) {
+            _threadLogs->local().emplace(nextCallSequence(), _timestamping ? CycleClock::now() : 0,
+                                         ParamTupleType{args...});
+            // pairs with the fence in expectCalledWithin so that the waiter
+            // either collects this call or is counted down by it. All waiting
+            // costs when nobody's waiting is the fence and a load, and the
+            // waiter is only woken up by the call it's waiting for.
+            fullFence();
+            if(_waiting->remaining.load(std::memory_order_relaxed) > 0 &&
+               _waiting->remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock{_waiting->mutex};
+                _waiting->called.notify_all();
+            }
+            return;
+        }
+        _values.emplace_back(args...);
+        _sequence.push_back(nextCallSequence());
+        if(_timestamping) _timestamps.push_back(CycleClock::now());
+    }
+
+    /**
+     Discards the calls recorded so far without freeing the memory they took,
+     for recorders that only keep the calls of the latest run
+     */
+    void forgetCalls() {
+        collect();
+        _values.clear();
+        _sequence.clear();
+        _timestamps.clear();
+    }
+
+private:
+
+    struct Call {
+        std::uint64_t sequence;
+        std::uint64_t timestamp; // 0 if not timestamping
+        ParamTupleType values;
+    };
+
+    // for expectCalledWithin, which waits for calls recorded concurrently
+    struct Waiting {
+        std::mutex mutex;
+        std::condition_variable called;
+        std::atomic<std::int64_t> remaining{0}; // calls until the waiter has enough
+    };
+
+    // calls recorded concurrently are moved here when they're looked at
+    mutable std::deque<ParamTupleType> _values;
+    mutable std::deque<std::uint64_t> _sequence;
+    mutable std::deque<std::uint64_t> _timestamps;
+    bool _timestamping = false;
+    std::unique_ptr<ThreadLogs<Call>> _threadLogs;
+    std::unique_ptr<Waiting> _waiting;
+    mutable std::vector<Call> _collecting; // reused by collect
+    mutable std::vector<Call*> _merged;
+    mutable std::vector<size_t> _runs;
+    std::unique_ptr<CallSink<ParamTupleType>> _sink;
+
+    // Each log is in sequence order, so the calls that are new since last
+    // time come in one sorted run per thread and only need merging. Calls
+    // still being recorded by other threads are picked up next time. The
+    // logs free what's been collected.
+    void collect() const {
+        if(_sink) {
+            _sink->collect([this](const ParamTupleType& values) { _values.push_back(values); });
+        }
+        if(!_threadLogs) return;
+
+        _collecting.clear();
+        _runs.assign(1, 0);
+        _threadLogs->forEachLog([this](ThreadLog<Call>& log) {
+            log.consume([this](Call& call) { _collecting.push_back(std::move(call)); });
+            _runs.push_back(_collecting.size());
+        });
+
+        // the values may not be assignable, so it's pointers to them that are merged
+        _merged.clear();
+        for(auto& call: _collecting) _merged.push_back(&call);
+        const auto bySequence = [](const Call* lhs, const Call* rhs) { return lhs->sequence < rhs->sequence; };
+        for(size_t i = 2; i < _runs.size(); ++i)
+            std::inplace_merge(_merged.begin(), _merged.begin() + _runs[i - 1], _merged.begin() + _runs[i], bySequence);
+
+        for(const auto call: _merged) {
+            _values.push_back(std::move(call->values));
+            _sequence.push_back(call->sequence);
+            if(call->timestamp) _timestamps.push_back(call->timestamp);
+        }
+        _merged.clear();
+        _collecting.clear();
+    }
+};
+
+
+/**
+ A bounded lock-free queue for any number of producer and consumer threads.
+ Each slot has a sequence number that says whose turn it is: producers and
+ consumers claim positions with a CAS on their own counter and then wait for
+ nothing but the slot. Counts the CASes that had to be retried, a measure of
+ how contended the queue is.
+ */
+template<typename V>
+class ConcurrentQueue {
+public:
+
+    /**
+     Holds at least capacity values
+     */
+    explicit ConcurrentQueue(size_t capacity):
+        _mask{roundUp(capacity) - 1},
+        _slots{new Slot[_mask + 1]} {
+        for(size_t i = 0; i <= _mask; ++i) _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ConcurrentQueue(const ConcurrentQueue&) = delete;
+    ConcurrentQueue& operator=(const ConcurrentQueue&) = delete;
+
+    size_t capacity() const noexcept { return _mask + 1; }
+
+    /**
+     Returns false if the queue is full
+     */
+    bool push(V value) {
+        auto position = _tail.position.load(std::memory_order_relaxed);
+        Slot* slot;
+        if(!claim(_tail.position, position, 0, slot)) return false;
+        slot->value = std::move(value);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     Returns false if the queue is empty
+     */
+    bool pop(V& value) {
+        auto position = _head.position.load(std::memory_order_relaxed);
+        Slot* slot;
+        if(!claim(_head.position, position, 1, slot)) return false;
+        value = std::move(slot->value);
+        slot->sequence.store(position + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    void clear() {
+        V value;
+        while(pop(value)) {}
+    }
+
+    /**
+     How many times a push or pop lost a race for a position and tried again
+     */
+    std::uint64_t retries() const noexcept { return _retries.load(std::memory_order_relaxed); }
+
+private:
+
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        V value{};
+    };
+
+    // kept on cache lines of their own so that producers and consumers
+    // don't slow each other down
+    struct Counter {
+        char before[64];
+        std::atomic<size_t> position{0};
+        char after[64 - sizeof(std::atomic<size_t>)];
+    };
+
+    size_t _mask;
+    std::unique_ptr<Slot[]> _slots;
+    Counter _tail;
+    Counter _head;
+    std::atomic<std::uint64_t> _retries{0};
+
+    static size_t roundUp(size_t capacity) noexcept {
+        size_t result = 1;
+        while(result < capacity) result *= 2;
+        return result;
+    }
+
+    // The slot at position is ready for a producer when its sequence number
+    // is position and for a consumer when it's position + 1. Less than that
+    // means the queue is full (or empty), more that another thread got there
+    // first.
+    bool claim(std::atomic<size_t>& counter, size_t& position, size_t ready, Slot*& slot) {
+        std::uint64_t retries = 0;
+        for(;;) {
+            slot = &_slots[position & _mask];
+            const auto sequence = slot->sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - (position + ready));
+            if(difference == 0) {
+                if(counter.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                ++retries;
+            } else if(difference < 0) {
+                if(retries) _retries.fetch_add(retries, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = counter.load(std::memory_order_relaxed);
+                ++retries;
+            }
+        }
+        if(retries) _retries.fetch_add(retries, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+
+/**
+ A mock class to verify expectations of how the mock was called.
+ Supports verification of the number of times called, setting
+ return values and checking the values passed to it.
+ */
+template<typename T>
+class Mock: public CallRecorder<T> {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+    using OutputTupleType = typename StdFunctionTraits<T>::OutputTupleType;
+
+    /**
+     Constructor. Pass in the mock_ std::function to replace until
+     the end of scope.
+     */
+    Mock(T& func):
+        _mockScope{func,
+            [this](auto... args) {
+
+                this->record(args...);
+
+                this->setOutputParameters<sizeof...(args)>(args...);
+
+                auto ret = nextReturnValue();
+
+                // it may seem odd to cast to the return type here, but the only
+                // reason it's needed is when the mocked function's return type
+                // is void. This makes it work
+                return static_cast<ReturnType>(ret);
+        }},
+    _returns(1) {
+
+        _mockScope.setHistory(this);
+    }
+
+    /**
+     Set the next N return values
+     */
+    template<typename... A>
+    void returnValue(A&&... args) {
+        _returns.clear();
+        returnValueImpl(std::forward<A>(args)...);
+        if(_returnQueue) queueReturnValues();
+    }
+
+    /**
+     Let any number of threads take return values from now on, each value
+     set with `returnValue` going to exactly one call except for the last,
+     which sticks as before. The values are kept in a lock-free queue, so
+     `returnValue` must not be called while other threads call the mock.
+     */
+    void returnConcurrently() {
+        if(_returnQueue) return;
+        queueReturnValues();
+    }
+
+    /**
+     How many times threads taking return values concurrently had to retry
+     because another thread took the same one first
+     */
+    std::uint64_t returnRetries() const noexcept {
+        return _returnQueue ? _returnQueue->retries() : 0;
+    }
+
+    /**
+     Set the output parameter at position I
+    */
+    template<int I, typename A>
+    void outputParam(A valuePtr) {
+        outputArray<I>(valuePtr, 1);
+    }
+
+    template<size_t I, typename A>
+    void outputArray(A ptr, size_t length) {
+        std::get<I>(_outputs) = Slice<A>{ptr, length * sizeof(*ptr)};
+    }
+
+    template<int N, typename A, typename... As>
+    std::enable_if_t<std::is_pointer<std::remove_reference_t<A>>::value && CanBeOverwritten<A>::value>
+    setOutputParameters(A outputParam, As&&... args) {
+        setOutputParametersImpl<N>(std::forward<A>(outputParam));
+        setOutputParameters<N - 1>(std::forward<As>(args)...);
+    }
+
+private:
+
+    MockScope<T> _mockScope;
+    // the _returns would be static if'ed out for void return type if it were allowed in C++
+    // since it isn't, we change the return type to void* in that case
+    std::deque<ReturnValueType<ReturnType>> _returns;
+    // all but the last return value when returning concurrently, _returns
+    // then only has the one that sticks
+    std::unique_ptr<ConcurrentQueue<ReturnValueType<ReturnType>>> _returnQueue;
+    OutputTupleType _outputs{};
+
+    ReturnValueType<ReturnType> nextReturnValue() {
+        if(_returnQueue) {
+            ReturnValueType<ReturnType> value;
+            if(_returnQueue->pop(value)) return value;
+            return _returns.at(0);
+        }
+        auto ret = _returns.at(0);
+        if(_returns.size() > 1) _returns.pop_front();
+        return ret;
+    }
+
+    void queueReturnValues() {
+        if(!_returnQueue || _returnQueue->capacity() < _returns.size())
+            _returnQueue.reset(new ConcurrentQueue<ReturnValueType<ReturnType>>{_returns.size()});
+        _returnQueue->clear();
+        while(_returns.size() > 1) {
+            _returnQueue->push(_returns.front());
+            _returns.pop_front();
+        }
+    }
+
+    template<typename A, typename... As>
+    void returnValueImpl(A&& arg, As&&... args) {
+        _returns.emplace_back(arg);
+        returnValueImpl(std::forward<As>(args)...);
+    }
+
+    void returnValueImpl() {}
 
     template<int N, typename A>
     std::enable_if_t<std::is_pointer<std::remove_reference_t<A>>::value && CanBeOverwritten<A>::value>
@@ -443,6 +1483,145 @@ private:
 
 
 
+/**
+ A spy records calls like a Mock but then forwards them to the implementation
+ it displaced (usually the real function), so that a dependency can be
+ observed without changing its behaviour.
+ */
+template<typename T>
+class Spy: public CallRecorder<T> {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+
+    /**
+     Constructor. Pass in the mock_ std::function to spy on until
+     the end of scope.
+     */
+    Spy(T& func):
+        _mockScope{func, [this](auto&&... args) -> ReturnType {
+                this->record(args...);
+                Timer timer{_timings.get()};
+                return _mockScope.displaced()(std::forward<decltype(args)>(args)...);
+            }} {
+        _mockScope.setHistory(this);
+    }
+
+    /**
+     Time every forwarded call from now on, from any number of threads. Costs
+     two reads of CycleClock per call, and each thread logs its timings to a
+     log of its own that's only allocated a chunk at a time. Must be called
+     before other threads call the spy.
+     */
+    void timeCalls() {
+        CycleClock::nanosecondsPerTick(); // calibrate now, not in the first call
+        if(_timings) return;
+        _latencies.reset(new LatencyHistogram);
+        _timings.reset(new ThreadLogs<std::uint64_t>);
+    }
+
+    /**
+     How long the forwarded calls took since timeCalls was called, including
+     those still being made by other threads as far as they've got
+     */
+    const LatencyHistogram& latencies() const {
+        if(!_timings) throw std::logic_error("Spy::latencies called without calling timeCalls first");
+        _timings->forEachLog([this](ThreadLog<std::uint64_t>& log) {
+            log.consume([this](std::uint64_t nanoseconds) { _latencies->record(nanoseconds); });
+        });
+        return *_latencies;
+    }
+
+private:
+
+    // times a forwarded call into the calling thread's log, if timing
+    class Timer {
+    public:
+
+        explicit Timer(ThreadLogs<std::uint64_t>* timings) noexcept:
+            _timings{timings},
+            _start{timings ? CycleClock::now() : 0} {
+        }
+
+        ~Timer() {
+            if(_timings) _timings->local().emplace(CycleClock::toNanoseconds(CycleClock::now() - _start));
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+
+        ThreadLogs<std::uint64_t>* _timings;
+        std::uint64_t _start;
+    };
+
+    std::unique_ptr<ThreadLogs<std::uint64_t>> _timings;
+    std::unique_ptr<LatencyHistogram> _latencies; // the timings merged so far
+    MockScope<T> _mockScope;
+};
+
+
+/**
+ The order calls to several mocks or spies were made in: for each call, the
+ position of the one it was made to. Each history is already sorted, so
+ merging them takes time linear in the number of calls.
+ */
+inline std::vector<size_t> mergeCallOrder(const std::vector<const CallHistory*>& histories) {
+    // looked up once, as that collects calls recorded concurrently
+    std::vector<const std::deque<std::uint64_t>*> sequences;
+    for(const auto history: histories) sequences.push_back(&history->sequenceNumbers());
+
+    std::vector<size_t> next(histories.size(), 0);
+    std::vector<size_t> order;
+    for(;;) {
+        auto earliest = histories.size();
+        std::uint64_t lowest = 0;
+        for(size_t i = 0; i < histories.size(); ++i) {
+            const auto& sequence = *sequences[i];
+            if(next[i] == sequence.size()) continue;
+            if(earliest == histories.size() || sequence[next[i]] < lowest) {
+                earliest = i;
+                lowest = sequence[next[i]];
+            }
+        }
+        if(earliest == histories.size()) return order;
+        order.push_back(earliest);
+        ++next[earliest];
+    }
+}
+
+/**
+ The order calls to the given mocks or spies were made in, as positions in
+ the argument list
+ */
+template<typename... H>
+std::vector<size_t> callOrder(const H&... histories) {
+    return mergeCallOrder({static_cast<const CallHistory*>(&histories)...});
+}
+
+/**
+ Verify that all calls to the first mock or spy were made before any call to
+ the second, and so on. Must be called before `expectCalled`, which forgets
+ the calls it checked.
+ */
+template<typename... H>
+void expectInSequence(const H&... histories) {
+    const auto order = callOrder(histories...);
+    if(std::is_sorted(order.begin(), order.end())) return;
+
+    std::string expected;
+    std::string actual;
+    for(size_t i = 0; i < sizeof...(histories); ++i)
+        expected += (i ? ", then #" : "#") + std::to_string(i + 1);
+    for(const auto position: order)
+        actual += (actual.empty() ? "#" : " #") + std::to_string(position + 1);
+    throw MockException(std::string{"Calls were not in sequence\n"} +
+                        "Expected: " + expected + "\n" +
+                        "Actual:   " + actual + "\n");
+}
+
+
 /**
  Helper function to create a Mock<T>
  */
@@ -456,6 +1635,372 @@ Mock<T> mock(T& func) {
  */
 #define MOCK(func) mock(mock_##func)
 
+/**
+ Helper function to create a Spy<T>
+ */
+template<typename T>
+Spy<T> spy(T& func) {
+    return {func};
+}
+
+/**
+ Helper macro to spy on a particular "real" function
+ */
+#define SPY(func) spy(mock_##func)
+
+
+/**
+ Counters that threads increment without contending with each other: each
+ thread increments its own copy of every counter, without a lock or a shared
+ cache line, and reading one sums the copies of all the threads, including
+ those that have exited since.
+ */
+class ThreadCounters {
+public:
+
+    /**
+     A new counter, identified by its index
+     */
+    static size_t add() noexcept {
+        static std::atomic<size_t> counters{0};
+        return counters++;
+    }
+
+    static void increment(size_t counter) {
+        auto& block = local();
+        auto* chunk = block.chunks[counter / chunkSize].load(std::memory_order_relaxed);
+        if(!chunk) chunk = block.allocate(counter / chunkSize);
+        auto& count = chunk[counter % chunkSize];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t sum(size_t counter) {
+        auto& all = registry();
+        std::lock_guard<std::mutex> lock{all.mutex};
+        auto total = all.exited.get(counter);
+        for(const auto block: all.blocks) total += block->get(counter);
+        return total;
+    }
+
+private:
+
+    static constexpr size_t chunkSize = 256;
+    static constexpr size_t maxChunks = 256;
+
+    // one thread's copies of the counters, allocated a chunk at a time as the
+    // thread uses them
+    struct Block {
+        std::array<std::atomic<std::atomic<std::uint64_t>*>, maxChunks> chunks{};
+
+        Block() = default;
+        Block(const Block&) = delete;
+        Block& operator=(const Block&) = delete;
+
+        ~Block() {
+            for(auto& chunk: chunks) delete[] chunk.load(std::memory_order_relaxed);
+        }
+
+        std::atomic<std::uint64_t>* allocate(size_t index) {
+            if(index >= maxChunks) throw std::length_error("Too many mocks to count calls for");
+            auto chunk = new std::atomic<std::uint64_t>[chunkSize]();
+            chunks[index].store(chunk, std::memory_order_release);
+            return chunk;
+        }
+
+        std::uint64_t get(size_t counter) const noexcept {
+            if(counter / chunkSize >= maxChunks) return 0;
+            const auto chunk = chunks[counter / chunkSize].load(std::memory_order_acquire);
+            return chunk ? chunk[counter % chunkSize].load(std::memory_order_relaxed) : 0;
+        }
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Block*> blocks; // of the threads still running
+        Block exited;               // what the threads that exited counted
+    };
+
+    // registers the calling thread's block while the thread runs, and adds
+    // its counts to the exited ones when it ends
+    struct Local: Block {
+        Local() {
+            auto& all = registry();
+            std::lock_guard<std::mutex> lock{all.mutex};
+            all.blocks.push_back(this);
+        }
+
+        ~Local() {
+            auto& all = registry();
+            std::lock_guard<std::mutex> lock{all.mutex};
+            all.blocks.erase(std::find(all.blocks.begin(), all.blocks.end(), this));
+            for(size_t i = 0; i < maxChunks; ++i) {
+                const auto chunk = chunks[i].load(std::memory_order_relaxed);
+                if(!chunk) continue;
+                auto exited = all.exited.chunks[i].load(std::memory_order_relaxed);
+                if(!exited) exited = all.exited.allocate(i);
+                for(size_t j = 0; j < chunkSize; ++j)
+                    exited[j].store(exited[j].load(std::memory_order_relaxed) + chunk[j].load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // never destroyed, since threads and atexit handlers registered before
+    // it was constructed may still count or sum after static destructors run
+    static Registry& registry() {
+        static Registry& registry = *new Registry;
+        return registry;
+    }
+
+    static Local& local() {
+        static thread_local Local block;
+        return block;
+    }
+};
+
+
+/**
+ Identifies a mock defined with IMPL_MOCK or IMPL_MOCK_DEFAULT. Each one is
+ a static object that adds itself to the list of all mocks before main and
+ counts the calls made through the ut_premock_ function, per thread so that
+ threads calling the same mock don't contend on the count.
+ */
+class MockRegistration {
+public:
+
+    MockRegistration(const char* name, void* (*mock)(), std::function<void()> (*capture)()):
+        _name{name},
+        _mock{mock},
+        _capture{capture},
+        _default{capture()},
+        _counter{ThreadCounters::add()},
+        _next{first()} {
+        first() = this;
+    }
+
+    MockRegistration(const MockRegistration&) = delete;
+    MockRegistration& operator=(const MockRegistration&) = delete;
+
+    const char* name() const noexcept { return _name; }
+
+    /**
+     The mock_ variable of the calling thread
+     */
+    void* mock() const { return _mock(); }
+
+    /**
+     Copies the implementation in the calling thread's mock_ variable into
+     a function that installs it in the mock_ variable of whichever thread
+     calls that
+     */
+    std::function<void()> capture() const { return _capture(); }
+
+    /**
+     Installs the implementation the mock had before anything replaced it,
+     as captured during static initialisation, in the calling thread's mock_
+     variable
+     */
+    void restoreDefault() const { _default(); }
+
+    /**
+     Calls made through the ut_premock_ function, by all threads
+     */
+    std::uint64_t calls() const { return ThreadCounters::sum(_counter); }
+
+    void called() { ThreadCounters::increment(_counter); }
+
+    const MockRegistration* next() const noexcept { return _next; }
+
+    static MockRegistration*& first() noexcept {
+        static MockRegistration* registration = nullptr;
+        return registration;
+    }
+
+private:
+
+    const char* _name;
+    void* (*_mock)();
+    std::function<void()> (*_capture)();
+    std::function<void()> _default;
+    size_t _counter;
+    MockRegistration* _next;
+};
+
+
+/**
+ All the mocks linked into the binary, for resetting them in bulk and for
+ finding out which ones tests use
+ */
+class MockRegistry {
+public:
+
+    /**
+     What is known about one mock. Scope depth and history size are for the
+     calling thread.
+     */
+    struct Stats {
+        std::string name;
+        std::uint64_t calls;
+        size_t historyBytes;
+        size_t scopeDepth;
+    };
+
+    /**
+     Calls func with every registered mock
+     */
+    template<typename F>
+    static void forEach(F func) {
+        for(const MockRegistration* registration = MockRegistration::first(); registration;
+            registration = registration->next())
+            func(*registration);
+    }
+
+    static size_t size() noexcept {
+        size_t count = 0;
+        forEach([&count](const MockRegistration&) { ++count; });
+        return count;
+    }
+
+    /**
+     Returns the mock registered for function name, or nullptr
+     */
+    static const MockRegistration* find(const std::string& name) noexcept {
+        const MockRegistration* found = nullptr;
+        forEach([&](const MockRegistration& registration) {
+            if(name == registration.name()) found = &registration;
+        });
+        return found;
+    }
+
+    /**
+     Undoes every REPLACE, MOCK, SPY etc. still in effect on this thread,
+     restoring the mocks to their defaults. Takes time proportional to the
+     number of replacements, not to the number of mocks. Returns how many
+     replacements were undone.
+     */
+    static size_t resetOverrides() noexcept {
+        return MockScopeBase::restoreAll();
+    }
+
+    /**
+     The names of the mocks that were never called through their ut_premock_
+     function
+     */
+    static std::vector<std::string> neverCalled() {
+        std::vector<std::string> names;
+        forEach([&names](const MockRegistration& registration) {
+            if(registration.calls() == 0) names.emplace_back(registration.name());
+        });
+        return names;
+    }
+
+    static std::vector<Stats> stats() {
+        std::vector<Stats> result;
+        forEach([&result](const MockRegistration& registration) {
+            Stats stats{registration.name(), registration.calls(), 0, 0};
+            // the common case of no active scopes doesn't touch the thread local mocks
+            MockScopeBase::forEachActive([&](const MockScopeBase& scope) {
+                if(scope.target() != registration.mock()) return;
+                ++stats.scopeDepth;
+                if(scope.history()) stats.historyBytes += scope.history()->historyBytes();
+            });
+            result.push_back(std::move(stats));
+        });
+        return result;
+    }
+
+    /**
+     The stats of all mocks as JSON:
+     {"mocks":[{"name":"send","calls":3,"historyBytes":0,"scopeDepth":0},...]}
+     */
+    static std::string statsJson() {
+        std::string json{"{\"mocks\":["};
+        bool first = true;
+        for(const auto& stats: MockRegistry::stats()) {
+            if(!first) json += ",";
+            first = false;
+            json += "\n{\"name\":\"" + stats.name + "\"" +
+                ",\"calls\":" + std::to_string(stats.calls) +
+                ",\"historyBytes\":" + std::to_string(stats.historyBytes) +
+                ",\"scopeDepth\":" + std::to_string(stats.scopeDepth) + "}";
+        }
+        return json + "\n]}\n";
+    }
+
+    /**
+     Writes statsJson to fileName when the process exits
+     */
+    static void dumpStatsAtExit(std::string fileName) {
+        const bool registered = !exitFileName().empty();
+        exitFileName() = std::move(fileName);
+        if(registered) return;
+        std::atexit([] {
+            std::ofstream file{exitFileName()};
+            file << statsJson();
+        });
+    }
+
+private:
+
+    static std::string& exitFileName() {
+        static std::string fileName;
+        return fileName;
+    }
+};
+
+
+/**
+ Copies of the mocks replaced on the thread that creates it, to be installed
+ in another thread. Each thread has mocks of its own otherwise, since their
+ storage is thread_local.
+ */
+class MockSnapshot {
+public:
+
+    /**
+     Captures every registered mock with a REPLACE, MOCK, SPY etc. in effect
+     on the calling thread, or installed there from another snapshot
+     */
+    MockSnapshot() {
+        std::vector<const void*> targets;
+        MockScopeBase::forEachActive([&targets](const MockScopeBase& scope) { targets.push_back(scope.target()); });
+        for(const auto registration: inherited()) targets.push_back(registration->mock());
+        if(targets.empty()) return;
+
+        MockRegistry::forEach([&](const MockRegistration& registration) {
+            if(std::find(targets.begin(), targets.end(), registration.mock()) == targets.end()) return;
+            _registrations.push_back(&registration);
+            _installers.push_back(registration.capture());
+        });
+    }
+
+    /**
+     Replaces the calling thread's mocks with the captured ones. They stay
+     replaced until the thread exits.
+     */
+    void install() const {
+        for(const auto& installer: _installers) installer();
+        auto& installed = inherited();
+        installed.insert(installed.end(), _registrations.begin(), _registrations.end());
+    }
+
+    /**
+     How many mocks were captured
+     */
+    size_t size() const noexcept { return _installers.size(); }
+
+private:
+
+    std::vector<const MockRegistration*> _registrations;
+    std::vector<std::function<void()>> _installers;
+
+    // the mocks installed in this thread, so that they're passed on in turn
+    static std::vector<const MockRegistration*>& inherited() {
+        static thread_local std::vector<const MockRegistration*> registrations;
+        return registrations;
+    }
+};
+
 /**
  Traits class for function pointers
  */
@@ -483,6 +2028,41 @@ struct FunctionTraits<R(*)(A...)> {
     };
 };
 
+#ifdef __cpp_noexcept_function_type
+// most libc functions are declared noexcept when compiled as C++, and from
+// C++17 on that is part of the function type
+template<typename R, typename... A>
+struct FunctionTraits<R(*)(A...) noexcept>: FunctionTraits<R(*)(A...)> {};
+#endif
+
+/**
+ Returns the plain function pointer type of its argument. Going through template
+ argument deduction strips attributes that some headers attach to function types
+ (e.g. nonnull on clock_gettime), which would otherwise cause warnings whenever
+ the type is used as a template argument.
+ */
+template<typename R, typename... A>
+R (*plainFunctionPointer(R(*)(A...)))(A...);
+
+#define PREMOCK_FUNCTION_TYPE(func) decltype(plainFunctionPointer(&func))
+
+
+/**
+ The address the last ut_premock_ function called on this thread returns to,
+ i.e. the call site in the production code. Set by every trampoline so that
+ mocks can tell apart the places they're called from.
+ */
+inline const void*& premockCallSite() noexcept {
+    static thread_local const void* callSite = nullptr;
+    return callSite;
+}
+
+#ifdef _MSC_VER
+#    define PREMOCK_RETURN_ADDRESS() _ReturnAddress()
+#else
+#    define PREMOCK_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
 
 /**
  Declares a mock function for "real" function func. This is simply the
@@ -492,9 +2072,22 @@ struct FunctionTraits<R(*)(A...)> {
 
  Then DECL_MOCK(foo) is:
 
+ extern MockRegistration premock_registration_foo;
  extern std::function<int(int, float)> mock_foo;
  */
-#define DECL_MOCK(func) extern "C" thread_local FunctionTraits<decltype(&func)>::StdFunctionType mock_##func
+#define DECL_MOCK(func) \
+    extern "C" MockRegistration premock_registration_##func; \
+    extern "C" thread_local FunctionTraits<PREMOCK_FUNCTION_TYPE(func)>::StdFunctionType mock_##func
+
+/**
+ Definition of the object registering the mock for func with MockRegistry
+ */
+#define MOCK_REGISTRATION(func) \
+    MockRegistration premock_registration_##func{#func, []() -> void* { return &mock_##func; }, \
+        []() -> std::function<void()> { \
+            auto impl = mock_##func; \
+            return [impl] { mock_##func = impl; }; \
+        }}
 
 /**
  Definition of the std::function that will store the implementation. e.g. given:
@@ -535,7 +2128,7 @@ struct FunctionTraits<R(*)(A...)> {
  UT_FUNC_TYPE_AND_ARG(foo, 0) = int arg_0
  UT_FUNC_TYPE_AND_ARG(foo, 1) = float arg_1
  */
-#define UT_FUNC_TYPE_AND_ARG(func, index) FunctionTraits<decltype(&func)>::Arg<index>::Type UT_FUNC_ARG(index)
+#define UT_FUNC_TYPE_AND_ARG(func, index) FunctionTraits<PREMOCK_FUNCTION_TYPE(func)>::Arg<index>::Type UT_FUNC_ARG(index)
 
 
 /**
@@ -600,16 +2193,22 @@ struct FunctionTraits<R(*)(A...)> {
  assuming the macro is used in an extern "C" block:
 
  extern "C" ssize_t ut_premock_send(int arg0, const void* arg1, size_t arg2, int arg3) {
+     premockCallSite() = __builtin_return_address(0);
+     premock_registration_send.called();
      return mock_send(arg0, arg1, arg2, arg3);
  }
+ MockRegistration premock_registration_send{"send", ...};
  std::function<ssize_t(int, const void*, size_t, int)> mock_send = send
 
 
  */
 #define IMPL_MOCK_DEFAULT(num_args, func) \
-    FunctionTraits<decltype(&func)>::ReturnType ut_premock_##func(UT_FUNC_ARGS_##num_args(func)) { \
+    FunctionTraits<PREMOCK_FUNCTION_TYPE(func)>::ReturnType ut_premock_##func(UT_FUNC_ARGS_##num_args(func)) { \
+        premockCallSite() = PREMOCK_RETURN_ADDRESS(); \
+        premock_registration_##func.called(); \
         return mock_##func(UT_FUNC_FWD_##num_args); \
     } \
+    MOCK_REGISTRATION(func); \
     MOCK_STORAGE_DEFAULT(func)
 
 /**
@@ -632,16 +2231,22 @@ struct FunctionTraits<R(*)(A...)> {
  assuming the macro is used in an extern "C" block:
 
  extern "C" ssize_t ut_premock_send(int arg0, const void* arg1, size_t arg2, int arg3) {
+     premockCallSite() = __builtin_return_address(0);
+     premock_registration_send.called();
      return mock_send(arg0, arg1, arg2, arg3);
  }
+ MockRegistration premock_registration_send{"send", ...};
  std::function<ssize_t(int, const void*, size_t, int)> mock_send = send
 
 
  */
 #define IMPL_MOCK(num_args, func) \
-    FunctionTraits<decltype(&func)>::ReturnType ut_premock_##func(UT_FUNC_ARGS_##num_args(func)) { \
+    FunctionTraits<PREMOCK_FUNCTION_TYPE(func)>::ReturnType ut_premock_##func(UT_FUNC_ARGS_##num_args(func)) { \
+        premockCallSite() = PREMOCK_RETURN_ADDRESS(); \
+        premock_registration_##func.called(); \
         return mock_##func(UT_FUNC_FWD_##num_args); \
     } \
+    MOCK_REGISTRATION(func); \
     MOCK_STORAGE(func)
 
 
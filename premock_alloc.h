@@ -0,0 +1,9 @@
+#ifndef PREMOCK_ALLOC_H_
+#define PREMOCK_ALLOC_H_
+
+#define malloc ut_premock_malloc
+#define calloc ut_premock_calloc
+#define realloc ut_premock_realloc
+#define free ut_premock_free
+
+#endif // PREMOCK_ALLOC_H_
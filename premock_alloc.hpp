@@ -0,0 +1,261 @@
+/**
+Mocks for malloc, calloc, realloc and free.
+
+Mocking the allocator needs some care: whatever the mock does while
+handling a call must not end up calling the mock again. The trampolines
+defined by `IMPL_MOCK_ALLOCATORS` hold a reentrancy guard while the mock
+runs, and while it's held they call the real allocator directly. Anything
+premock or a replacement lambda allocates is then served by libc as usual
+and never recorded.
+
+That guard is what makes `MOCK`, `SPY` and `REPLACE` usable on these
+functions at all: a Mock's or Spy's history is a `std::deque` that grows as
+calls are recorded and the replacement is a `std::function` that may
+allocate, so with the trampolines of `IMPL_MOCK_DEFAULT` the first call
+recorded would call malloc again and recurse until the stack runs out.
+Allocator mocks must only ever be defined with `IMPL_MOCK_GUARDED`, which
+is what `IMPL_MOCK_ALLOCATORS` uses.
+
+`AllocationTracker` is a ready-made spy for all four functions. It counts
+calls and bytes, keeps a log of the most recent calls in storage allocated
+up front, and can make allocations fail, all without allocating itself:
+
+```c++
+TEST(handler, no_allocations) {
+    handle_request(); // warm up caches
+    AllocationTracker allocations;
+    handle_request();
+    REQUIRE(allocations.allocations() == 0);
+}
+
+TEST(handler, out_of_memory) {
+    AllocationTracker allocations;
+    allocations.failAfter(2);
+    REQUIRE(handle_request() == ERR_NO_MEMORY);
+}
+```
+
+The production code needs the redefinitions in `premock_alloc.h` and the
+test binary `IMPL_MOCK_ALLOCATORS()` in an extern "C" block.
+ */
+
+#ifndef PREMOCK_ALLOC_HPP_
+#define PREMOCK_ALLOC_HPP_
+
+#include "premock.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+DECL_MOCK(malloc);
+DECL_MOCK(calloc);
+DECL_MOCK(realloc);
+DECL_MOCK(free);
+
+
+/**
+ Marks the current thread as being inside a mock until the end of scope
+ */
+class InsideMock {
+public:
+
+    InsideMock() noexcept { ++depth(); }
+    ~InsideMock() { --depth(); }
+
+    InsideMock(const InsideMock&) = delete;
+    InsideMock& operator=(const InsideMock&) = delete;
+
+    static bool active() noexcept { return depth() > 0; }
+
+private:
+
+    static int& depth() noexcept {
+        static thread_local int depth = 0;
+        return depth;
+    }
+};
+
+
+/**
+ Like IMPL_MOCK_DEFAULT, but calls made while the thread is already inside
+ a guarded mock go straight to the real function
+ */
+#define IMPL_MOCK_GUARDED(num_args, func) \
+    FunctionTraits<PREMOCK_FUNCTION_TYPE(func)>::ReturnType ut_premock_##func(UT_FUNC_ARGS_##num_args(func)) { \
+        if(InsideMock::active()) return func(UT_FUNC_FWD_##num_args); \
+        InsideMock guard; \
+        premockCallSite() = PREMOCK_RETURN_ADDRESS(); \
+        premock_registration_##func.called(); \
+        return mock_##func(UT_FUNC_FWD_##num_args); \
+    } \
+    MOCK_REGISTRATION(func); \
+    MOCK_STORAGE_DEFAULT(func)
+
+/**
+ The implementation of the allocator mocks, to be used in an extern "C" block
+ */
+#define IMPL_MOCK_ALLOCATORS() \
+    IMPL_MOCK_GUARDED(1, malloc); \
+    IMPL_MOCK_GUARDED(2, calloc); \
+    IMPL_MOCK_GUARDED(2, realloc); \
+    IMPL_MOCK_GUARDED(1, free)
+
+
+/**
+ One call to the allocator as logged by AllocationTracker
+ */
+struct AllocationEvent {
+    enum class Kind { malloc, calloc, realloc, free };
+
+    Kind kind;
+    const void* pointer; // the one returned, or passed to free
+    size_t size;
+};
+
+
+/**
+ RAII class that spies on malloc, calloc, realloc and free until the end of
+ scope. Nothing it does per call allocates: the log of recent calls is a ring
+ buffer allocated on construction.
+ */
+class AllocationTracker {
+public:
+
+    explicit AllocationTracker(size_t logCapacity = 1024):
+        _log(logCapacity),
+        _malloc{mock_malloc, [this](size_t size) -> void* {
+                if(shouldFail()) return nullptr;
+                return allocated(AllocationEvent::Kind::malloc, _malloc.displaced()(size), size);
+            }},
+        _calloc{mock_calloc, [this](size_t count, size_t size) -> void* {
+                if(shouldFail()) return nullptr;
+                return allocated(AllocationEvent::Kind::calloc, _calloc.displaced()(count, size), count * size);
+            }},
+        _realloc{mock_realloc, [this](void* pointer, size_t size) -> void* {
+                if(shouldFail()) return nullptr;
+                ++_reallocations;
+                const auto result = _realloc.displaced()(pointer, size);
+                log(AllocationEvent::Kind::realloc, result, size);
+                if(result == nullptr) {
+                    if(size != 0) ++_failures;
+                    else if(pointer) ++_frees; // realloc(pointer, 0) freed it
+                    return result;
+                }
+                // resizing an existing block is neither a new allocation nor a free
+                if(pointer == nullptr) ++_allocations;
+                _bytes += size;
+                return result;
+            }},
+        _free{mock_free, [this](void* pointer) {
+                if(pointer) ++_frees;
+                log(AllocationEvent::Kind::free, pointer, 0);
+                _free.displaced()(pointer);
+            }} {
+    }
+
+    /**
+     Blocks allocated with malloc, calloc or realloc of a null pointer
+     */
+    size_t allocations() const noexcept { return _allocations; }
+
+    /**
+     Calls to realloc, whether they moved the block or not
+     */
+    size_t reallocations() const noexcept { return _reallocations; }
+
+    /**
+     Calls to free with a non-null pointer
+     */
+    size_t frees() const noexcept { return _frees; }
+
+    /**
+     Bytes requested by all allocation calls that succeeded
+     */
+    size_t bytes() const noexcept { return _bytes; }
+
+    /**
+     Allocations that failed, whether forced to or not
+     */
+    size_t failures() const noexcept { return _failures; }
+
+    /**
+     Blocks allocated and not freed since construction. Negative if blocks
+     allocated before then were freed.
+     */
+    std::ptrdiff_t live() const noexcept {
+        return static_cast<std::ptrdiff_t>(_allocations) - static_cast<std::ptrdiff_t>(_frees);
+    }
+
+    /**
+     Makes every allocation after the next n fail with ENOMEM
+     */
+    void failAfter(size_t n) noexcept {
+        _failAfter = n;
+        _failing = true;
+    }
+
+    /**
+     Stops making allocations fail
+     */
+    void stopFailing() noexcept {
+        _failing = false;
+    }
+
+    /**
+     Calls func with the logged calls, oldest first. Only the most recent
+     ones, up to the capacity passed to the constructor, are kept.
+     */
+    template<typename F>
+    void forEachEvent(F func) const {
+        const auto count = std::min(_logged, _log.size());
+        for(size_t i = _logged - count; i < _logged; ++i) func(_log[i % _log.size()]);
+    }
+
+private:
+
+    std::vector<AllocationEvent> _log;
+    size_t _logged = 0;
+    size_t _allocations = 0;
+    size_t _reallocations = 0;
+    size_t _frees = 0;
+    size_t _bytes = 0;
+    size_t _failures = 0;
+    size_t _failAfter = 0;
+    bool _failing = false;
+    MockScope<decltype(mock_malloc)> _malloc;
+    MockScope<decltype(mock_calloc)> _calloc;
+    MockScope<decltype(mock_realloc)> _realloc;
+    MockScope<decltype(mock_free)> _free;
+
+    bool shouldFail() noexcept {
+        if(!_failing) return false;
+        if(_failAfter > 0) {
+            --_failAfter;
+            return false;
+        }
+        ++_failures;
+        errno = ENOMEM;
+        return true;
+    }
+
+    void* allocated(AllocationEvent::Kind kind, void* pointer, size_t size) noexcept {
+        log(kind, pointer, size);
+        if(pointer == nullptr) {
+            if(size != 0) ++_failures;
+            return pointer;
+        }
+        ++_allocations;
+        _bytes += size;
+        return pointer;
+    }
+
+    void log(AllocationEvent::Kind kind, const void* pointer, size_t size) noexcept {
+        if(_log.empty()) return;
+        _log[_logged++ % _log.size()] = AllocationEvent{kind, pointer, size};
+    }
+};
+
+
+#endif // PREMOCK_ALLOC_HPP_
@@ -0,0 +1,183 @@
+/**
+Call and byte budgets, to catch performance regressions in unit tests.
+
+A `CallBudget` counts the calls made to any number of mocked functions while
+it's in scope, and optionally sums one of their parameters, e.g. the length
+passed to `send`. Calls are forwarded to whatever implementation was in
+place before. `verify` then throws a `MockException` if the code under test
+went over budget:
+
+```c++
+TEST(handler, syscalls) {
+    CallBudget budget{"handle_request"};
+    budget.watchBytes<2>(mock_send).watch(mock_recv);
+    budget.maxCalls(4).maxBytes(1024);
+    handle_request();
+    budget.verify();
+}
+```
+
+Instead of fixed limits, the observed counts can be compared against those
+saved in a baseline file by a previous run, with some tolerance:
+
+```c++
+    budget.verifyBaseline("budgets.txt", 0.1); // at most 10% more than last time
+```
+
+The first run for a budget only saves its counts; delete its line from the
+file (or call `saveBaseline`) to accept a new baseline. The counts aren't
+synchronised, so a budget's mocks must only be called from the thread that
+created it and not be inherited with `InheritMocks`.
+ */
+
+#ifndef PREMOCK_BUDGET_HPP_
+#define PREMOCK_BUDGET_HPP_
+
+#include "premock.hpp"
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+/**
+ Counts calls to, and bytes passed to, a set of mocks until the end of scope
+ */
+class CallBudget {
+public:
+
+    explicit CallBudget(std::string name):_name(std::move(name)) {
+        if(_name.empty() || _name.find_first_of(" \t\n") != std::string::npos)
+            throw std::logic_error("CallBudget name must be one word, got '" + _name + "'");
+    }
+
+    CallBudget(const CallBudget&) = delete;
+    CallBudget& operator=(const CallBudget&) = delete;
+
+    /**
+     Count the calls to func against this budget
+     */
+    template<typename T>
+    CallBudget& watch(T& func) {
+        return count<-1>(func);
+    }
+
+    /**
+     Count the calls to func against this budget and the parameter at
+     position BytesParam as bytes
+     */
+    template<int BytesParam, typename T>
+    CallBudget& watchBytes(T& func) {
+        static_assert(BytesParam >= 0, "BytesParam must be a parameter position");
+        return count<BytesParam>(func);
+    }
+
+    CallBudget& maxCalls(std::uint64_t calls) noexcept {
+        _maxCalls = calls;
+        return *this;
+    }
+
+    CallBudget& maxBytes(std::uint64_t bytes) noexcept {
+        _maxBytes = bytes;
+        return *this;
+    }
+
+    const std::string& name() const noexcept { return _name; }
+    std::uint64_t calls() const noexcept { return _calls; }
+    std::uint64_t bytes() const noexcept { return _bytes; }
+
+    /**
+     Throws MockException if more calls were made, or more bytes passed, than allowed
+     */
+    void verify() const {
+        check(_maxCalls, _maxBytes, "the budget");
+    }
+
+    /**
+     Compares the counts so far to the ones saved for this budget in fileName,
+     throws MockException if either is more than tolerance (e.g. 0.1 for 10%)
+     above them. If there's no baseline for this budget yet, saves one.
+     */
+    void verifyBaseline(const std::string& fileName, double tolerance = 0) const {
+        const auto baselines = readBaselines(fileName);
+        const auto baseline = baselines.find(_name);
+        if(baseline == baselines.end()) {
+            saveBaseline(fileName);
+            return;
+        }
+
+        check(withTolerance(baseline->second.calls, tolerance), withTolerance(baseline->second.bytes, tolerance),
+              "the baseline in " + fileName);
+    }
+
+    /**
+     Saves the counts so far as the baseline for this budget in fileName,
+     replacing any previous one and keeping those of other budgets
+     */
+    void saveBaseline(const std::string& fileName) const {
+        auto baselines = readBaselines(fileName);
+        baselines[_name] = Baseline{_calls, _bytes};
+
+        std::ofstream file{fileName};
+        if(!file) throw std::runtime_error("Could not write baseline file " + fileName);
+        for(const auto& baseline: baselines)
+            file << baseline.first << " " << baseline.second.calls << " " << baseline.second.bytes << "\n";
+    }
+
+private:
+
+    struct Baseline {
+        std::uint64_t calls;
+        std::uint64_t bytes;
+    };
+
+    std::string _name;
+    std::uint64_t _calls = 0;
+    std::uint64_t _bytes = 0;
+    std::uint64_t _maxCalls = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t _maxBytes = std::numeric_limits<std::uint64_t>::max();
+    WatchedMocks _watches;
+
+    template<int BytesParam, typename T>
+    CallBudget& count(T& func) {
+        _watches.watch(func, [this](const auto& displaced, auto&&... args) {
+            ++_calls;
+            _bytes += countParameter<BytesParam>(args...);
+            return displaced(std::forward<decltype(args)>(args)...);
+        });
+        return *this;
+    }
+
+    void check(std::uint64_t maxCalls, std::uint64_t maxBytes, const std::string& limit) const {
+        std::ostringstream errors;
+        if(_calls > maxCalls)
+            errors << "  " << _calls << " calls, at most " << maxCalls << " allowed\n";
+        if(_bytes > maxBytes)
+            errors << "  " << _bytes << " bytes, at most " << maxBytes << " allowed\n";
+
+        const auto error = errors.str();
+        if(!error.empty())
+            throw MockException("Budget '" + _name + "' exceeded " + limit + ":\n" + error);
+    }
+
+    static std::uint64_t withTolerance(std::uint64_t value, double tolerance) noexcept {
+        return static_cast<std::uint64_t>(static_cast<double>(value) * (1 + tolerance));
+    }
+
+    // one line per budget: name calls bytes
+    static std::map<std::string, Baseline> readBaselines(const std::string& fileName) {
+        std::map<std::string, Baseline> baselines;
+        std::ifstream file{fileName};
+        std::string name;
+        Baseline baseline;
+        while(file >> name >> baseline.calls >> baseline.bytes) baselines[name] = baseline;
+        return baselines;
+    }
+};
+
+
+#endif // PREMOCK_BUDGET_HPP_
@@ -0,0 +1,220 @@
+/**
+Attributes the calls to a mocked function to the places they're made from.
+
+Every `ut_premock_` trampoline stores the address it returns to before
+calling the mock, which makes it possible to tell apart the forty places
+legacy code calls `send` from. `CALL_SITES` counts calls (and optionally
+bytes, from one of the parameters) per call site in a fixed-size hash table
+while forwarding to whatever implementation it displaced. Addresses are only
+turned into symbol names when a report is asked for:
+
+```c++
+TEST(server, send_hotspots) {
+    auto sites = CALL_SITES_BYTES(send, 2); // sum the len parameter
+    run_load_test();
+    std::cout << sites.report(5);
+}
+```
+
+Symbolizing uses `dladdr`, so functions only get names if they're exported,
+e.g. by linking with `-rdynamic`. Otherwise the report shows the module and
+offset, which `addr2line -e module offset` resolves. glibc older than 2.34
+also needs `-ldl` for it. A profile's table isn't synchronised, so it must
+only be called from the thread that created it and not be inherited with
+`InheritMocks`.
+ */
+
+#ifndef PREMOCK_CALLSITE_HPP_
+#define PREMOCK_CALLSITE_HPP_
+
+#include "premock.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cxxabi.h>
+#include <dlfcn.h>
+
+
+/**
+ How often a call site called a mocked function
+ */
+struct CallSite {
+    const void* address;
+    std::uint64_t calls;
+    std::uint64_t bytes;
+
+    /**
+     The function the call site is in, demangled and with the offset into
+     it, or the module and offset if the function isn't exported. Calls
+     that didn't go through a ut_premock_ function have a null address.
+     */
+    std::string symbol() const {
+        if(address == nullptr) return "<unknown>";
+
+        char buffer[64];
+        Dl_info info;
+        // the return address is the instruction after the call, which might
+        // not be in the same function if the call was the last thing in it
+        const auto lookup = static_cast<const char*>(address) - 1;
+        if(dladdr(lookup, &info) == 0 || info.dli_fname == nullptr) {
+            snprintf(buffer, sizeof(buffer), "%p", address);
+            return buffer;
+        }
+
+        if(info.dli_sname == nullptr) {
+            snprintf(buffer, sizeof(buffer), "+0x%zx", static_cast<size_t>(lookup - static_cast<const char*>(info.dli_fbase)));
+            return info.dli_fname + std::string{buffer};
+        }
+
+        int status = 0;
+        std::unique_ptr<char, decltype(&free)> demangled{
+            abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status), &free};
+        snprintf(buffer, sizeof(buffer), "+0x%zx", static_cast<size_t>(lookup - static_cast<const char*>(info.dli_saddr)));
+        return (status == 0 ? demangled.get() : info.dli_sname) + std::string{buffer};
+    }
+};
+
+
+/**
+ Open addressing hash table of call sites with a fixed capacity, allocated
+ up front so that counting a call never allocates. Calls from sites that
+ don't fit any more are counted as overflow.
+ */
+class CallSiteTable {
+public:
+
+    static constexpr size_t capacity() noexcept { return size_t{1} << capacityBits; }
+
+    CallSiteTable():_sites(capacity(), CallSite{nullptr, 0, 0}) {}
+
+    void record(const void* address, std::uint64_t bytes) noexcept {
+        auto index = hash(address);
+        for(size_t probes = 0; probes < maxProbes; ++probes, index = (index + 1) % capacity()) {
+            auto& site = _sites[index];
+            if(site.calls == 0) site.address = address;
+            if(site.address == address) {
+                ++site.calls;
+                site.bytes += bytes;
+                return;
+            }
+        }
+        ++_overflow;
+    }
+
+    /**
+     The call sites in descending order of calls
+     */
+    std::vector<CallSite> ranked() const {
+        std::vector<CallSite> sites;
+        for(const auto& site: _sites) if(site.calls) sites.push_back(site);
+        std::sort(sites.begin(), sites.end(), [](const CallSite& lhs, const CallSite& rhs) {
+            return lhs.calls != rhs.calls ? lhs.calls > rhs.calls : lhs.bytes > rhs.bytes;
+        });
+        return sites;
+    }
+
+    /**
+     How many calls weren't attributed to their call site since the table was full
+     */
+    std::uint64_t overflow() const noexcept { return _overflow; }
+
+private:
+
+    static constexpr int capacityBits = 12;
+    static constexpr size_t maxProbes = 64;
+
+    std::vector<CallSite> _sites;
+    std::uint64_t _overflow = 0;
+
+    // Fibonacci hashing: call sites are close together so their low bits
+    // need mixing into the high ones that are kept
+    static size_t hash(const void* address) noexcept {
+        const auto value = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(address));
+        return static_cast<size_t>((value * 0x9e3779b97f4a7c15ULL) >> (64 - capacityBits));
+    }
+};
+
+
+/**
+ RAII class that counts the calls to the mock per call site, and the bytes
+ in the parameter at position BytesParam if it isn't negative, then forwards
+ them to the implementation it replaced.
+ */
+template<typename T, int BytesParam = -1>
+class CallSiteProfile {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+
+    CallSiteProfile(T& func, std::string name):
+        _name(std::move(name)),
+        _mockScope{func, [this](auto&&... args) -> ReturnType {
+                // consumed so that calls that don't go through a trampoline aren't
+                // attributed to the last one that did
+                auto& callSite = premockCallSite();
+                _table.record(callSite, countParameter<BytesParam>(args...));
+                callSite = nullptr;
+                return _mockScope.displaced()(std::forward<decltype(args)>(args)...);
+            }} {
+    }
+
+    /**
+     The call sites in descending order of calls
+     */
+    std::vector<CallSite> hotspots() const {
+        return _table.ranked();
+    }
+
+    /**
+     The top call sites, symbolized, one per line
+     */
+    std::string report(size_t top = 10) const {
+        const auto sites = hotspots();
+        std::uint64_t total = 0;
+        for(const auto& site: sites) total += site.calls;
+
+        std::string result = _name + ": " + std::to_string(total + _table.overflow()) + " calls from " +
+            std::to_string(sites.size()) + " call sites\n";
+        for(size_t i = 0; i < std::min(top, sites.size()); ++i) {
+            result += "  " + std::to_string(sites[i].calls) + " calls";
+            if(BytesParam >= 0) result += ", " + std::to_string(sites[i].bytes) + " bytes";
+            result += ": " + sites[i].symbol() + "\n";
+        }
+        if(_table.overflow())
+            result += "  " + std::to_string(_table.overflow()) + " calls from call sites that didn't fit\n";
+        return result;
+    }
+
+private:
+
+    std::string _name;
+    CallSiteTable _table;
+    MockScope<T> _mockScope;
+};
+
+
+/**
+ Helper function to create a CallSiteProfile
+ */
+template<int BytesParam = -1, typename T>
+CallSiteProfile<T, BytesParam> callSiteProfile(T& func, std::string name) {
+    return {func, std::move(name)};
+}
+
+/**
+ Helper macro to count the calls to a particular "real" function per call site
+ */
+#define CALL_SITES(func) callSiteProfile(mock_##func, #func)
+
+/**
+ Like CALL_SITES but also sums the parameter at position index, e.g. the length
+ passed to send
+ */
+#define CALL_SITES_BYTES(func, index) callSiteProfile<index>(mock_##func, #func)
+
+
+#endif // PREMOCK_CALLSITE_HPP_
@@ -0,0 +1,292 @@
+/**
+Lock contention profiling for code that uses pthread mutexes and rwlocks.
+
+A `LockProfile` spies on the mutex, rwlock and `pthread_cond_wait` functions
+declared in `premock_pthread.hpp` and, per lock address, counts acquisitions,
+those that had to wait because the lock was taken and failed `trylock`s, and
+keeps histograms of how long threads waited for the lock and held it. Each
+thread logs to a buffer of its own so that profiling doesn't add contention
+of its own, and the logs are only aggregated for a report:
+
+```c++
+TEST(server, lock_contention) {
+    LockProfile locks{"locks.txt"}; // ranked report written at end of scope
+    locks.name(&session_table_mutex, "session table");
+    InheritMocks inherit;           // profile the worker threads too
+    run_server_with_clients(16);
+}
+```
+
+Acquisitions are timed by first trying to take the lock and only then
+blocking on it, which is also how contended acquisitions are told apart.
+`pthread_cond_wait` releases the mutex and takes it again on waking up, so
+the hold time ends before the wait and a new one starts after it. How long
+the waking thread waited for the mutex can't be told apart from how long it
+waited for the condition, so those acquisitions are counted as wakeups
+instead of being timed.
+Mocks are per thread, so threads started by the code under test need an
+`InheritMocks` (premock_thread.hpp) in scope to be profiled.
+ */
+
+#ifndef PREMOCK_CONTENTION_HPP_
+#define PREMOCK_CONTENTION_HPP_
+
+#include "premock_pthread.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/**
+ What a LockProfile found out about one lock. Times are in nanoseconds.
+ */
+struct LockStats {
+    const void* lock = nullptr;
+    std::string name; // empty unless given to LockProfile::name
+    bool rwlock = false;
+    std::uint64_t acquisitions = 0;
+    std::uint64_t contended = 0; // acquisitions that had to wait
+    std::uint64_t failedTries = 0;
+    std::uint64_t wakeups = 0; // acquisitions by pthread_cond_wait, not timed
+    LatencyHistogram wait;
+    LatencyHistogram hold;
+
+    std::string toString() const {
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "%s (%s): %llu acquisitions, %llu contended, %llu failed tries, "
+                 "waited %.1fus (p99 %.1fus, max %.1fus), held p50 %.1fus p99 %.1fus",
+                 label().c_str(), rwlock ? "rwlock" : "mutex",
+                 static_cast<unsigned long long>(acquisitions), static_cast<unsigned long long>(contended),
+                 static_cast<unsigned long long>(failedTries),
+                 microseconds(wait.total()), microseconds(wait.p99()), microseconds(wait.max()),
+                 microseconds(hold.p50()), microseconds(hold.p99()));
+        return line;
+    }
+
+private:
+
+    std::string label() const {
+        if(!name.empty()) return name;
+        char address[32];
+        snprintf(address, sizeof(address), "%p", lock);
+        return address;
+    }
+
+    static double microseconds(std::uint64_t nanoseconds) noexcept {
+        return static_cast<double>(nanoseconds) / 1000.0;
+    }
+};
+
+
+/**
+ RAII class that profiles the pthread mutexes and rwlocks taken until the end
+ of scope, writing a report to fileName then if there is one
+ */
+class LockProfile {
+public:
+
+    explicit LockProfile(std::string fileName = ""):
+        _fileName(std::move(fileName)),
+        _mutexLock{mock_pthread_mutex_lock, [this](pthread_mutex_t* mutex) {
+                return acquire(mutex, false, _mutexTrylock.displaced(), _mutexLock.displaced());
+            }},
+        _mutexTrylock{mock_pthread_mutex_trylock, [this](pthread_mutex_t* mutex) {
+                return tryAcquire(mutex, false, _mutexTrylock.displaced());
+            }},
+        _mutexUnlock{mock_pthread_mutex_unlock, [this](pthread_mutex_t* mutex) {
+                released(mutex, false);
+                return _mutexUnlock.displaced()(mutex);
+            }},
+        _condWait{mock_pthread_cond_wait, [this](pthread_cond_t* cond, pthread_mutex_t* mutex) {
+                released(mutex, false);
+                const auto result = _condWait.displaced()(cond, mutex);
+                // the mutex is held again even if the wait failed
+                acquired(mutex, false, CycleClock::now(), Event::Type::wakeup);
+                return result;
+            }},
+        _rdlock{mock_pthread_rwlock_rdlock, [this](pthread_rwlock_t* rwlock) {
+                return acquire(rwlock, true, _tryrdlock.displaced(), _rdlock.displaced());
+            }},
+        _tryrdlock{mock_pthread_rwlock_tryrdlock, [this](pthread_rwlock_t* rwlock) {
+                return tryAcquire(rwlock, true, _tryrdlock.displaced());
+            }},
+        _wrlock{mock_pthread_rwlock_wrlock, [this](pthread_rwlock_t* rwlock) {
+                return acquire(rwlock, true, _trywrlock.displaced(), _wrlock.displaced());
+            }},
+        _trywrlock{mock_pthread_rwlock_trywrlock, [this](pthread_rwlock_t* rwlock) {
+                return tryAcquire(rwlock, true, _trywrlock.displaced());
+            }},
+        _rwlockUnlock{mock_pthread_rwlock_unlock, [this](pthread_rwlock_t* rwlock) {
+                released(rwlock, true);
+                return _rwlockUnlock.displaced()(rwlock);
+            }} {
+        CycleClock::nanosecondsPerTick(); // calibrate now, not while a lock is held
+    }
+
+    ~LockProfile() {
+        if(_fileName.empty()) return;
+        std::ofstream file{_fileName};
+        file << report();
+    }
+
+    LockProfile(const LockProfile&) = delete;
+    LockProfile& operator=(const LockProfile&) = delete;
+
+    /**
+     Names the lock at address lock in reports
+     */
+    LockProfile& name(const void* lock, std::string name) {
+        _names[lock] = std::move(name);
+        return *this;
+    }
+
+    /**
+     The locks taken so far, most waited for first. Safe to call while other
+     threads are still taking locks, their latest acquisitions just might not
+     be in it.
+     */
+    std::vector<LockStats> stats() const {
+        std::map<const void*, LockStats> locks;
+        _logs.forEachLog([&](const ThreadLog<Event>& log) {
+            log.forEach([&](const Event& event) {
+                auto& stats = locks[event.lock];
+                stats.lock = event.lock;
+                stats.rwlock = event.rwlock;
+                const auto nanoseconds = CycleClock::toNanoseconds(event.ticks);
+                switch(event.type) {
+                case Event::Type::contended:
+                    ++stats.contended;
+                    // fall through
+                case Event::Type::acquired:
+                    ++stats.acquisitions;
+                    stats.wait.record(nanoseconds);
+                    break;
+                case Event::Type::wakeup:
+                    ++stats.acquisitions;
+                    ++stats.wakeups;
+                    break;
+                case Event::Type::failedTry:
+                    ++stats.failedTries;
+                    break;
+                case Event::Type::released:
+                    stats.hold.record(nanoseconds);
+                    break;
+                }
+            });
+        });
+
+        std::vector<LockStats> ranked;
+        for(auto& lock: locks) {
+            const auto name = _names.find(lock.first);
+            if(name != _names.end()) lock.second.name = name->second;
+            ranked.push_back(std::move(lock.second));
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const LockStats& lhs, const LockStats& rhs) {
+            return lhs.wait.total() != rhs.wait.total() ?
+                lhs.wait.total() > rhs.wait.total() :
+                lhs.acquisitions > rhs.acquisitions;
+        });
+        return ranked;
+    }
+
+    /**
+     The top locks, one per line
+     */
+    std::string report(size_t top = 10) const {
+        const auto locks = stats();
+        std::uint64_t acquisitions = 0;
+        std::uint64_t contended = 0;
+        for(const auto& lock: locks) {
+            acquisitions += lock.acquisitions;
+            contended += lock.contended;
+        }
+
+        std::string result = "Lock contention: " + std::to_string(locks.size()) + " locks, " +
+            std::to_string(acquisitions) + " acquisitions, " + std::to_string(contended) + " contended\n";
+        for(size_t i = 0; i < std::min(top, locks.size()); ++i)
+            result += "  " + locks[i].toString() + "\n";
+        return result;
+    }
+
+private:
+
+    struct Event {
+        enum class Type: std::uint8_t { acquired, contended, wakeup, failedTry, released };
+
+        const void* lock;
+        std::uint64_t ticks; // waiting for the lock, or holding it
+        Type type;
+        bool rwlock;
+    };
+
+    // the locks the current thread holds, and since when
+    struct Held {
+        const void* lock;
+        std::uint64_t since;
+    };
+
+    std::string _fileName;
+    std::map<const void*, std::string> _names;
+    ThreadLogs<Event> _logs;
+    MockScope<decltype(mock_pthread_mutex_lock)> _mutexLock;
+    MockScope<decltype(mock_pthread_mutex_trylock)> _mutexTrylock;
+    MockScope<decltype(mock_pthread_mutex_unlock)> _mutexUnlock;
+    MockScope<decltype(mock_pthread_cond_wait)> _condWait;
+    MockScope<decltype(mock_pthread_rwlock_rdlock)> _rdlock;
+    MockScope<decltype(mock_pthread_rwlock_tryrdlock)> _tryrdlock;
+    MockScope<decltype(mock_pthread_rwlock_wrlock)> _wrlock;
+    MockScope<decltype(mock_pthread_rwlock_trywrlock)> _trywrlock;
+    MockScope<decltype(mock_pthread_rwlock_unlock)> _rwlockUnlock;
+
+    static std::vector<Held>& held() {
+        static thread_local std::vector<Held> locks;
+        return locks;
+    }
+
+    template<typename L, typename F, typename G>
+    int acquire(L* lock, bool rwlock, const F& tryLock, const G& blockingLock) {
+        const auto start = CycleClock::now();
+        if(tryLock(lock) == 0) {
+            acquired(lock, rwlock, start, Event::Type::acquired);
+            return 0;
+        }
+        const auto result = blockingLock(lock);
+        if(result == 0) acquired(lock, rwlock, start, Event::Type::contended);
+        return result;
+    }
+
+    template<typename L, typename F>
+    int tryAcquire(L* lock, bool rwlock, const F& tryLock) {
+        const auto start = CycleClock::now();
+        const auto result = tryLock(lock);
+        if(result == 0) acquired(lock, rwlock, start, Event::Type::acquired);
+        else _logs.local().emplace(lock, std::uint64_t{0}, Event::Type::failedTry, rwlock);
+        return result;
+    }
+
+    void acquired(const void* lock, bool rwlock, std::uint64_t start, Event::Type type) {
+        const auto now = CycleClock::now();
+        _logs.local().emplace(lock, now - start, type, rwlock);
+        held().push_back(Held{lock, now});
+    }
+
+    // the most recent acquisition is the one released, for read locks taken
+    // more than once by the same thread
+    void released(const void* lock, bool rwlock) {
+        auto& locks = held();
+        for(auto it = locks.rbegin(); it != locks.rend(); ++it) {
+            if(it->lock != lock) continue;
+            _logs.local().emplace(lock, CycleClock::now() - it->since, Event::Type::released, rwlock);
+            locks.erase(std::next(it).base());
+            return;
+        }
+    }
+};
+
+
+#endif // PREMOCK_CONTENTION_HPP_
@@ -0,0 +1,11 @@
+#ifndef PREMOCK_EPOLL_H_
+#define PREMOCK_EPOLL_H_
+
+#define epoll_create ut_premock_epoll_create
+#define epoll_create1 ut_premock_epoll_create1
+#define epoll_ctl ut_premock_epoll_ctl
+#define epoll_wait ut_premock_epoll_wait
+#define poll ut_premock_poll
+#define close ut_premock_close
+
+#endif // PREMOCK_EPOLL_H_
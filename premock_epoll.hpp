@@ -0,0 +1,439 @@
+/**
+Event loops driven by scripted readiness instead of the kernel.
+
+The mocks for `epoll_create`, `epoll_create1`, `epoll_ctl`, `epoll_wait` and
+`poll` declared here are backed by a `ReadinessTable`: which file descriptors
+are readable, writable or hung up is whatever the test says it is, and a wait
+returns straight away with the events that are ready. A timeline of steps,
+one applied on each wait, scripts what happens next, so an event loop can be
+driven through millions of iterations a second without a kernel wait.
+
+The production code needs the redefinitions in `premock_epoll.h` and the test
+binary has to implement the mocks as usual:
+
+```c++
+#include "premock_epoll.hpp"
+extern "C" {
+    IMPL_MOCK_DEFAULT(1, epoll_create);
+    IMPL_MOCK_DEFAULT(1, epoll_create1);
+    IMPL_MOCK_DEFAULT(4, epoll_ctl);
+    IMPL_MOCK_DEFAULT(4, epoll_wait);
+    IMPL_MOCK_DEFAULT(3, poll);
+    IMPL_MOCK_DEFAULT(1, close);
+}
+```
+
+Test code then does:
+
+```c++
+TEST(daemon, answers_then_stops) {
+    VirtualPolling polling;
+    polling.table()
+        .then({{listen_fd, EPOLLIN}})                  // a client connects
+        .then({{listen_fd, 0}, {client_fd, EPOLLIN}})  // and sends a request
+        .then([] { stop_daemon(); });
+    run_daemon_loop();
+}
+```
+
+Readiness is level-triggered unless `EPOLLET` asks otherwise: each time an
+fd is made ready counts as a new edge. `EPOLLONESHOT` is honoured too. Timeouts
+expire at once when nothing is ready. A wait with no timeout that finds
+nothing ready moves on through the timeline until something is, and throws a
+MockException if the timeline ends first, as the real call would block forever.
+Closing an fd removes it from the table and every epoll instance, and then
+goes on to the previous implementation of `close`. Epoll instances created
+before the scope aren't virtual and are forwarded to the previous
+implementation.
+ */
+
+#ifndef PREMOCK_EPOLL_HPP_
+#define PREMOCK_EPOLL_HPP_
+
+#include "premock.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+DECL_MOCK(epoll_create);
+DECL_MOCK(epoll_create1);
+DECL_MOCK(epoll_ctl);
+DECL_MOCK(epoll_wait);
+DECL_MOCK(poll);
+DECL_MOCK(close);
+
+
+// readiness is kept as epoll events and reported as is by poll
+static_assert(EPOLLIN == POLLIN && EPOLLOUT == POLLOUT && EPOLLPRI == POLLPRI &&
+              EPOLLERR == POLLERR && EPOLLHUP == POLLHUP, "epoll and poll events differ");
+
+
+/**
+ The events ready on one file descriptor
+ */
+struct Readiness {
+    int fd;
+    std::uint32_t events; // EPOLLIN, EPOLLOUT etc., 0 for not ready
+};
+
+
+/**
+ Which file descriptors are ready for what, the epoll instances watching
+ them and a timeline of changes to come. Can be shared between threads, each
+ with its own VirtualPolling scope.
+ */
+class ReadinessTable {
+public:
+
+    /**
+     The first fake file descriptor handed out for an epoll instance. Above
+     the ones LoopbackNetwork and MemoryFileSystem use.
+     */
+    static constexpr int firstFd() noexcept { return 1 << 22; }
+
+    ReadinessTable() = default;
+    ReadinessTable(const ReadinessTable&) = delete;
+    ReadinessTable& operator=(const ReadinessTable&) = delete;
+
+    /**
+     Makes fd ready for exactly events, which is a new edge if there are any
+     */
+    ReadinessTable& set(int fd, std::uint32_t events) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        setLocked(fd, events);
+        return *this;
+    }
+
+    /**
+     Makes fd ready for events as well as whatever it was ready for
+     */
+    ReadinessTable& raise(int fd, std::uint32_t events) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto it = _fds.find(fd);
+        setLocked(fd, (it == _fds.end() ? 0 : it->second.events) | events);
+        return *this;
+    }
+
+    /**
+     Makes fd no longer ready for events
+     */
+    ReadinessTable& clear(int fd, std::uint32_t events = ~std::uint32_t{0}) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto it = _fds.find(fd);
+        if(it != _fds.end()) it->second.events &= ~events;
+        return *this;
+    }
+
+    std::uint32_t readiness(int fd) const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto it = _fds.find(fd);
+        return it == _fds.end() ? 0 : it->second.events;
+    }
+
+    /**
+     Appends a step to the timeline: at the next wait that hasn't had one,
+     each fd in changes is made ready for exactly its events
+     */
+    ReadinessTable& then(std::vector<Readiness> changes) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _timeline.push_back(Step{std::move(changes), nullptr});
+        return *this;
+    }
+
+    /**
+     Appends a step to the timeline where nothing changes
+     */
+    ReadinessTable& then() {
+        return then(std::vector<Readiness>{});
+    }
+
+    /**
+     Appends a step to the timeline that calls action, e.g. to stop the event
+     loop or to change readiness depending on what the code did so far
+     */
+    ReadinessTable& then(std::function<void()> action) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _timeline.push_back(Step{{}, std::move(action)});
+        return *this;
+    }
+
+    /**
+     How many steps of the timeline haven't happened yet
+     */
+    size_t remainingSteps() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _timeline.size();
+    }
+
+    /**
+     How many times epoll_wait and poll were called
+     */
+    std::uint64_t waits() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _waits;
+    }
+
+    bool owns(int epfd) const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return findInstance(epfd) != nullptr;
+    }
+
+    int epollCreate(int size) {
+        if(size <= 0) return fail(EINVAL);
+        return epollCreate1(0);
+    }
+
+    int epollCreate1(int flags) {
+        if(flags & ~EPOLL_CLOEXEC) return fail(EINVAL);
+        std::lock_guard<std::mutex> lock{_mutex};
+        for(size_t i = 0; i < _instances.size(); ++i) {
+            if(!_instances[i]) {
+                _instances[i].reset(new Instance);
+                return firstFd() + static_cast<int>(i);
+            }
+        }
+        _instances.emplace_back(new Instance);
+        return firstFd() + static_cast<int>(_instances.size() - 1);
+    }
+
+    int epollCtl(int epfd, int op, int fd, epoll_event* event) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto instance = findInstance(epfd);
+        if(!instance) return fail(EBADF);
+        if(fd == epfd) return fail(EINVAL);
+        if(op != EPOLL_CTL_DEL && !event) return fail(EFAULT);
+
+        const auto it = instance->interests.find(fd);
+        switch(op) {
+        case EPOLL_CTL_ADD:
+            if(it != instance->interests.end()) return fail(EEXIST);
+            instance->interests[fd] = Interest{*event, true, 0};
+            return 0;
+        case EPOLL_CTL_MOD:
+            if(it == instance->interests.end()) return fail(ENOENT);
+            it->second = Interest{*event, true, 0};
+            return 0;
+        case EPOLL_CTL_DEL:
+            if(it == instance->interests.end()) return fail(ENOENT);
+            instance->interests.erase(it);
+            return 0;
+        default:
+            return fail(EINVAL);
+        }
+    }
+
+    int epollWait(int epfd, epoll_event* events, int maxEvents, int timeout) {
+        if(maxEvents <= 0) return fail(EINVAL);
+        return wait("epoll_wait", timeout, [&]() -> int {
+            auto instance = findInstance(epfd);
+            if(!instance) return fail(EBADF);
+            return collect(*instance, events, maxEvents);
+        });
+    }
+
+    int poll(pollfd* fds, nfds_t nfds, int timeout) {
+        return wait("poll", timeout, [&]() -> int {
+            int ready = 0;
+            for(nfds_t i = 0; i < nfds; ++i) {
+                fds[i].revents = 0;
+                if(fds[i].fd < 0) continue;
+                const auto it = _fds.find(fds[i].fd);
+                if(it == _fds.end()) continue;
+                const auto mask = static_cast<std::uint32_t>(static_cast<unsigned short>(fds[i].events)) |
+                    POLLERR | POLLHUP;
+                fds[i].revents = static_cast<short>(it->second.events & mask);
+                if(fds[i].revents) ++ready;
+            }
+            return ready;
+        });
+    }
+
+    /**
+     Forgets fd. Returns true if it was an epoll instance of this table, which
+     then needs no closing by anybody else.
+     */
+    bool close(int fd) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if(findInstance(fd)) {
+            _instances[fd - firstFd()].reset();
+            return true;
+        }
+        _fds.erase(fd);
+        for(auto& instance: _instances)
+            if(instance) instance->interests.erase(fd);
+        return false;
+    }
+
+private:
+
+    struct FdState {
+        std::uint32_t events;
+        std::uint64_t edges; // how many times it was made ready
+    };
+
+    struct Interest {
+        epoll_event event;
+        bool armed; // false after an EPOLLONESHOT event until EPOLL_CTL_MOD
+        std::uint64_t edgesSeen; // for EPOLLET
+    };
+
+    struct Instance {
+        std::map<int, Interest> interests;
+        int last = -1; // the last fd reported, to take turns when there are too many
+    };
+
+    struct Step {
+        std::vector<Readiness> changes;
+        std::function<void()> action;
+    };
+
+    mutable std::mutex _mutex;
+    std::unordered_map<int, FdState> _fds;
+    std::vector<std::unique_ptr<Instance>> _instances;
+    std::deque<Step> _timeline;
+    std::uint64_t _waits = 0;
+
+    // must be called with _mutex locked
+    void setLocked(int fd, std::uint32_t events) {
+        auto& state = _fds[fd];
+        state.events = events;
+        if(events) ++state.edges;
+    }
+
+    // must be called with _mutex locked
+    Instance* findInstance(int epfd) const noexcept {
+        const auto index = static_cast<size_t>(epfd) - static_cast<size_t>(firstFd());
+        return epfd >= firstFd() && index < _instances.size() ? _instances[index].get() : nullptr;
+    }
+
+    // Applies the next step of the timeline and calls ready until it finds
+    // something or the timeout, which is instant, says to stop looking.
+    template<typename F>
+    int wait(const char* function, int timeout, const F& ready) {
+        std::unique_lock<std::mutex> lock{_mutex};
+        ++_waits;
+        for(;;) {
+            const auto stepped = step(lock);
+            const auto result = ready();
+            if(result != 0 || timeout >= 0) return result;
+            if(!stepped)
+                throw MockException(std::string{function} + " would block forever: nothing is ready "
+                                    "and the timeline is over\n");
+        }
+    }
+
+    // must be called with lock locked, which it unlocks to run actions
+    bool step(std::unique_lock<std::mutex>& lock) {
+        if(_timeline.empty()) return false;
+        auto next = std::move(_timeline.front());
+        _timeline.pop_front();
+        for(const auto& change: next.changes) setLocked(change.fd, change.events);
+        if(next.action) {
+            lock.unlock();
+            next.action();
+            lock.lock();
+        }
+        return true;
+    }
+
+    // must be called with _mutex locked. Starts after the fd reported last so
+    // that fds take turns when more are ready than fit in events.
+    int collect(Instance& instance, epoll_event* events, int maxEvents) {
+        int count = 0;
+        auto it = instance.interests.upper_bound(instance.last);
+        for(size_t visited = 0; visited < instance.interests.size() && count < maxEvents; ++visited, ++it) {
+            if(it == instance.interests.end()) it = instance.interests.begin();
+            auto& interest = it->second;
+            if(!interest.armed) continue;
+            const auto state = _fds.find(it->first);
+            if(state == _fds.end()) continue;
+
+            const auto ready = state->second.events & (interest.event.events | EPOLLERR | EPOLLHUP);
+            if(!ready) continue;
+            if(interest.event.events & EPOLLET) {
+                if(interest.edgesSeen == state->second.edges) continue;
+                interest.edgesSeen = state->second.edges;
+            }
+            if(interest.event.events & EPOLLONESHOT) interest.armed = false;
+
+            events[count].events = ready;
+            events[count].data = interest.event.data;
+            ++count;
+            instance.last = it->first;
+        }
+        return count;
+    }
+
+    static int fail(int error) noexcept {
+        errno = error;
+        return -1;
+    }
+};
+
+
+/**
+ RAII class that makes the epoll and poll mocks of the current thread use a
+ ReadinessTable until the end of scope
+ */
+class VirtualPolling {
+public:
+
+    VirtualPolling():VirtualPolling{std::unique_ptr<ReadinessTable>{new ReadinessTable}, nullptr} {}
+
+    /**
+     Use an externally owned table, e.g. to share it with other threads
+     */
+    explicit VirtualPolling(ReadinessTable& table):
+        VirtualPolling{nullptr, &table} {
+    }
+
+    VirtualPolling(const VirtualPolling&) = delete;
+    VirtualPolling& operator=(const VirtualPolling&) = delete;
+
+    ReadinessTable& table() noexcept { return _table; }
+
+private:
+
+    std::unique_ptr<ReadinessTable> _ownTable; // only if no table was passed in
+    ReadinessTable& _table;
+    MockScope<decltype(mock_epoll_create)> _epollCreate;
+    MockScope<decltype(mock_epoll_create1)> _epollCreate1;
+    MockScope<decltype(mock_epoll_ctl)> _epollCtl;
+    MockScope<decltype(mock_epoll_wait)> _epollWait;
+    MockScope<decltype(mock_poll)> _poll;
+    MockScope<decltype(mock_close)> _close;
+
+    VirtualPolling(std::unique_ptr<ReadinessTable> ownTable, ReadinessTable* table):
+        _ownTable{std::move(ownTable)},
+        _table(table ? *table : *_ownTable),
+        _epollCreate{mock_epoll_create, [this](int size) { return _table.epollCreate(size); }},
+        _epollCreate1{mock_epoll_create1, [this](int flags) { return _table.epollCreate1(flags); }},
+        _epollCtl{mock_epoll_ctl, [this](int epfd, int op, int fd, epoll_event* event) {
+                return _table.owns(epfd) ? _table.epollCtl(epfd, op, fd, event) :
+                    _epollCtl.displaced()(epfd, op, fd, event);
+            }},
+        _epollWait{mock_epoll_wait, [this](int epfd, epoll_event* events, int maxEvents, int timeout) {
+                return _table.owns(epfd) ? _table.epollWait(epfd, events, maxEvents, timeout) :
+                    _epollWait.displaced()(epfd, events, maxEvents, timeout);
+            }},
+        _poll{mock_poll, [this](pollfd* fds, nfds_t nfds, int timeout) {
+                return _table.poll(fds, nfds, timeout);
+            }},
+        _close{mock_close, [this](int fd) {
+                return _table.close(fd) ? 0 : _close.displaced()(fd);
+            }} {
+    }
+};
+
+
+#endif // PREMOCK_EPOLL_HPP_
@@ -0,0 +1,241 @@
+/**
+Verifying calls made by child processes.
+
+After `fork` a child has its own copy of the test's mocks, so the calls it
+makes are recorded in memory the test can't see. `recordAcrossProcesses`
+switches a `Mock` or `Spy` to record into a ring buffer in shared memory
+instead, created before the children are forked, and the test verifies all
+of their calls as usual once they're done:
+
+```c++
+TEST(server, children_send) {
+    auto m = MOCK(send);
+    recordAcrossProcesses(m);
+    prefork_server(4);      // each child answers one request
+    wait_for_children();
+    m.expectCalled(4);
+}
+```
+
+Calls are recorded as fixed-size records, so every parameter type must be
+trivially copyable. Pointers are recorded as addresses, which only mean the
+same in every process for memory allocated before the fork. Any number of
+processes append without locks. Only the process that created the ring
+collects from it, and a call that doesn't fit because the ring is full is
+reported by the next expectation instead of being silently lost. Calls are
+collected in the order they claimed their slots, but processes don't share
+the sequence that orders calls to different mocks, so `callOrder` and
+`expectInSequence` throw `std::logic_error` for them.
+ */
+
+#ifndef PREMOCK_FORK_HPP_
+#define PREMOCK_FORK_HPP_
+
+#include "premock.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory needs address-free 64-bit atomics");
+
+
+/**
+ Converts a tuple of trivially copyable values to and from the bytes they're
+ stored as in shared memory, one after the other without padding
+ */
+template<typename Tuple>
+struct SharedRecord;
+
+template<typename... A>
+struct SharedRecord<std::tuple<A...>> {
+
+    using Tuple = std::tuple<A...>;
+
+    static constexpr bool triviallyCopyable() {
+        const bool trivial[] = {true, std::is_trivially_copyable<A>::value...};
+        for(auto t: trivial) if(!t) return false;
+        return true;
+    }
+
+    static_assert(triviallyCopyable(), "calls recorded across processes must have trivially copyable parameters");
+
+    static constexpr size_t size() {
+        const size_t sizes[] = {0, sizeof(A)...};
+        size_t total = 0;
+        for(auto s: sizes) total += s;
+        return total;
+    }
+
+    static void store(unsigned char* out, const Tuple& values) noexcept {
+        store(out, values, std::index_sequence_for<A...>{});
+    }
+
+    static Tuple load(const unsigned char* in) noexcept {
+        Tuple values;
+        load(in, values, std::index_sequence_for<A...>{});
+        return values;
+    }
+
+private:
+
+    template<size_t... I>
+    static void store(unsigned char* out, const Tuple& values, std::index_sequence<I...>) noexcept {
+        (void)out; (void)values;
+        (void)std::initializer_list<int>{0, (std::memcpy(out, &std::get<I>(values), sizeof(A)), out += sizeof(A), 0)...};
+    }
+
+    template<size_t... I>
+    static void load(const unsigned char* in, Tuple& values, std::index_sequence<I...>) noexcept {
+        (void)in; (void)values;
+        (void)std::initializer_list<int>{0, (std::memcpy(&std::get<I>(values), in, sizeof(A)), in += sizeof(A), 0)...};
+    }
+};
+
+
+/**
+ A bounded ring of calls in anonymous shared memory, inherited by every
+ process forked after it's created. Producers claim a slot by advancing the
+ shared head with a CAS and publish it by bumping the slot's sequence number,
+ so a producer that stops halfway only holds up the calls after its own.
+ */
+template<typename Tuple>
+class SharedCallRing: public CallSink<Tuple> {
+public:
+
+    /**
+     Room for at least capacity calls that haven't been collected yet
+     */
+    explicit SharedCallRing(size_t capacity = 4096):
+        _capacity{roundUp(capacity)},
+        _bytes{headerSize() + _capacity * slotSize()},
+        _owner{getpid()} {
+
+        void* memory = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(memory == MAP_FAILED)
+            throw std::runtime_error(std::string{"Could not map shared call ring: "} + strerror(errno));
+        _memory = static_cast<unsigned char*>(memory);
+
+        _header = new (_memory) Header;
+        for(size_t i = 0; i < _capacity; ++i)
+            new (_memory + headerSize() + i * slotSize()) std::atomic<std::uint64_t>{i};
+    }
+
+    ~SharedCallRing() override {
+        munmap(_memory, _bytes);
+    }
+
+    SharedCallRing(const SharedCallRing&) = delete;
+    SharedCallRing& operator=(const SharedCallRing&) = delete;
+
+    size_t capacity() const noexcept { return _capacity; }
+
+    void record(const Tuple& values) override {
+        auto position = _header->head.load(std::memory_order_relaxed);
+        for(;;) {
+            auto& sequence = sequenceAt(position);
+            const auto difference = static_cast<std::int64_t>(sequence.load(std::memory_order_acquire) - position);
+            if(difference == 0) {
+                if(_header->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    Record::store(valuesAt(position), values);
+                    sequence.store(position + 1, std::memory_order_release);
+                    return;
+                }
+            } else if(difference < 0) { // still holds a call nobody collected
+                _header->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                position = _header->head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     Does nothing in processes other than the one that created the ring.
+     Throws a MockException if calls were dropped since the last time.
+     */
+    void collect(const std::function<void(const Tuple&)>& func) override {
+        if(getpid() != _owner) return;
+
+        for(;;) {
+            auto& sequence = sequenceAt(_tail);
+            if(sequence.load(std::memory_order_acquire) != _tail + 1) break;
+            func(Record::load(valuesAt(_tail)));
+            sequence.store(_tail + _capacity, std::memory_order_release);
+            ++_tail;
+        }
+
+        const auto dropped = _header->dropped.exchange(0, std::memory_order_relaxed);
+        if(dropped)
+            throw MockException(std::to_string(dropped) + " calls were dropped because the shared call ring of " +
+                                std::to_string(_capacity) + " was full\n");
+    }
+
+    size_t bytes() const noexcept override { return _bytes; }
+
+private:
+
+    using Record = SharedRecord<Tuple>;
+
+    struct Header {
+        std::atomic<std::uint64_t> head{0};
+        char padding[64 - sizeof(std::atomic<std::uint64_t>)];
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    size_t _capacity;
+    size_t _bytes;
+    pid_t _owner;
+    unsigned char* _memory = nullptr;
+    Header* _header = nullptr;
+    std::uint64_t _tail = 0; // only the owner collects
+
+    static size_t roundUp(size_t capacity) noexcept {
+        size_t result = 1;
+        while(result < capacity) result *= 2;
+        return result;
+    }
+
+    static constexpr size_t headerSize() noexcept { return (sizeof(Header) + 63) / 64 * 64; }
+
+    // each slot is its sequence number followed by the record
+    static constexpr size_t slotSize() noexcept {
+        return (sizeof(std::atomic<std::uint64_t>) + Record::size() + 7) / 8 * 8;
+    }
+
+    unsigned char* slotAt(std::uint64_t position) const noexcept {
+        return _memory + headerSize() + (position & (_capacity - 1)) * slotSize();
+    }
+
+    std::atomic<std::uint64_t>& sequenceAt(std::uint64_t position) const noexcept {
+        return *reinterpret_cast<std::atomic<std::uint64_t>*>(slotAt(position));
+    }
+
+    unsigned char* valuesAt(std::uint64_t position) const noexcept {
+        return slotAt(position) + sizeof(std::atomic<std::uint64_t>);
+    }
+};
+
+
+/**
+ Makes recorder, a Mock or Spy, record its calls in a SharedCallRing from
+ now on so that the calls made by processes forked afterwards can be verified
+ */
+template<typename R>
+void recordAcrossProcesses(R& recorder, size_t capacity = 4096) {
+    using Tuple = typename R::ParamTupleType;
+    recorder.recordInto(std::unique_ptr<CallSink<Tuple>>{new SharedCallRing<Tuple>{capacity}});
+}
+
+
+#endif // PREMOCK_FORK_HPP_
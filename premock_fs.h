@@ -0,0 +1,11 @@
+#ifndef PREMOCK_FS_H_
+#define PREMOCK_FS_H_
+
+#define open ut_premock_open
+#define read ut_premock_read
+#define write ut_premock_write
+#define lseek ut_premock_lseek
+#define fstat ut_premock_fstat
+#define close ut_premock_close
+
+#endif // PREMOCK_FS_H_
@@ -0,0 +1,412 @@
+/**
+In-memory files for code that does POSIX file I/O.
+
+The mocks for `open`, `read`, `write`, `lseek`, `fstat` and `close` declared here
+are backed by a `MemoryFileSystem`: a table of files held in RAM, optionally
+seeded from real files that are memory mapped and only copied when written to.
+File descriptors, offsets and the common errors behave like the real thing,
+so test suites doing thousands of file operations run at memory speed and
+have nothing to clean up afterwards.
+
+`open` is variadic, which the generic mock macros can't handle, so it has
+its own declaration and implementation macro. The production code needs the
+redefinitions in `premock_fs.h` and the test binary has to implement the
+mocks:
+
+```c++
+#include "premock_fs.hpp"
+extern "C" {
+    IMPL_MOCK_OPEN();
+    IMPL_MOCK_DEFAULT(3, read);
+    IMPL_MOCK_DEFAULT(3, write);
+    IMPL_MOCK_DEFAULT(3, lseek);
+    IMPL_MOCK_DEFAULT(2, fstat);
+    IMPL_MOCK_DEFAULT(1, close);
+}
+```
+
+Test code then does:
+
+```c++
+TEST(config, parse) {
+    MemoryFiles files;
+    files.fileSystem().addFile("/etc/app.conf", "port = 8080\n");
+    REQUIRE(load_config("/etc/app.conf").port == 8080);
+}
+```
+
+Only paths starting with the mount point passed to the file system (all of
+them by default) are handled in memory, the rest and any file descriptors
+the file system doesn't own go to the previous implementation.
+ */
+
+#ifndef PREMOCK_FS_HPP_
+#define PREMOCK_FS_HPP_
+
+#include "premock.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+DECL_MOCK(read);
+DECL_MOCK(write);
+DECL_MOCK(lseek);
+DECL_MOCK(fstat);
+DECL_MOCK(close);
+
+/**
+ The mock for open. It takes the mode explicitly since the real function is
+ variadic and std::function can't be.
+ */
+extern "C" MockRegistration premock_registration_open;
+extern "C" thread_local std::function<int(const char*, int, mode_t)> mock_open;
+
+#ifdef O_TMPFILE
+#    define PREMOCK_OPEN_NEEDS_MODE(flags) ((flags) & (O_CREAT | O_TMPFILE))
+#else
+#    define PREMOCK_OPEN_NEEDS_MODE(flags) ((flags) & O_CREAT)
+#endif
+
+/**
+ The implementation of the mock for open, defaulting to the real function.
+ Like IMPL_MOCK_DEFAULT, it should be used in an extern "C" block.
+ */
+#define IMPL_MOCK_OPEN() \
+    int ut_premock_open(const char* path, int flags, ...) { \
+        premockCallSite() = PREMOCK_RETURN_ADDRESS(); \
+        premock_registration_open.called(); \
+        mode_t mode = 0; \
+        if(PREMOCK_OPEN_NEEDS_MODE(flags)) { \
+            va_list args; \
+            va_start(args, flags); \
+            mode = va_arg(args, mode_t); \
+            va_end(args); \
+        } \
+        return mock_open(path, flags, mode); \
+    } \
+    MOCK_REGISTRATION(open); \
+    thread_local decltype(mock_open) mock_open = [](const char* path, int flags, mode_t mode) { \
+        return open(path, flags, mode); \
+    }
+
+
+/**
+ The files and open file descriptors of an in-memory file system. Can be
+ used from several threads at once, each with its own MemoryFiles scope.
+ */
+class MemoryFileSystem {
+public:
+
+    /**
+     The first fake file descriptor handed out. High enough to not clash with
+     real ones or with the ones from LoopbackNetwork.
+     */
+    static constexpr int firstFd() noexcept { return 1 << 21; }
+
+    explicit MemoryFileSystem(std::string mountPoint = "", size_t maxOpenFiles = 1024):
+        _mountPoint(std::move(mountPoint)),
+        _openFiles(maxOpenFiles) {
+    }
+
+    MemoryFileSystem(const MemoryFileSystem&) = delete;
+    MemoryFileSystem& operator=(const MemoryFileSystem&) = delete;
+
+    /**
+     Creates (or replaces) a file with the given contents
+     */
+    void addFile(const std::string& path, const std::string& contents, mode_t mode = 0644) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto file = std::make_shared<File>(++_lastInode, mode);
+        file->data.assign(contents.begin(), contents.end());
+        _files[path] = std::move(file);
+    }
+
+    /**
+     Creates a file at path with the contents of realPath, which is memory
+     mapped and only copied if the in-memory file is written to. Throws
+     if realPath can't be read.
+     */
+    void seedFromFile(const std::string& path, const std::string& realPath) {
+        const auto fd = ::open(realPath.c_str(), O_RDONLY);
+        if(fd == -1) throw std::runtime_error("Could not open " + realPath + ": " + strerror(errno));
+
+        struct stat info;
+        const auto statResult = ::fstat(fd, &info);
+        void* mapped = nullptr;
+        if(statResult == 0 && info.st_size > 0)
+            mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(statResult != 0 || mapped == MAP_FAILED)
+            throw std::runtime_error("Could not map " + realPath + ": " + strerror(errno));
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto file = std::make_shared<File>(++_lastInode, info.st_mode & 07777);
+        file->mapped = static_cast<const char*>(mapped);
+        file->mappedSize = static_cast<size_t>(info.st_size);
+        _files[path] = std::move(file);
+    }
+
+    bool exists(const std::string& path) const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _files.count(path) != 0;
+    }
+
+    /**
+     The current contents of a file. Throws if it doesn't exist.
+     */
+    std::string contents(const std::string& path) const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto it = _files.find(path);
+        if(it == _files.end()) throw std::logic_error("No in-memory file " + path);
+        return std::string(it->second->bytes(), it->second->size());
+    }
+
+    /**
+     Whether path is on this file system
+     */
+    bool handles(const char* path) const noexcept {
+        return path && strncmp(path, _mountPoint.c_str(), _mountPoint.size()) == 0;
+    }
+
+    /**
+     Whether fd is one of this file system's fake file descriptors
+     */
+    bool owns(int fd) const noexcept {
+        return fd >= firstFd() && static_cast<size_t>(fd - firstFd()) < _openFiles.size();
+    }
+
+    int open(const char* path, int flags, mode_t mode) {
+        if(!path) return fail(EFAULT);
+        const auto access = flags & O_ACCMODE;
+        if(access != O_RDONLY && access != O_WRONLY && access != O_RDWR) return fail(EINVAL);
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto it = _files.find(path);
+        if(it == _files.end()) {
+            if(!(flags & O_CREAT)) return fail(ENOENT);
+            it = _files.emplace(path, std::make_shared<File>(++_lastInode, mode & 07777)).first;
+        } else if((flags & O_CREAT) && (flags & O_EXCL)) {
+            return fail(EEXIST);
+        }
+
+        if((flags & O_TRUNC) && access != O_RDONLY) it->second->truncate();
+
+        for(size_t i = 0; i < _openFiles.size(); ++i) {
+            if(!_openFiles[i].file) {
+                _openFiles[i] = OpenFile{it->second, 0, flags};
+                return firstFd() + static_cast<int>(i);
+            }
+        }
+        return fail(EMFILE);
+    }
+
+    ssize_t read(int fd, void* buffer, size_t length) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto openFile = find(fd);
+        if(!openFile || (openFile->flags & O_ACCMODE) == O_WRONLY) return fail(EBADF);
+        if(!buffer && length) return fail(EFAULT);
+
+        const auto& file = *openFile->file;
+        const auto offset = static_cast<size_t>(openFile->offset);
+        if(offset >= file.size()) return 0;
+        const auto count = std::min(length, file.size() - offset);
+        memcpy(buffer, file.bytes() + offset, count);
+        openFile->offset += static_cast<off_t>(count);
+        return static_cast<ssize_t>(count);
+    }
+
+    ssize_t write(int fd, const void* buffer, size_t length) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto openFile = find(fd);
+        if(!openFile || (openFile->flags & O_ACCMODE) == O_RDONLY) return fail(EBADF);
+        if(!buffer && length) return fail(EFAULT);
+
+        auto& file = *openFile->file;
+        auto& data = file.writable();
+        if(openFile->flags & O_APPEND) openFile->offset = static_cast<off_t>(data.size());
+        const auto offset = static_cast<size_t>(openFile->offset);
+        // writing past the end leaves a hole of zeros, like a sparse file
+        if(data.size() < offset + length) data.resize(offset + length);
+        if(length) memcpy(&data[offset], buffer, length);
+        openFile->offset += static_cast<off_t>(length);
+        return static_cast<ssize_t>(length);
+    }
+
+    off_t lseek(int fd, off_t offset, int whence) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto openFile = find(fd);
+        if(!openFile) return fail(EBADF);
+
+        off_t base;
+        switch(whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = openFile->offset; break;
+        case SEEK_END: base = static_cast<off_t>(openFile->file->size()); break;
+        default: return fail(EINVAL);
+        }
+
+        if(base + offset < 0) return fail(EINVAL);
+        openFile->offset = base + offset;
+        return openFile->offset;
+    }
+
+    int fstat(int fd, struct stat* info) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto openFile = find(fd);
+        if(!openFile) return fail(EBADF);
+        if(!info) return fail(EFAULT);
+
+        const auto& file = *openFile->file;
+        *info = {};
+        info->st_ino = file.inode;
+        info->st_mode = S_IFREG | file.mode;
+        info->st_nlink = 1;
+        info->st_size = static_cast<off_t>(file.size());
+        info->st_blksize = 4096;
+        info->st_blocks = static_cast<blkcnt_t>((file.size() + 511) / 512);
+        return 0;
+    }
+
+    int close(int fd) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto openFile = find(fd);
+        if(!openFile) return fail(EBADF);
+        *openFile = OpenFile{};
+        return 0;
+    }
+
+private:
+
+    struct File {
+
+        File(ino_t inode_, mode_t mode_):inode{inode_}, mode{mode_} {}
+
+        ~File() {
+            if(mapped) munmap(const_cast<char*>(mapped), mappedSize);
+        }
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        const ino_t inode;
+        const mode_t mode;
+        std::vector<char> data;
+        // contents seeded from a real file stay mapped until written to
+        const char* mapped = nullptr;
+        size_t mappedSize = 0;
+
+        const char* bytes() const noexcept { return mapped ? mapped : data.data(); }
+        size_t size() const noexcept { return mapped ? mappedSize : data.size(); }
+
+        std::vector<char>& writable() {
+            if(mapped) {
+                data.assign(mapped, mapped + mappedSize);
+                munmap(const_cast<char*>(mapped), mappedSize);
+                mapped = nullptr;
+                mappedSize = 0;
+            }
+            return data;
+        }
+
+        void truncate() {
+            writable().clear();
+        }
+    };
+
+    struct OpenFile {
+        std::shared_ptr<File> file;
+        off_t offset;
+        int flags;
+    };
+
+    const std::string _mountPoint;
+    std::map<std::string, std::shared_ptr<File>> _files;
+    std::vector<OpenFile> _openFiles;
+    ino_t _lastInode = 0;
+    mutable std::mutex _mutex;
+
+    // must be called with _mutex locked
+    OpenFile* find(int fd) noexcept {
+        if(!owns(fd)) return nullptr;
+        auto& openFile = _openFiles[fd - firstFd()];
+        return openFile.file ? &openFile : nullptr;
+    }
+
+    static int fail(int error) noexcept {
+        errno = error;
+        return -1;
+    }
+};
+
+
+/**
+ RAII class that makes the file mocks of the current thread use a
+ MemoryFileSystem until the end of scope.
+ */
+class MemoryFiles {
+public:
+
+    explicit MemoryFiles(std::string mountPoint = ""):
+        MemoryFiles{std::unique_ptr<MemoryFileSystem>{new MemoryFileSystem{std::move(mountPoint)}}, nullptr} {
+    }
+
+    /**
+     Use an externally owned file system, e.g. to share it with other threads
+     */
+    explicit MemoryFiles(MemoryFileSystem& fileSystem):
+        MemoryFiles{nullptr, &fileSystem} {
+    }
+
+    MemoryFileSystem& fileSystem() noexcept { return _fileSystem; }
+
+private:
+
+    std::unique_ptr<MemoryFileSystem> _ownFileSystem; // only if no file system was passed in
+    MemoryFileSystem& _fileSystem;
+    MockScope<decltype(mock_open)> _open;
+    MockScope<decltype(mock_read)> _read;
+    MockScope<decltype(mock_write)> _write;
+    MockScope<decltype(mock_lseek)> _lseek;
+    MockScope<decltype(mock_fstat)> _fstat;
+    MockScope<decltype(mock_close)> _close;
+
+    MemoryFiles(std::unique_ptr<MemoryFileSystem> ownFileSystem, MemoryFileSystem* fileSystem):
+        _ownFileSystem{std::move(ownFileSystem)},
+        _fileSystem(fileSystem ? *fileSystem : *_ownFileSystem),
+        _open{mock_open, [this](const char* path, int flags, mode_t mode) {
+                return _fileSystem.handles(path) ? _fileSystem.open(path, flags, mode) :
+                    _open.displaced()(path, flags, mode);
+            }},
+        _read{mock_read, [this](int fd, void* buffer, size_t length) {
+                return _fileSystem.owns(fd) ? _fileSystem.read(fd, buffer, length) :
+                    _read.displaced()(fd, buffer, length);
+            }},
+        _write{mock_write, [this](int fd, const void* buffer, size_t length) {
+                return _fileSystem.owns(fd) ? _fileSystem.write(fd, buffer, length) :
+                    _write.displaced()(fd, buffer, length);
+            }},
+        _lseek{mock_lseek, [this](int fd, off_t offset, int whence) {
+                return _fileSystem.owns(fd) ? _fileSystem.lseek(fd, offset, whence) :
+                    _lseek.displaced()(fd, offset, whence);
+            }},
+        _fstat{mock_fstat, [this](int fd, struct stat* info) {
+                return _fileSystem.owns(fd) ? _fileSystem.fstat(fd, info) : _fstat.displaced()(fd, info);
+            }},
+        _close{mock_close, [this](int fd) {
+                return _fileSystem.owns(fd) ? _fileSystem.close(fd) : _close.displaced()(fd);
+            }} {
+    }
+};
+
+
+#endif // PREMOCK_FS_HPP_
@@ -0,0 +1,289 @@
+/**
+Mocks driven by fuzzer input.
+
+A `FuzzMock` takes the return values and output parameter contents of the
+mocked function from the bytes of the current fuzzing iteration, so that a
+fuzzer explores how the code under test reacts to whatever its dependencies
+might do. Like a `Mock`, it records the calls it gets so that expectations
+can be verified on them, but only those of the current iteration: the first
+call of each iteration forgets the previous one's, keeping their memory. The
+mock is installed once; after that each call only reads from a `FuzzInput`
+and each iteration only resets a cursor into it. Once the history has grown
+to the most calls an iteration makes nothing on that path allocates and no
+`std::function` gets reassigned, which keeps the fuzzer running at full
+speed.
+
+```c++
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static FuzzInput input;
+    // installed once and never destroyed so that it outlives the fuzzer,
+    // recv's buffer gets up to len (parameter 2) bytes from the input in
+    // every call and recv returns how many it got
+    static auto& recvMock = (new FuzzMock<decltype(mock_recv)>{mock_recv, input})->
+        outputArray<1, 2>(4096).returnBytesWritten<1>();
+    input.reset(data, size);
+    parse_message_from_socket(42);
+    return 0;
+}
+```
+
+The input's cursor isn't synchronised, so a fuzzed mock must only be called
+from one thread and not be inherited with `InheritMocks`.
+ */
+
+#ifndef PREMOCK_FUZZ_HPP_
+#define PREMOCK_FUZZ_HPP_
+
+#include "premock.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+
+/**
+ The bytes of the current fuzzing iteration, shared by all the FuzzMocks
+ bound to it. Once they run out every value consumed is zero.
+ */
+class FuzzInput {
+public:
+
+    /**
+     Starts a new iteration. Cheap: it only resets the cursor into data,
+     which must stay valid until the next call to reset.
+     */
+    void reset(const std::uint8_t* data, size_t size) noexcept {
+        _data = data;
+        _size = size;
+        _position = 0;
+        ++_iteration;
+    }
+
+    /**
+     Consumes sizeof(T) bytes and returns them as a T
+     */
+    template<typename T>
+    T consume() noexcept {
+        static_assert(std::is_trivially_copyable<T>::value, "Can only consume trivially copyable types");
+        T value{};
+        consumeRaw(&value, sizeof(T));
+        return value;
+    }
+
+    /**
+     Consumes a length between 0 and maxLength and then that many bytes into
+     output, returns the length
+     */
+    size_t consumeBytes(void* output, size_t maxLength) noexcept {
+        if(maxLength == 0) return 0;
+        // maxLength + 1 would wrap to 0 if maxLength is SIZE_MAX, but then
+        // every length that can be consumed is already in range
+        const auto wanted = static_cast<size_t>(consume<std::uint32_t>());
+        const auto length = std::min(wanted <= maxLength ? wanted : wanted % (maxLength + 1),
+                                     remaining());
+        consumeRaw(output, length);
+        return length;
+    }
+
+    size_t remaining() const noexcept { return _size - _position; }
+
+    /**
+     Incremented each time reset is called
+     */
+    std::uint64_t iteration() const noexcept { return _iteration; }
+
+private:
+
+    const std::uint8_t* _data = nullptr;
+    size_t _size = 0;
+    size_t _position = 0;
+    std::uint64_t _iteration = 0;
+
+    void consumeRaw(void* output, size_t length) noexcept {
+        const auto count = std::min(length, remaining());
+        if(count) memcpy(output, _data + _position, count);
+        _position += count;
+    }
+};
+
+
+/**
+ A mock whose return values and output parameters come from a FuzzInput.
+ Arithmetic and enum return types are read straight from the input; for
+ any other type, or to restrict the values returned, use returnOneOf.
+ Each call consumes its return value first and then the output parameters
+ in order, unless it returns how many bytes it wrote. The calls of the
+ current iteration are recorded as a Mock's are.
+ */
+template<typename T>
+class FuzzMock: public CallRecorder<T> {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+    using ParamTupleType = typename CallRecorder<T>::ParamTupleType;
+
+    FuzzMock(T& func, FuzzInput& input):
+        _input(input),
+        _mockScope{func, [this](auto... args) {
+                if(_iteration != _input.iteration()) {
+                    _iteration = _input.iteration();
+                    _calls = 0;
+                    this->forgetCalls();
+                }
+                ++_calls;
+                this->record(args...);
+                if(_returnWritten != noParameter) {
+                    this->fillOutputs(std::index_sequence_for<decltype(args)...>{}, args...);
+                    return static_cast<ReturnType>(
+                        this->template asReturnValue<ReturnValueType<ReturnType>>(_written[_returnWritten]));
+                }
+                const auto ret = this->template nextReturnValue<ReturnValueType<ReturnType>>();
+                this->fillOutputs(std::index_sequence_for<decltype(args)...>{}, args...);
+                return static_cast<ReturnType>(ret);
+            }} {
+        _lengthParameters.fill(size_t{noParameter});
+        _mockScope.setHistory(this);
+    }
+
+    /**
+     Makes the mock return one of these values, chosen by the input
+     */
+    FuzzMock& returnOneOf(std::initializer_list<ReturnValueType<ReturnType>> values) {
+        _returnChoices.assign(values.begin(), values.end());
+        return *this;
+    }
+
+    /**
+     Fill the pointer parameter at position I with up to maxLength elements
+     from the input in every call
+     */
+    template<size_t I>
+    FuzzMock& outputArray(size_t maxLength) {
+        std::get<I>(_outputLengths) = maxLength;
+        return *this;
+    }
+
+    /**
+     Fill the pointer parameter at position I with up to maxLength elements
+     from the input in every call, and never more than the integer parameter
+     at position LengthIndex says the caller's buffer has room for
+     */
+    template<size_t I, size_t LengthIndex>
+    FuzzMock& outputArray(size_t maxLength) {
+        static_assert(std::is_integral<std::tuple_element_t<LengthIndex, ParamTupleType>>::value,
+                      "The length of an output array must be an integer parameter");
+        std::get<I>(_lengthParameters) = LengthIndex;
+        return outputArray<I>(maxLength);
+    }
+
+    /**
+     Make the mock return how many bytes it wrote to the output parameter at
+     position I instead of consuming a return value, as read and recv do
+     */
+    template<size_t I>
+    FuzzMock& returnBytesWritten() {
+        static_assert(std::is_arithmetic<ReturnType>::value, "Can only return a byte count as a number");
+        _returnWritten = I;
+        return *this;
+    }
+
+    /**
+     Fill the pointer parameter at position I with one element from the
+     input in every call
+     */
+    template<size_t I>
+    FuzzMock& outputParam() {
+        return outputArray<I>(1);
+    }
+
+    /**
+     How many times the mock was called in the current iteration
+     */
+    size_t calls() const noexcept {
+        return _iteration == _input.iteration() ? _calls : 0;
+    }
+
+private:
+
+    static constexpr size_t noParameter = std::numeric_limits<size_t>::max();
+    static constexpr size_t numParameters = std::tuple_size<ParamTupleType>::value;
+
+    FuzzInput& _input;
+    std::array<size_t, numParameters> _outputLengths{};
+    std::array<size_t, numParameters> _lengthParameters{};
+    std::array<size_t, numParameters> _written{}; // bytes, in the last call
+    size_t _returnWritten = noParameter;
+    std::vector<ReturnValueType<ReturnType>> _returnChoices;
+    std::uint64_t _iteration = 0;
+    size_t _calls = 0;
+    MockScope<T> _mockScope;
+
+    template<size_t... I, typename... A>
+    void fillOutputs(std::index_sequence<I...>, A... args) noexcept {
+        int expand[] = {0, (_written[I] = fillOutput<I>(args, args...), 0)...};
+        (void)expand;
+    }
+
+    // returns how many bytes it wrote
+    template<size_t I, typename A, typename... As>
+    std::enable_if_t<std::is_pointer<A>::value && !std::is_const<std::remove_pointer_t<A>>::value, size_t>
+    fillOutput(A arg, As... args) noexcept {
+        using Element = std::conditional_t<std::is_void<std::remove_pointer_t<A>>::value,
+                                           char, std::remove_pointer_t<A>>;
+        auto length = std::get<I>(_outputLengths);
+        const auto lengthParameter = std::get<I>(_lengthParameters);
+        if(lengthParameter != noParameter)
+            length = std::min(length, static_cast<size_t>(countParameterAt(lengthParameter, args...)));
+        length = std::min(length, std::numeric_limits<size_t>::max() / sizeof(Element));
+        return arg && length ? _input.consumeBytes(arg, length * sizeof(Element)) : 0;
+    }
+
+    template<size_t I, typename A, typename... As>
+    std::enable_if_t<!std::is_pointer<A>::value || std::is_const<std::remove_pointer_t<A>>::value, size_t>
+    fillOutput(A, As...) noexcept { return 0; }
+
+    template<typename R>
+    static std::enable_if_t<std::is_arithmetic<R>::value, R> asReturnValue(size_t bytes) noexcept {
+        return static_cast<R>(bytes);
+    }
+
+    template<typename R>
+    static std::enable_if_t<!std::is_arithmetic<R>::value, R> asReturnValue(size_t) noexcept { return R{}; }
+
+    template<typename R>
+    std::enable_if_t<std::is_arithmetic<R>::value || std::is_enum<R>::value, R>
+    nextReturnValue() noexcept {
+        return _returnChoices.empty() ? _input.consume<R>() : chooseReturn();
+    }
+
+    template<typename R>
+    std::enable_if_t<!std::is_arithmetic<R>::value && !std::is_enum<R>::value, R>
+    nextReturnValue() noexcept {
+        return _returnChoices.empty() ? R{} : chooseReturn();
+    }
+
+    ReturnValueType<ReturnType> chooseReturn() noexcept {
+        return _returnChoices[_input.consume<std::uint32_t>() % _returnChoices.size()];
+    }
+};
+
+
+/**
+ Helper function to create a FuzzMock
+ */
+template<typename T>
+FuzzMock<T> fuzzMock(T& func, FuzzInput& input) {
+    return {func, input};
+}
+
+/**
+ Helper macro to make a particular "real" function take its behaviour from
+ the fuzzer's input
+ */
+#define FUZZ_MOCK(func, input) fuzzMock(mock_##func, input)
+
+
+#endif // PREMOCK_FUZZ_HPP_
@@ -0,0 +1,271 @@
+/**
+Latency injection for modelling slow dependencies in benchmarks.
+
+Wraps whatever implementation a mock currently has (the real function, a
+`REPLACE` lambda, a `MOCK`...) so that every call is delayed according to a
+latency policy before being forwarded. Since it's built on `MockScope` it
+composes with everything else and restores the previous implementation at
+the end of scope:
+
+```c++
+BENCHMARK(handler_with_slow_network) {
+    REPLACE(send, [](auto, auto, auto len, auto) { return len; });
+    auto latency = LATENCY(send, LogNormalLatency{std::chrono::microseconds{50}, 0.5});
+    run_request_handler();
+    // the time spent sleeping in send, to correct the benchmark results
+    report(latency.injected());
+}
+```
+
+Delays are enforced either by calibrated busy-waiting (the default), which
+is accurate to well under a microsecond, or by advancing a `VirtualClock`.
+Policies and the injected total aren't synchronised, so a `LATENCY` scope
+must only be called from the thread that created it and not be inherited
+with `InheritMocks`.
+ */
+
+#ifndef PREMOCK_LATENCY_HPP_
+#define PREMOCK_LATENCY_HPP_
+
+#include "premock.hpp"
+#include "premock_time.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+/**
+ Always the same delay
+ */
+class FixedLatency {
+public:
+
+    explicit FixedLatency(std::chrono::nanoseconds delay):_delay{delay} {}
+
+    std::chrono::nanoseconds operator()() const noexcept { return _delay; }
+
+private:
+
+    std::chrono::nanoseconds _delay;
+};
+
+
+/**
+ Delays uniformly distributed between min and max (inclusive)
+ */
+class UniformLatency {
+public:
+
+    UniformLatency(std::chrono::nanoseconds min, std::chrono::nanoseconds max,
+                   std::mt19937_64::result_type seed = std::mt19937_64::default_seed):
+        _engine{seed},
+        _distribution{min.count(), max.count()} {
+    }
+
+    std::chrono::nanoseconds operator()() {
+        return std::chrono::nanoseconds{_distribution(_engine)};
+    }
+
+private:
+
+    std::mt19937_64 _engine;
+    std::uniform_int_distribution<std::chrono::nanoseconds::rep> _distribution;
+};
+
+
+/**
+ Log-normally distributed delays, the usual shape of network and disk latencies.
+ The median is the delay half the calls are faster than, sigma the standard
+ deviation of the logarithm of the delay.
+ */
+class LogNormalLatency {
+public:
+
+    LogNormalLatency(std::chrono::nanoseconds median, double sigma,
+                     std::mt19937_64::result_type seed = std::mt19937_64::default_seed):
+        _engine{seed},
+        _distribution{std::log(static_cast<double>(median.count())), sigma} {
+    }
+
+    std::chrono::nanoseconds operator()() {
+        return std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(_distribution(_engine))};
+    }
+
+private:
+
+    std::mt19937_64 _engine;
+    std::lognormal_distribution<double> _distribution;
+};
+
+
+/**
+ Replays previously recorded delays in order, starting over when they run out
+ */
+class ReplayLatency {
+public:
+
+    explicit ReplayLatency(std::vector<std::chrono::nanoseconds> delays):
+        _delays(std::move(delays)) {
+        if(_delays.empty()) throw std::logic_error("ReplayLatency needs at least one delay");
+    }
+
+    /**
+     Reads delays in nanoseconds from a file, one per line
+     */
+    static ReplayLatency fromFile(const std::string& fileName) {
+        std::ifstream file{fileName};
+        if(!file) throw std::runtime_error("Could not open latency file " + fileName);
+
+        std::vector<std::chrono::nanoseconds> delays;
+        std::chrono::nanoseconds::rep delay;
+        while(file >> delay) delays.emplace_back(delay);
+        return ReplayLatency{std::move(delays)};
+    }
+
+    std::chrono::nanoseconds operator()() noexcept {
+        const auto delay = _delays[_index];
+        if(++_index == _delays.size()) _index = 0;
+        return delay;
+    }
+
+private:
+
+    std::vector<std::chrono::nanoseconds> _delays;
+    size_t _index = 0;
+};
+
+
+/**
+ Enforces delays by spinning on the steady clock. The time it takes to read the
+ clock is measured on construction and accounted for, so that short delays
+ aren't systematically too long. Returns the delay actually spent spinning.
+ */
+class BusyWait {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    BusyWait():_clockOverhead{calibrate()} {}
+
+    std::chrono::nanoseconds operator()(std::chrono::nanoseconds delay) const noexcept {
+        const auto start = Clock::now();
+        if(delay <= std::chrono::nanoseconds::zero()) return std::chrono::nanoseconds::zero();
+
+        const auto deadline = start + delay - _clockOverhead;
+        auto now = start;
+        while(now < deadline) now = Clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now - start + _clockOverhead);
+    }
+
+    /**
+     How long it takes to read the clock
+     */
+    std::chrono::nanoseconds clockOverhead() const noexcept { return _clockOverhead; }
+
+private:
+
+    std::chrono::nanoseconds _clockOverhead;
+
+    // the minimum over many samples is the best estimate of the cost of
+    // reading the clock since nothing can make it faster than it is
+    static std::chrono::nanoseconds calibrate() noexcept {
+        auto best = std::chrono::nanoseconds::max();
+        for(int i = 0; i < 1000; ++i) {
+            const auto start = Clock::now();
+            const auto end = Clock::now();
+            best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start));
+        }
+        return best;
+    }
+};
+
+
+/**
+ Enforces delays by advancing a VirtualClock, which takes no real time at all
+ */
+class VirtualDelay {
+public:
+
+    explicit VirtualDelay(VirtualClock& clock):_clock(clock) {}
+
+    std::chrono::nanoseconds operator()(std::chrono::nanoseconds delay) const noexcept {
+        if(delay <= std::chrono::nanoseconds::zero()) return std::chrono::nanoseconds::zero();
+        _clock.advance(delay);
+        return delay;
+    }
+
+private:
+
+    VirtualClock& _clock;
+};
+
+
+/**
+ RAII class that delays every call to the mock by what Policy says
+ and then forwards to the implementation it replaced. Keeps track of
+ how much delay was actually injected.
+ */
+template<typename T, typename Policy, typename Enforcer = BusyWait>
+class LatencyScope {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+
+    LatencyScope(T& func, Policy policy, Enforcer enforcer = Enforcer{}):
+        _policy(std::move(policy)),
+        _enforcer(std::move(enforcer)),
+        _mockScope{func, [this](auto&&... args) -> ReturnType {
+                const auto injected = _enforcer(_policy());
+                _injected += injected;
+                _last = injected;
+                ++_calls;
+                return _mockScope.displaced()(std::forward<decltype(args)>(args)...);
+            }} {
+    }
+
+    /**
+     Total delay injected in all calls so far
+     */
+    std::chrono::nanoseconds injected() const noexcept { return _injected; }
+
+    /**
+     Delay injected in the last call
+     */
+    std::chrono::nanoseconds lastInjected() const noexcept { return _last; }
+
+    /**
+     How many calls were delayed
+     */
+    size_t calls() const noexcept { return _calls; }
+
+private:
+
+    Policy _policy;
+    Enforcer _enforcer;
+    std::chrono::nanoseconds _injected{};
+    std::chrono::nanoseconds _last{};
+    size_t _calls = 0;
+    MockScope<T> _mockScope;
+};
+
+
+/**
+ Helper function to create a LatencyScope
+ */
+template<typename T, typename Policy, typename Enforcer = BusyWait>
+LatencyScope<T, Policy, Enforcer> injectLatency(T& func, Policy policy, Enforcer enforcer = Enforcer{}) {
+    return {func, std::move(policy), std::move(enforcer)};
+}
+
+/**
+ Helper macro to delay calls to a particular "real" function, e.g.
+ auto latency = LATENCY(send, FixedLatency{std::chrono::microseconds{10}});
+ */
+#define LATENCY(func, ...) injectLatency(mock_##func, __VA_ARGS__)
+
+
+#endif // PREMOCK_LATENCY_HPP_
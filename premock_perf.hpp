@@ -0,0 +1,344 @@
+/**
+CPU counters for production code, excluding the time spent in dependencies.
+
+A `CpuProfile` watches a set of mocks and reads the thread's performance
+counters every time control enters or leaves one of them. Everything counted
+outside a mocked call is attributed to the production code and everything
+inside to its dependencies, which measures the CPU cost of the code under
+test independently of I/O:
+
+```c++
+TEST(parser, cpu_cost) {
+    CpuProfile profile;
+    profile.watch(mock_recv).watch(mock_send);
+    handle_requests(1000);
+    std::cout << profile.report();
+    REQUIRE(profile.production().instructions < 50000000);
+}
+```
+
+Instructions, cycles and cache misses come from `perf_event_open`. When the
+PMU isn't available (as in most VMs and containers, or with a restrictive
+`perf_event_paranoid`) only the software task clock is counted, and if
+`perf_event_open` is disallowed altogether the thread CPU time clock is used
+instead. Counting is per thread and only covers user space. When there are
+more events than hardware counters the kernel multiplexes them and the
+counts are scaled up from the time they were actually counted, which
+`report` points out. The watched mocks must only be called from the
+thread that created the profile, so it must not be inherited with
+`InheritMocks`. Linux only.
+ */
+
+#ifndef PREMOCK_PERF_HPP_
+#define PREMOCK_PERF_HPP_
+
+#include "premock.hpp"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/**
+ Counter values, or differences between them. Hardware counts are zero if
+ the hardware counters aren't available.
+ */
+struct PerfSample {
+    std::uint64_t instructions = 0;
+    std::uint64_t cycles = 0;
+    std::uint64_t cacheMisses = 0;
+    std::uint64_t taskClock = 0; // nanoseconds of CPU time
+    // nanoseconds the counters were enabled, and actually counting
+    std::uint64_t timeEnabled = 0;
+    std::uint64_t timeRunning = 0;
+
+    PerfSample& operator+=(const PerfSample& other) noexcept {
+        instructions += other.instructions;
+        cycles += other.cycles;
+        cacheMisses += other.cacheMisses;
+        taskClock += other.taskClock;
+        timeEnabled += other.timeEnabled;
+        timeRunning += other.timeRunning;
+        return *this;
+    }
+
+    PerfSample operator+(const PerfSample& other) const noexcept {
+        auto result = *this;
+        return result += other;
+    }
+
+    PerfSample operator-(const PerfSample& other) const noexcept {
+        PerfSample result;
+        result.instructions = instructions - other.instructions;
+        result.cycles = cycles - other.cycles;
+        result.cacheMisses = cacheMisses - other.cacheMisses;
+        result.taskClock = taskClock - other.taskClock;
+        result.timeEnabled = timeEnabled - other.timeEnabled;
+        result.timeRunning = timeRunning - other.timeRunning;
+        return result;
+    }
+
+    /**
+     Whether the counters were multiplexed with other events for part of the
+     time, so that the counts are or need to be scaled up
+     */
+    bool scaled() const noexcept { return timeRunning < timeEnabled; }
+
+    /**
+     Whether the counters didn't count at all while enabled, which makes the
+     counts meaningless
+     */
+    bool unreliable() const noexcept { return timeEnabled > 0 && timeRunning == 0; }
+
+    /**
+     The counts scaled up by how much of the time they were counting. Only
+     meaningful for the difference between two reads: the ratio of two
+     cumulative readings can fall in between, so scaling them separately
+     could make the later one smaller.
+     */
+    PerfSample estimate() const noexcept {
+        if(!scaled()) return *this;
+        const auto scale = [this](std::uint64_t value) {
+            if(timeRunning == 0) return std::uint64_t{0};
+            return static_cast<std::uint64_t>(static_cast<double>(value) * static_cast<double>(timeEnabled) /
+                                              static_cast<double>(timeRunning));
+        };
+        auto result = *this;
+        result.instructions = scale(instructions);
+        result.cycles = scale(cycles);
+        result.cacheMisses = scale(cacheMisses);
+        result.taskClock = scale(taskClock);
+        return result;
+    }
+
+    std::string toString() const {
+        return std::to_string(instructions) + " instructions, " +
+            std::to_string(cycles) + " cycles, " +
+            std::to_string(cacheMisses) + " cache misses, " +
+            std::to_string(taskClock) + "ns CPU time";
+    }
+};
+
+
+/**
+ The performance counters of the thread that creates it, read all at once
+ as a perf event group
+ */
+class PerfCounters {
+public:
+
+    PerfCounters() {
+        // the hardware counters hang off cycles if there are any, otherwise
+        // it's the task clock on its own
+        _leader = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        if(_leader != -1) {
+            _hardware = true;
+            _fds.push_back(_leader);
+            addToGroup(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            addToGroup(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            addToGroup(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+        } else {
+            _leader = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+            if(_leader != -1) _fds.push_back(_leader);
+        }
+
+        if(_leader != -1) {
+            ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    ~PerfCounters() {
+        for(auto fd: _fds) ::close(fd);
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /**
+     Whether instructions, cycles and cache misses are being counted
+     */
+    bool hardware() const noexcept { return _hardware; }
+
+    /**
+     Whether perf_event_open works at all. If it doesn't the task clock
+     is the thread's CPU time clock.
+     */
+    bool perfEvents() const noexcept { return _leader != -1; }
+
+    PerfSample read() const noexcept {
+        PerfSample sample;
+        if(_leader == -1) {
+            timespec time;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+            sample.taskClock = static_cast<std::uint64_t>(time.tv_sec) * 1000000000ULL +
+                static_cast<std::uint64_t>(time.tv_nsec);
+            return sample;
+        }
+
+        std::uint64_t values[3 + maxCounters] = {};
+        if(::read(_leader, values, sizeof(values)) <= 0) return sample;
+        return decode(values, _hardware);
+    }
+
+    /**
+     Turns what reading a group returns into a sample: the number of
+     counters, the time the group was enabled and running, then the values in
+     the order they were added to the group. The counts are as read, the
+     difference between two samples is what PerfSample::estimate scales.
+     */
+    static PerfSample decode(const std::uint64_t* values, bool hardware) noexcept {
+        PerfSample sample;
+        sample.timeEnabled = values[1];
+        sample.timeRunning = values[2];
+        if(hardware) {
+            sample.cycles = values[3];
+            sample.instructions = values[4];
+            sample.cacheMisses = values[5];
+            sample.taskClock = values[6];
+        } else {
+            sample.taskClock = values[3];
+        }
+        return sample;
+    }
+
+private:
+
+    static constexpr int maxCounters = 4;
+
+    int _leader = -1;
+    bool _hardware = false;
+    std::vector<int> _fds;
+
+    static int open(std::uint32_t type, std::uint64_t config, int groupFd) noexcept {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = groupFd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0 /*this thread*/, -1 /*any cpu*/, groupFd, 0));
+    }
+
+    // a counter that can't be opened would shift the values read, so if
+    // any of them fails there are no hardware counters at all
+    void addToGroup(std::uint32_t type, std::uint64_t config) {
+        if(!_hardware) return;
+        const auto fd = open(type, config, _leader);
+        if(fd == -1) {
+            for(auto opened: _fds) ::close(opened);
+            _fds.clear();
+            _hardware = false;
+            _leader = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+            if(_leader != -1) _fds.push_back(_leader);
+            return;
+        }
+        _fds.push_back(fd);
+    }
+};
+
+
+/**
+ Splits the counts of the calling thread between production code and the
+ mocked dependencies it calls, until the end of scope
+ */
+class CpuProfile {
+public:
+
+    CpuProfile():_last{_counters.read()} {}
+
+    CpuProfile(const CpuProfile&) = delete;
+    CpuProfile& operator=(const CpuProfile&) = delete;
+
+    /**
+     Count calls to func as time spent in a dependency
+     */
+    template<typename T>
+    CpuProfile& watch(T& func) {
+        _watches.watch(func, [this](const auto& displaced, auto&&... args) {
+            InDependency inDependency{*this};
+            return displaced(std::forward<decltype(args)>(args)...);
+        });
+        return *this;
+    }
+
+    /**
+     What the production code has cost so far
+     */
+    PerfSample production() const noexcept {
+        auto result = _production;
+        if(_depth == 0) result += (_counters.read() - _last).estimate();
+        return result;
+    }
+
+    /**
+     What the calls to the watched mocks have cost so far
+     */
+    PerfSample dependencies() const noexcept {
+        auto result = _dependencies;
+        if(_depth > 0) result += (_counters.read() - _last).estimate();
+        return result;
+    }
+
+    bool hardwareCounters() const noexcept { return _counters.hardware(); }
+
+    std::string report() const {
+        const auto total = production() + dependencies();
+        return std::string{"production:   "} + production().toString() + "\n" +
+            "dependencies: " + dependencies().toString() + "\n" +
+            (hardwareCounters() ? "" : "(no hardware counters available)\n") +
+            (total.unreliable() ? "(the counters never got to count, the counts are meaningless)\n" :
+             total.scaled() ? "(counters multiplexed, counts scaled from " + runningPercent(total) + "% of the time)\n" :
+             "");
+    }
+
+private:
+
+    // a watched mock calling another one is still the same dependency
+    class InDependency {
+    public:
+
+        explicit InDependency(CpuProfile& profile) noexcept:_profile(profile) {
+            if(_profile._depth++ == 0) _profile.endSegment(_profile._production);
+        }
+
+        ~InDependency() {
+            if(--_profile._depth == 0) _profile.endSegment(_profile._dependencies);
+        }
+
+    private:
+
+        CpuProfile& _profile;
+    };
+
+    PerfCounters _counters;
+    PerfSample _last;
+    PerfSample _production;
+    PerfSample _dependencies;
+    int _depth = 0;
+    WatchedMocks _watches;
+
+    static std::string runningPercent(const PerfSample& sample) {
+        return std::to_string(sample.timeRunning * 100 / sample.timeEnabled);
+    }
+
+    // adds what was counted since control last crossed into or out of
+    // a dependency to the side it's leaving
+    void endSegment(PerfSample& ended) noexcept {
+        const auto now = _counters.read();
+        ended += (now - _last).estimate();
+        _last = now;
+    }
+};
+
+
+#endif // PREMOCK_PERF_HPP_
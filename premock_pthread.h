@@ -0,0 +1,23 @@
+#ifndef PREMOCK_PTHREAD_H_
+#define PREMOCK_PTHREAD_H_
+
+#define pthread_create ut_premock_pthread_create
+#define pthread_join ut_premock_pthread_join
+#define pthread_detach ut_premock_pthread_detach
+#define pthread_self ut_premock_pthread_self
+#define pthread_mutex_lock ut_premock_pthread_mutex_lock
+#define pthread_mutex_trylock ut_premock_pthread_mutex_trylock
+#define pthread_mutex_timedlock ut_premock_pthread_mutex_timedlock
+#define pthread_mutex_unlock ut_premock_pthread_mutex_unlock
+#define pthread_cond_wait ut_premock_pthread_cond_wait
+#define pthread_cond_timedwait ut_premock_pthread_cond_timedwait
+#define pthread_cond_signal ut_premock_pthread_cond_signal
+#define pthread_cond_broadcast ut_premock_pthread_cond_broadcast
+#define sched_yield ut_premock_sched_yield
+#define pthread_rwlock_rdlock ut_premock_pthread_rwlock_rdlock
+#define pthread_rwlock_tryrdlock ut_premock_pthread_rwlock_tryrdlock
+#define pthread_rwlock_wrlock ut_premock_pthread_rwlock_wrlock
+#define pthread_rwlock_trywrlock ut_premock_pthread_rwlock_trywrlock
+#define pthread_rwlock_unlock ut_premock_pthread_rwlock_unlock
+
+#endif // PREMOCK_PTHREAD_H_
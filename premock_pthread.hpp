@@ -0,0 +1,547 @@
+/**
+A deterministic scheduler for multi-threaded C code.
+
+The mocks for `pthread_create`, `pthread_join`, `pthread_detach`,
+`pthread_self`, the mutex, rwlock and condition variable functions and
+`sched_yield` declared here are backed by a
+`CooperativeScheduler`: threads become user-level contexts (`ucontext`) that
+all run on the test's thread, one at a time. Every call to one of the mocks is
+a point where the scheduler may switch to another thread, chosen by a random
+number generator with a fixed seed. The same seed always gives the same
+interleaving, and different seeds explore different ones, thousands of them per
+second:
+
+```c++
+TEST(counter, no_lost_updates) {
+    CooperativeScheduler::explore(1000, [] {
+        reset_counter();
+        run_incrementer_threads(4); // pthread_create, pthread_join
+        REQUIRE(counter() == 4);
+    });
+}
+```
+
+`explore` reports the seed of the first schedule that failed, and running a
+`CooperativeScheduler` constructed with that seed replays it exactly. When all
+remaining threads are blocked the run fails as a deadlock.
+
+The production code needs the redefinitions in `premock_pthread.h` and the
+test binary has to implement the mocks as usual:
+
+```c++
+#include "premock_pthread.hpp"
+extern "C" {
+    IMPL_MOCK_DEFAULT(4, pthread_create);
+    IMPL_MOCK_DEFAULT(2, pthread_join);
+    IMPL_MOCK_DEFAULT(1, pthread_detach);
+    IMPL_MOCK_DEFAULT(0, pthread_self);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_lock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_trylock);
+    IMPL_MOCK_DEFAULT(2, pthread_mutex_timedlock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_unlock);
+    IMPL_MOCK_DEFAULT(2, pthread_cond_wait);
+    IMPL_MOCK_DEFAULT(3, pthread_cond_timedwait);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_signal);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_broadcast);
+    IMPL_MOCK_DEFAULT(0, sched_yield);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_rdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_tryrdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_wrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_trywrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_unlock);
+}
+```
+
+Mutexes behave like error checking ones, and mutexes and rwlocks are
+identified by address so statically initialised ones work. Timed waits
+ignore their deadline and only time out once no thread could run otherwise,
+as if the time passed then. Thread
+attributes are ignored, thread local variables are shared by all the threads
+of a run since they all run on one OS thread, and the threads still running
+when a run fails are abandoned without unwinding their stacks. Linux only.
+ */
+
+#ifndef PREMOCK_PTHREAD_HPP_
+#define PREMOCK_PTHREAD_HPP_
+
+#include "premock.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
+
+DECL_MOCK(pthread_create);
+DECL_MOCK(pthread_join);
+DECL_MOCK(pthread_detach);
+DECL_MOCK(pthread_self);
+DECL_MOCK(pthread_mutex_lock);
+DECL_MOCK(pthread_mutex_trylock);
+DECL_MOCK(pthread_mutex_timedlock);
+DECL_MOCK(pthread_mutex_unlock);
+DECL_MOCK(pthread_cond_wait);
+DECL_MOCK(pthread_cond_timedwait);
+DECL_MOCK(pthread_cond_signal);
+DECL_MOCK(pthread_cond_broadcast);
+DECL_MOCK(sched_yield);
+DECL_MOCK(pthread_rwlock_rdlock);
+DECL_MOCK(pthread_rwlock_tryrdlock);
+DECL_MOCK(pthread_rwlock_wrlock);
+DECL_MOCK(pthread_rwlock_trywrlock);
+DECL_MOCK(pthread_rwlock_unlock);
+
+
+/**
+ RAII class that replaces the pthread mocks with a single threaded, seeded
+ scheduler. Outside of run the calls go to the previous implementations.
+ */
+class CooperativeScheduler {
+public:
+
+    explicit CooperativeScheduler(std::uint64_t seed = 0, size_t stackSize = 256 * 1024):
+        _seed{seed},
+        _stackSize{stackSize},
+        _create{mock_pthread_create,
+            [this](pthread_t* thread, const pthread_attr_t* attr, void* (*start)(void*), void* arg) {
+                if(!running()) return _create.displaced()(thread, attr, start, arg);
+                *thread = spawn([start, arg] { return start(arg); });
+                yield();
+                return 0;
+            }},
+        _join{mock_pthread_join, [this](pthread_t thread, void** result) {
+                if(!running()) return _join.displaced()(thread, result);
+                return join(thread, result);
+            }},
+        _detach{mock_pthread_detach, [this](pthread_t thread) {
+                if(!running()) return _detach.displaced()(thread);
+                return detach(thread);
+            }},
+        _self{mock_pthread_self, [this] {
+                if(!running()) return _self.displaced()();
+                return self();
+            }},
+        _lock{mock_pthread_mutex_lock, [this](pthread_mutex_t* mutex) {
+                if(!running()) return _lock.displaced()(mutex);
+                yield();
+                return lock(mutex);
+            }},
+        _trylock{mock_pthread_mutex_trylock, [this](pthread_mutex_t* mutex) {
+                if(!running()) return _trylock.displaced()(mutex);
+                yield();
+                if(_mutexOwners[mutex] != 0) return EBUSY;
+                _mutexOwners[mutex] = self();
+                return 0;
+            }},
+        _timedlock{mock_pthread_mutex_timedlock, [this](pthread_mutex_t* mutex, const timespec* deadline) {
+                if(!running()) return _timedlock.displaced()(mutex, deadline);
+                yield();
+                return lock(mutex, true);
+            }},
+        _unlock{mock_pthread_mutex_unlock, [this](pthread_mutex_t* mutex) {
+                if(!running()) return _unlock.displaced()(mutex);
+                const auto result = unlock(mutex);
+                yield();
+                return result;
+            }},
+        _wait{mock_pthread_cond_wait, [this](pthread_cond_t* cond, pthread_mutex_t* mutex) {
+                if(!running()) return _wait.displaced()(cond, mutex);
+                const auto result = unlock(mutex);
+                if(result != 0) return result;
+                block(cond);
+                return lock(mutex);
+            }},
+        _timedwait{mock_pthread_cond_timedwait,
+            [this](pthread_cond_t* cond, pthread_mutex_t* mutex, const timespec* deadline) {
+                if(!running()) return _timedwait.displaced()(cond, mutex, deadline);
+                const auto result = unlock(mutex);
+                if(result != 0) return result;
+                const auto woken = blockTimed(cond);
+                const auto relocked = lock(mutex);
+                return relocked != 0 ? relocked : woken ? 0 : ETIMEDOUT;
+            }},
+        _signal{mock_pthread_cond_signal, [this](pthread_cond_t* cond) {
+                if(!running()) return _signal.displaced()(cond);
+                wakeOne(cond);
+                yield();
+                return 0;
+            }},
+        _broadcast{mock_pthread_cond_broadcast, [this](pthread_cond_t* cond) {
+                if(!running()) return _broadcast.displaced()(cond);
+                wake(cond);
+                yield();
+                return 0;
+            }},
+        _yield{mock_sched_yield, [this] {
+                if(!running()) return _yield.displaced()();
+                yield();
+                return 0;
+            }},
+        _rdlock{mock_pthread_rwlock_rdlock, [this](pthread_rwlock_t* rwlock) {
+                if(!running()) return _rdlock.displaced()(rwlock);
+                yield();
+                return readLock(rwlock, false);
+            }},
+        _tryrdlock{mock_pthread_rwlock_tryrdlock, [this](pthread_rwlock_t* rwlock) {
+                if(!running()) return _tryrdlock.displaced()(rwlock);
+                yield();
+                return readLock(rwlock, true);
+            }},
+        _wrlock{mock_pthread_rwlock_wrlock, [this](pthread_rwlock_t* rwlock) {
+                if(!running()) return _wrlock.displaced()(rwlock);
+                yield();
+                return writeLock(rwlock, false);
+            }},
+        _trywrlock{mock_pthread_rwlock_trywrlock, [this](pthread_rwlock_t* rwlock) {
+                if(!running()) return _trywrlock.displaced()(rwlock);
+                yield();
+                return writeLock(rwlock, true);
+            }},
+        _rwunlock{mock_pthread_rwlock_unlock, [this](pthread_rwlock_t* rwlock) {
+                if(!running()) return _rwunlock.displaced()(rwlock);
+                const auto result = unlock(rwlock);
+                yield();
+                return result;
+            }} {
+    }
+
+    CooperativeScheduler(const CooperativeScheduler&) = delete;
+    CooperativeScheduler& operator=(const CooperativeScheduler&) = delete;
+
+    /**
+     Runs main as the first thread, and all the threads it creates, until they
+     have all finished. Rethrows the first exception a thread let escape and
+     throws MockException if the threads deadlock. Running again with the
+     same seed gives the same schedule.
+     */
+    void run(std::function<void()> main) {
+        if(running()) throw std::logic_error("CooperativeScheduler::run can't be nested");
+
+        _random.seed(_seed);
+        _schedule.clear();
+        _replayed = 0;
+        _switches = 0;
+        _fibers.clear();
+        _mutexOwners.clear();
+        _rwlocks.clear();
+        _error = nullptr;
+        spawn([&main] {
+            main();
+            return static_cast<void*>(nullptr);
+        });
+
+        current() = this;
+        loop();
+        current() = nullptr;
+
+        // what threads that didn't finish had on their stacks is abandoned
+        _fibers.clear();
+        _replay.clear();
+        if(_error) std::rethrow_exception(_error);
+    }
+
+    /**
+     Makes the next run take the scheduling decisions in schedule, as returned
+     by schedule() after a previous run, before resorting to the seed. Runs
+     after that only use the seed again.
+     */
+    void replay(std::vector<std::uint32_t> schedule) {
+        _replay = std::move(schedule);
+    }
+
+    /**
+     The scheduling decisions taken by the last run: which of the runnable
+     threads was picked, whenever there was more than one
+     */
+    const std::vector<std::uint32_t>& schedule() const noexcept { return _schedule; }
+
+    std::uint64_t seed() const noexcept { return _seed; }
+
+    /**
+     How many times the last run switched to a thread
+     */
+    std::uint64_t switches() const noexcept { return _switches; }
+
+    /**
+     Runs main with runs different seeds, starting at firstSeed. Throws
+     MockException naming the seed of the first run that fails.
+     */
+    static void explore(size_t runs, const std::function<void()>& main, std::uint64_t firstSeed = 0) {
+        for(size_t i = 0; i < runs; ++i) {
+            CooperativeScheduler scheduler{firstSeed + i};
+            try {
+                scheduler.run(main);
+            } catch(const std::exception& ex) {
+                throw MockException(failure(scheduler) + ":\n" + ex.what());
+            } catch(...) {
+                throw MockException(failure(scheduler));
+            }
+        }
+    }
+
+private:
+
+    struct Fiber {
+        ucontext_t context;
+        std::unique_ptr<char[]> stack;
+        std::function<void*()> body;
+        void* result = nullptr;
+        const void* blockedOn = nullptr;
+        bool timed = false;    // gives up if nothing else can happen
+        bool timedOut = false;
+        bool detached = false;
+        bool finished = false;
+    };
+
+    struct Rwlock {
+        pthread_t writer = 0;
+        size_t readers = 0;
+    };
+
+    const std::uint64_t _seed;
+    const size_t _stackSize;
+    std::mt19937_64 _random;
+    std::vector<std::uint32_t> _schedule;
+    std::vector<std::uint32_t> _replay;
+    size_t _replayed = 0;
+    std::uint64_t _switches = 0;
+    ucontext_t _schedulerContext;
+    std::vector<std::unique_ptr<Fiber>> _fibers; // pthread_t is the index + 1
+    size_t _current = 0;
+    std::vector<size_t> _candidates;
+    std::map<const void*, pthread_t> _mutexOwners; // 0 if unlocked
+    std::map<const void*, Rwlock> _rwlocks;
+    std::exception_ptr _error;
+
+    MockScope<decltype(mock_pthread_create)> _create;
+    MockScope<decltype(mock_pthread_join)> _join;
+    MockScope<decltype(mock_pthread_detach)> _detach;
+    MockScope<decltype(mock_pthread_self)> _self;
+    MockScope<decltype(mock_pthread_mutex_lock)> _lock;
+    MockScope<decltype(mock_pthread_mutex_trylock)> _trylock;
+    MockScope<decltype(mock_pthread_mutex_timedlock)> _timedlock;
+    MockScope<decltype(mock_pthread_mutex_unlock)> _unlock;
+    MockScope<decltype(mock_pthread_cond_wait)> _wait;
+    MockScope<decltype(mock_pthread_cond_timedwait)> _timedwait;
+    MockScope<decltype(mock_pthread_cond_signal)> _signal;
+    MockScope<decltype(mock_pthread_cond_broadcast)> _broadcast;
+    MockScope<decltype(mock_sched_yield)> _yield;
+    MockScope<decltype(mock_pthread_rwlock_rdlock)> _rdlock;
+    MockScope<decltype(mock_pthread_rwlock_tryrdlock)> _tryrdlock;
+    MockScope<decltype(mock_pthread_rwlock_wrlock)> _wrlock;
+    MockScope<decltype(mock_pthread_rwlock_trywrlock)> _trywrlock;
+    MockScope<decltype(mock_pthread_rwlock_unlock)> _rwunlock;
+
+    // makecontext can only pass ints to the entry point, so it finds the
+    // scheduler here instead
+    static CooperativeScheduler*& current() noexcept {
+        static thread_local CooperativeScheduler* scheduler = nullptr;
+        return scheduler;
+    }
+
+    bool running() const noexcept { return current() == this; }
+
+    pthread_t self() const noexcept { return static_cast<pthread_t>(_current + 1); }
+
+    Fiber& fiber() noexcept { return *_fibers[_current]; }
+
+    pthread_t spawn(std::function<void*()> body) {
+        std::unique_ptr<Fiber> fiber{new Fiber};
+        fiber->stack.reset(new char[_stackSize]);
+        fiber->body = std::move(body);
+        getcontext(&fiber->context);
+        fiber->context.uc_stack.ss_sp = fiber->stack.get();
+        fiber->context.uc_stack.ss_size = _stackSize;
+        fiber->context.uc_link = &_schedulerContext;
+        makecontext(&fiber->context, &CooperativeScheduler::entry, 0);
+        _fibers.push_back(std::move(fiber));
+        return static_cast<pthread_t>(_fibers.size());
+    }
+
+    // returning goes back to the scheduler through uc_link
+    static void entry() {
+        auto& scheduler = *current();
+        auto& fiber = scheduler.fiber();
+        try {
+            fiber.result = fiber.body();
+        } catch(...) {
+            if(!scheduler._error) scheduler._error = std::current_exception();
+        }
+        fiber.finished = true;
+        scheduler.wake(&fiber);
+    }
+
+    void loop() {
+        while(!_error) {
+            _candidates.clear();
+            for(size_t i = 0; i < _fibers.size(); ++i)
+                if(!_fibers[i]->finished && !_fibers[i]->blockedOn) _candidates.push_back(i);
+
+            if(_candidates.empty()) {
+                if(timeOut()) continue;
+                if(!allFinished()) _error = std::make_exception_ptr(MockException(deadlock()));
+                return;
+            }
+
+            _current = _candidates[choose(_candidates.size())];
+            ++_switches;
+            swapcontext(&_schedulerContext, &fiber().context);
+        }
+    }
+
+    size_t choose(size_t count) {
+        if(count == 1) return 0;
+        const auto choice = _replayed < _replay.size() ?
+            _replay[_replayed++] % count :
+            static_cast<size_t>(_random() % count);
+        _schedule.push_back(static_cast<std::uint32_t>(choice));
+        return choice;
+    }
+
+    // a scheduling point: any runnable thread, including this one, runs next
+    void yield() {
+        swapcontext(&fiber().context, &_schedulerContext);
+    }
+
+    void block(const void* on) {
+        fiber().blockedOn = on;
+        yield();
+    }
+
+    // like block, but gives up once no thread could run otherwise. Returns
+    // whether it was woken up before that.
+    bool blockTimed(const void* on) {
+        fiber().timed = true;
+        block(on);
+        fiber().timed = false;
+        const auto timedOut = fiber().timedOut;
+        fiber().timedOut = false;
+        return !timedOut;
+    }
+
+    // wakes the threads in timed waits, if any, when nothing else can run
+    bool timeOut() noexcept {
+        bool any = false;
+        for(auto& fiber: _fibers) {
+            if(fiber->finished || !fiber->blockedOn || !fiber->timed) continue;
+            fiber->blockedOn = nullptr;
+            fiber->timedOut = true;
+            any = true;
+        }
+        return any;
+    }
+
+    void wake(const void* on) noexcept {
+        for(auto& fiber: _fibers)
+            if(fiber->blockedOn == on) fiber->blockedOn = nullptr;
+    }
+
+    void wakeOne(const void* on) {
+        _candidates.clear();
+        for(size_t i = 0; i < _fibers.size(); ++i)
+            if(_fibers[i]->blockedOn == on) _candidates.push_back(i);
+        if(!_candidates.empty()) _fibers[_candidates[choose(_candidates.size())]]->blockedOn = nullptr;
+    }
+
+    int lock(pthread_mutex_t* mutex, bool timed = false) {
+        if(_mutexOwners[mutex] == self()) return EDEADLK;
+        while(_mutexOwners[mutex] != 0) {
+            if(!timed) block(mutex);
+            else if(!blockTimed(mutex)) return ETIMEDOUT;
+        }
+        _mutexOwners[mutex] = self();
+        return 0;
+    }
+
+    int unlock(pthread_mutex_t* mutex) {
+        if(_mutexOwners[mutex] != self()) return EPERM;
+        _mutexOwners[mutex] = 0;
+        wake(mutex);
+        return 0;
+    }
+
+    int join(pthread_t thread, void** result) {
+        const auto index = static_cast<size_t>(thread) - 1;
+        if(index >= _fibers.size()) return ESRCH;
+        if(index == _current) return EDEADLK;
+        auto& joined = *_fibers[index];
+        if(joined.detached) return EINVAL;
+        while(!joined.finished) block(&joined);
+        if(result) *result = joined.result;
+        return 0;
+    }
+
+    int detach(pthread_t thread) {
+        const auto index = static_cast<size_t>(thread) - 1;
+        if(index >= _fibers.size()) return ESRCH;
+        if(_fibers[index]->detached) return EINVAL;
+        _fibers[index]->detached = true;
+        return 0;
+    }
+
+    // std::map doesn't move its values, so the references stay valid while
+    // other threads take other locks
+    int readLock(pthread_rwlock_t* rwlock, bool tryOnly) {
+        auto& state = _rwlocks[rwlock];
+        if(state.writer == self()) return EDEADLK;
+        while(state.writer != 0) {
+            if(tryOnly) return EBUSY;
+            block(rwlock);
+        }
+        ++state.readers;
+        return 0;
+    }
+
+    int writeLock(pthread_rwlock_t* rwlock, bool tryOnly) {
+        auto& state = _rwlocks[rwlock];
+        if(state.writer == self()) return EDEADLK;
+        while(state.writer != 0 || state.readers > 0) {
+            if(tryOnly) return EBUSY;
+            block(rwlock);
+        }
+        state.writer = self();
+        return 0;
+    }
+
+    // which readers hold the lock isn't tracked, so any thread can release
+    // a read lock
+    int unlock(pthread_rwlock_t* rwlock) {
+        auto& state = _rwlocks[rwlock];
+        if(state.writer == self()) state.writer = 0;
+        else if(state.writer == 0 && state.readers > 0) --state.readers;
+        else return EPERM;
+        wake(rwlock);
+        return 0;
+    }
+
+    static std::string failure(const CooperativeScheduler& scheduler) {
+        return "Schedule with seed " + std::to_string(scheduler.seed()) + " failed after " +
+            std::to_string(scheduler.switches()) + " switches";
+    }
+
+    bool allFinished() const noexcept {
+        for(const auto& fiber: _fibers) if(!fiber->finished) return false;
+        return true;
+    }
+
+    std::string deadlock() const {
+        std::string message{"Deadlock:\n"};
+        char line[96];
+        for(size_t i = 0; i < _fibers.size(); ++i) {
+            if(_fibers[i]->finished) continue;
+            snprintf(line, sizeof(line), "  thread %zu blocked on %p\n", i + 1, _fibers[i]->blockedOn);
+            message += line;
+        }
+        return message;
+    }
+};
+
+
+#endif // PREMOCK_PTHREAD_HPP_
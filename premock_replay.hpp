@@ -0,0 +1,729 @@
+/**
+Records the calls made to real dependencies and replays them later.
+
+`RECORD_CALLS` works like `SPY`, but writes each call's arguments, return
+value, `errno` and the bytes written to output parameters into a binary
+trace file. The file is memory mapped and only ever appended to, so recording
+costs little more than a `memcpy` per call. `REPLAY_CALLS` then stands in for
+the dependency in later runs and answers each call from the trace, at memory
+speed and without the dependency being there at all:
+
+```c++
+TEST(client, record) {
+    CallRecording recording{"client.trace"};
+    auto send = RECORD_CALLS(send, recording);
+    auto recv = RECORD_CALLS(recv, recording);
+    recv.outputBufferFromReturn<1>(); // recv writes as many bytes as it returns
+    run_client_against_real_server();
+}
+
+TEST(client, replay) {
+    CallPlayback playback{"client.trace"};
+    auto send = REPLAY_CALLS(send, playback);
+    auto recv = REPLAY_CALLS(recv, playback);
+    recv.outputBuffer<1, 2>(); // the buffer has room for len bytes
+    run_client_against_real_server(); // there's no server any more
+}
+```
+
+Each function gets a record layout derived from its signature: arithmetic and
+other trivially copyable parameters are stored by value, C strings by content
+and writable pointers by the bytes the function wrote to them. Pointers to
+single objects (e.g. `struct stat*`) are recorded automatically; for buffers
+(`void*`, `char*`) the number of bytes has to be given with `outputBuffer` or
+`outputBufferFromReturn`. Other pointers aren't recorded. Replay checks that
+the arguments that were recorded match, unless told to just serve the
+recorded results in order. Arguments are compared with `==` if their type
+has one and byte by byte otherwise, so structs without one that are passed
+by value must be zero-initialised (e.g. with `memset`) when recording and
+replaying, or the padding between their fields won't match. Replay only
+writes as many bytes to a buffer as `outputBuffer` says it has room for,
+and reports a recorded call that wrote more as a mismatch.
+
+The trace starts with a fixed header followed by entries, each with its size,
+kind and function id: one declaring each function's name and layout, then
+the calls. Files are only portable between machines with the same ABI.
+Recordings and playbacks aren't synchronised, so recorded and replayed
+mocks must only be called from one thread and not be inherited with
+`InheritMocks`.
+ */
+
+#ifndef PREMOCK_REPLAY_HPP_
+#define PREMOCK_REPLAY_HPP_
+
+#include "premock.hpp"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ How each type of parameter or return value is stored in a trace
+ */
+template<typename A, typename = void>
+struct ReplayCodec;
+
+// by value
+template<typename A>
+struct ReplayCodec<A, std::enable_if_t<!std::is_pointer<A>::value && std::is_trivially_copyable<A>::value>> {
+    static std::string layout() { return "v" + std::to_string(sizeof(A)); }
+    static constexpr bool writable = false;
+};
+
+// by content
+template<>
+struct ReplayCodec<const char*> {
+    static std::string layout() { return "s"; }
+    static constexpr bool writable = false;
+    // stored instead of the length for null pointers
+    static constexpr std::uint32_t nullLength() { return 0xffffffff; }
+};
+
+// by the bytes written to it
+template<typename A>
+struct ReplayCodec<A*, std::enable_if_t<!std::is_const<A>::value>> {
+    static std::string layout() { return "o"; }
+    static constexpr bool writable = true;
+    static constexpr size_t defaultLength = std::is_void<A>::value ||
+        sizeof(std::conditional_t<std::is_void<A>::value, char, A>) == 1 ? 0 :
+        sizeof(std::conditional_t<std::is_void<A>::value, char, A>);
+};
+
+// not at all
+template<typename A>
+struct ReplayCodec<const A*, std::enable_if_t<!std::is_same<A, char>::value>> {
+    static std::string layout() { return "p"; }
+    static constexpr bool writable = false;
+};
+
+
+/**
+ Whether values of type A can be compared with ==
+ */
+template<typename A, typename = std::void_t<>>
+struct HasEquality: std::false_type {};
+
+template<typename A>
+struct HasEquality<A, std::void_t<decltype(std::declval<const A&>() == std::declval<const A&>())>>: std::true_type {};
+
+
+/**
+ The fixed header at the start of every trace file
+ */
+struct ReplayFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+
+    static ReplayFileHeader current() noexcept {
+        return ReplayFileHeader{{'P', 'R', 'E', 'M', 'O', 'C', 'K', '\0'}, 1, sizeof(ReplayFileHeader)};
+    }
+
+    bool matches(const ReplayFileHeader& other) const noexcept {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+};
+
+/**
+ The header of each entry in a trace file, followed by size - sizeof(ReplayEntryHeader)
+ bytes of payload
+ */
+struct ReplayEntryHeader {
+    enum Kind: std::uint16_t { declaration = 1, call = 2 };
+
+    std::uint32_t size;
+    std::uint16_t kind;
+    std::uint16_t function;
+};
+
+
+/**
+ An append-only trace file being recorded. Functions recorded to it get
+ their own ids so that several can share a file.
+ */
+class CallRecording {
+public:
+
+    explicit CallRecording(std::string fileName):_fileName(std::move(fileName)) {
+        _fd = ::open(_fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(_fd == -1) throw std::runtime_error("Could not create trace file " + _fileName);
+        try {
+            grow(initialCapacity);
+        } catch(...) {
+            ::close(_fd);
+            throw;
+        }
+        const auto header = ReplayFileHeader::current();
+        append(&header, sizeof(header));
+    }
+
+    /**
+     Truncates the file to what was recorded
+     */
+    ~CallRecording() {
+        if(_data) munmap(_data, _capacity);
+        if(ftruncate(_fd, static_cast<off_t>(_size)) != 0) {}
+        ::close(_fd);
+    }
+
+    CallRecording(const CallRecording&) = delete;
+    CallRecording& operator=(const CallRecording&) = delete;
+
+    /**
+     Bytes recorded so far, including the header
+     */
+    size_t size() const noexcept { return _size; }
+
+    std::uint16_t declare(const std::string& name, const std::string& layout) {
+        const auto function = _functions++;
+        const auto entry = beginEntry(ReplayEntryHeader::declaration, function);
+        append(name.c_str(), name.size() + 1);
+        append(layout.c_str(), layout.size() + 1);
+        endEntry(entry);
+        return function;
+    }
+
+    size_t beginEntry(std::uint16_t kind, std::uint16_t function) {
+        const auto offset = _size;
+        const ReplayEntryHeader header{0, kind, function};
+        append(&header, sizeof(header));
+        return offset;
+    }
+
+    void endEntry(size_t offset) noexcept {
+        const auto size = static_cast<std::uint32_t>(_size - offset);
+        memcpy(_data + offset, &size, sizeof(size));
+    }
+
+    void append(const void* data, size_t size) {
+        if(_size + size > _capacity) grow(std::max(_capacity * 2, _size + size));
+        if(size) memcpy(_data + _size, data, size);
+        _size += size;
+    }
+
+    template<typename V>
+    void appendValue(const V& value) {
+        append(&value, sizeof(value));
+    }
+
+private:
+
+    static constexpr size_t initialCapacity = 1 << 20;
+
+    std::string _fileName;
+    int _fd = -1;
+    char* _data = nullptr;
+    size_t _capacity = 0;
+    size_t _size = 0;
+    std::uint16_t _functions = 0;
+
+    void grow(size_t capacity) {
+        if(_data) munmap(_data, _capacity);
+        _data = nullptr;
+        if(ftruncate(_fd, static_cast<off_t>(capacity)) != 0)
+            throw std::runtime_error("Could not grow trace file " + _fileName);
+        auto data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if(data == MAP_FAILED) throw std::runtime_error("Could not map trace file " + _fileName);
+        _data = static_cast<char*>(data);
+        _capacity = capacity;
+    }
+};
+
+
+/**
+ A trace file being replayed, memory mapped and indexed once on construction
+ */
+class CallPlayback {
+public:
+
+    struct Function {
+        std::string layout;
+        std::vector<const char*> calls; // payloads
+    };
+
+    explicit CallPlayback(const std::string& fileName):_fileName(fileName) {
+        const auto fd = ::open(fileName.c_str(), O_RDONLY);
+        if(fd == -1) throw std::runtime_error("Could not open trace file " + fileName);
+        struct stat status;
+        fstat(fd, &status);
+        _size = static_cast<size_t>(status.st_size);
+        auto data = _size ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if(data == MAP_FAILED) throw std::runtime_error("Could not map trace file " + fileName);
+        _data = static_cast<const char*>(data);
+
+        try {
+            index();
+        } catch(...) {
+            munmap(const_cast<char*>(_data), _size);
+            throw;
+        }
+    }
+
+    ~CallPlayback() {
+        munmap(const_cast<char*>(_data), _size);
+    }
+
+    CallPlayback(const CallPlayback&) = delete;
+    CallPlayback& operator=(const CallPlayback&) = delete;
+
+    const std::string& fileName() const noexcept { return _fileName; }
+
+    /**
+     The recorded calls to name, which must have been recorded with layout
+     */
+    const Function& function(const std::string& name, const std::string& layout) const {
+        const auto function = _functions.find(name);
+        if(function == _functions.end())
+            throw std::runtime_error("No calls to " + name + " recorded in " + _fileName);
+        if(function->second.layout != layout)
+            throw std::runtime_error("Calls to " + name + " in " + _fileName + " were recorded with layout " +
+                                     function->second.layout + ", not " + layout);
+        return function->second;
+    }
+
+private:
+
+    std::string _fileName;
+    const char* _data = nullptr;
+    size_t _size = 0;
+    std::map<std::string, Function> _functions;
+
+    void index() {
+        const auto expected = ReplayFileHeader::current();
+        ReplayFileHeader header;
+        if(_size < sizeof(header)) throw std::runtime_error("Not a trace file: " + _fileName);
+        memcpy(&header, _data, sizeof(header));
+        if(!header.matches(expected)) throw std::runtime_error("Not a trace file: " + _fileName);
+
+        std::map<std::uint16_t, Function*> ids;
+        size_t offset = sizeof(header);
+        // a recording that was never closed has zeros at the end
+        while(offset + sizeof(ReplayEntryHeader) <= _size) {
+            ReplayEntryHeader entry;
+            memcpy(&entry, _data + offset, sizeof(entry));
+            if(entry.size < sizeof(entry) || offset + entry.size > _size) break;
+
+            const auto payload = _data + offset + sizeof(entry);
+            if(entry.kind == ReplayEntryHeader::declaration) {
+                const std::string name{payload};
+                auto& function = _functions[name];
+                function.layout = payload + name.size() + 1;
+                ids[entry.function] = &function;
+            } else if(entry.kind == ReplayEntryHeader::call && ids.count(entry.function)) {
+                ids[entry.function]->calls.push_back(payload);
+            }
+            offset += entry.size;
+        }
+    }
+};
+
+
+/**
+ Reads the values in a recorded call one after another
+ */
+class ReplayCursor {
+public:
+
+    explicit ReplayCursor(const char* data) noexcept:_data{data} {}
+
+    template<typename V>
+    V read() noexcept {
+        V value;
+        memcpy(&value, _data, sizeof(value));
+        _data += sizeof(value);
+        return value;
+    }
+
+    const char* bytes(size_t size) noexcept {
+        const auto bytes = _data;
+        _data += size;
+        return bytes;
+    }
+
+private:
+
+    const char* _data;
+};
+
+
+/**
+ The layout of calls to a function of type T (a std::function) in a trace
+ */
+template<typename>
+struct ReplayLayout;
+
+template<typename R, typename... A>
+struct ReplayLayout<std::function<R(A...)>> {
+    static std::string get() {
+        std::string layout = returnLayout<R>() + ":";
+        const std::string params[] = {"", ReplayCodec<A>::layout()...};
+        for(size_t i = 1; i < sizeof...(A) + 1; ++i) layout += (i > 1 ? "," : "") + params[i];
+        return layout;
+    }
+
+private:
+
+    template<typename V>
+    static std::enable_if_t<std::is_void<V>::value, std::string> returnLayout() { return "v0"; }
+
+    template<typename V>
+    static std::enable_if_t<!std::is_void<V>::value, std::string> returnLayout() { return ReplayCodec<V>::layout(); }
+};
+
+
+/**
+ RAII class that forwards calls to the implementation it replaced and
+ records them in a CallRecording
+ */
+template<typename T>
+class RecordScope {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+    using ParamTupleType = typename StdFunctionTraits<T>::TupleType;
+    static constexpr size_t numParams = std::tuple_size<ParamTupleType>::value;
+
+    RecordScope(T& func, const std::string& name, CallRecording& recording):
+        _recording(recording),
+        _function{recording.declare(name, ReplayLayout<T>::get())},
+        _mockScope{func, [this](auto... args) -> ReturnType {
+                return this->recordCall(_mockScope.displaced(), args...);
+            }} {
+        initLengths(std::make_index_sequence<numParams>{});
+    }
+
+    /**
+     Record as many bytes of the buffer at position I as the parameter at
+     position LengthParam says
+     */
+    template<size_t I, size_t LengthParam>
+    RecordScope& outputBuffer() {
+        static_assert(ReplayCodec<std::tuple_element_t<I, ParamTupleType>>::writable,
+                      "outputBuffer needs a writable pointer parameter");
+        _lengths[I] = OutputLength{OutputLength::param, LengthParam};
+        return *this;
+    }
+
+    /**
+     Record as many bytes of the buffer at position I as the function
+     returns, if it returns a positive number
+     */
+    template<size_t I>
+    RecordScope& outputBufferFromReturn() {
+        static_assert(ReplayCodec<std::tuple_element_t<I, ParamTupleType>>::writable,
+                      "outputBufferFromReturn needs a writable pointer parameter");
+        _lengths[I] = OutputLength{OutputLength::returnValue, 0};
+        return *this;
+    }
+
+private:
+
+    struct OutputLength {
+        enum Kind { fixed, param, returnValue } kind;
+        size_t value; // the fixed length or the parameter index
+    };
+
+    CallRecording& _recording;
+    std::uint16_t _function;
+    std::array<OutputLength, numParams> _lengths{};
+    MockScope<T> _mockScope;
+
+    template<size_t... I>
+    void initLengths(std::index_sequence<I...>) {
+        int expand[] = {0, (_lengths[I] = OutputLength{OutputLength::fixed, defaultLength<std::tuple_element_t<I, ParamTupleType>>()}, 0)...};
+        (void)expand;
+    }
+
+    template<typename A>
+    static constexpr std::enable_if_t<ReplayCodec<A>::writable, size_t> defaultLength() { return ReplayCodec<A>::defaultLength; }
+
+    template<typename A>
+    static constexpr std::enable_if_t<!ReplayCodec<A>::writable, size_t> defaultLength() { return 0; }
+
+    template<typename R = ReturnType, typename F, typename... A>
+    std::enable_if_t<!std::is_void<R>::value, R>
+    recordCall(const F& func, A... args) {
+        const auto ret = func(args...);
+        const auto error = errno;
+        writeCall(error, &ret, sizeof(ret), count(ret), args...);
+        errno = error;
+        return ret;
+    }
+
+    template<typename R = ReturnType, typename F, typename... A>
+    std::enable_if_t<std::is_void<R>::value>
+    recordCall(const F& func, A... args) {
+        func(args...);
+        const auto error = errno;
+        writeCall(error, nullptr, 0, 0, args...);
+        errno = error;
+    }
+
+    template<typename... A>
+    void writeCall(int error, const void* ret, size_t retSize, std::uint64_t returned, A... args) {
+        const auto entry = _recording.beginEntry(ReplayEntryHeader::call, _function);
+        _recording.appendValue(static_cast<std::int32_t>(error));
+        _recording.append(ret, retSize);
+        int inputs[] = {0, (writeInput(args), 0)...};
+        (void)inputs;
+        const auto params = std::make_tuple(args...);
+        writeOutputs(params, returned, std::index_sequence_for<A...>{});
+        _recording.endEntry(entry);
+    }
+
+    template<typename A>
+    std::enable_if_t<!std::is_pointer<A>::value> writeInput(const A& arg) {
+        _recording.appendValue(arg);
+    }
+
+    void writeInput(const char* arg) {
+        const auto length = arg ? static_cast<std::uint32_t>(strlen(arg)) : ReplayCodec<const char*>::nullLength();
+        _recording.appendValue(length);
+        if(arg) _recording.append(arg, length);
+    }
+
+    template<typename A>
+    std::enable_if_t<std::is_pointer<A>::value> writeInput(A) {}
+
+    template<size_t... I>
+    void writeOutputs(const ParamTupleType& params, std::uint64_t returned, std::index_sequence<I...>) {
+        int expand[] = {0, (writeOutput<I>(params, returned), 0)...};
+        (void)expand;
+    }
+
+    template<size_t I>
+    std::enable_if_t<ReplayCodec<std::tuple_element_t<I, ParamTupleType>>::writable>
+    writeOutput(const ParamTupleType& params, std::uint64_t returned) {
+        const auto pointer = std::get<I>(params);
+        std::uint32_t length = 0;
+        if(pointer) {
+            switch(_lengths[I].kind) {
+            case OutputLength::fixed: length = static_cast<std::uint32_t>(_lengths[I].value); break;
+            case OutputLength::param: length = static_cast<std::uint32_t>(paramCount(params, _lengths[I].value)); break;
+            case OutputLength::returnValue: length = static_cast<std::uint32_t>(returned); break;
+            }
+        }
+        _recording.appendValue(length);
+        _recording.append(pointer, length);
+    }
+
+    template<size_t I>
+    std::enable_if_t<!ReplayCodec<std::tuple_element_t<I, ParamTupleType>>::writable>
+    writeOutput(const ParamTupleType&, std::uint64_t) {}
+
+    // the value of the parameter at a runtime index as a count
+    static std::uint64_t paramCount(const ParamTupleType& params, size_t index) {
+        return paramCount(params, index, std::make_index_sequence<numParams>{});
+    }
+
+    template<size_t... I>
+    static std::uint64_t paramCount(const ParamTupleType& params, size_t index, std::index_sequence<I...>) {
+        std::uint64_t result = 0;
+        int expand[] = {0, (I == index ? (result = count(std::get<I>(params)), 0) : 0)...};
+        (void)expand;
+        return result;
+    }
+
+    template<typename V>
+    static std::enable_if_t<std::is_integral<V>::value, std::uint64_t> count(const V& value) {
+        return value > 0 ? static_cast<std::uint64_t>(value) : 0;
+    }
+
+    template<typename V>
+    static std::enable_if_t<!std::is_integral<V>::value, std::uint64_t> count(const V&) {
+        return 0;
+    }
+};
+
+
+/**
+ Whether replay checks that the arguments match the recorded ones
+ */
+enum class ReplayMode { checkArguments, inOrder };
+
+
+/**
+ RAII class that answers calls from the ones recorded in a CallPlayback,
+ in order
+ */
+template<typename T>
+class ReplayScope {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+    using ParamTupleType = typename StdFunctionTraits<T>::TupleType;
+    static constexpr size_t numParams = std::tuple_size<ParamTupleType>::value;
+
+    ReplayScope(T& func, const std::string& name, const CallPlayback& playback,
+                ReplayMode mode = ReplayMode::checkArguments):
+        _name(name),
+        _calls(playback.function(name, ReplayLayout<T>::get()).calls),
+        _mode{mode},
+        _mockScope{func, [this](auto... args) -> ReturnType {
+                if(_next == _calls.size())
+                    throw MockException("Replay of " + _name + " ran out of recorded calls after " +
+                                        std::to_string(_calls.size()));
+                ReplayCursor cursor{_calls[_next++]};
+                const auto error = cursor.read<std::int32_t>();
+                auto ret = this->template readReturn<ReturnType>(cursor);
+                size_t index = 0;
+                int inputs[] = {0, (this->checkInput(cursor, args, index++), 0)...};
+                (void)inputs;
+                index = 0;
+                int outputs[] = {0, (this->readOutput(cursor, args, index, this->bufferSize(index, args...)),
+                                     ++index, 0)...};
+                (void)outputs;
+                errno = error;
+                return static_cast<ReturnType>(ret);
+            }} {
+        _sizeParams.fill(size_t{noParam});
+    }
+
+    /**
+     The buffer at position I has room for as many bytes as the parameter at
+     position SizeParam says
+     */
+    template<size_t I, size_t SizeParam>
+    ReplayScope& outputBuffer() {
+        static_assert(ReplayCodec<std::tuple_element_t<I, ParamTupleType>>::writable,
+                      "outputBuffer needs a writable pointer parameter");
+        _sizeParams[I] = SizeParam;
+        return *this;
+    }
+
+    /**
+     How many recorded calls haven't been replayed yet
+     */
+    size_t remaining() const noexcept { return _calls.size() - _next; }
+
+private:
+
+    static constexpr size_t noParam = std::numeric_limits<size_t>::max();
+
+    std::string _name;
+    const std::vector<const char*>& _calls;
+    ReplayMode _mode;
+    size_t _next = 0;
+    std::array<size_t, numParams> _sizeParams{};
+    MockScope<T> _mockScope;
+
+    template<typename R>
+    std::enable_if_t<!std::is_void<R>::value, R> readReturn(ReplayCursor& cursor) {
+        return cursor.read<R>();
+    }
+
+    template<typename R>
+    std::enable_if_t<std::is_void<R>::value, void*> readReturn(ReplayCursor&) {
+        return nullptr;
+    }
+
+    template<typename A>
+    std::enable_if_t<!std::is_pointer<A>::value> checkInput(ReplayCursor& cursor, const A& arg, size_t index) {
+        const auto recorded = cursor.bytes(sizeof(A));
+        if(_mode == ReplayMode::checkArguments && !same(recorded, arg))
+            mismatch(index, toString(arg));
+    }
+
+    // by their own operator== so that padding doesn't matter
+    template<typename A>
+    static std::enable_if_t<std::is_class<A>::value && HasEquality<A>::value, bool>
+    same(const char* recorded, const A& arg) {
+        std::aligned_storage_t<sizeof(A), alignof(A)> storage;
+        memcpy(&storage, recorded, sizeof(A));
+        return *reinterpret_cast<const A*>(&storage) == arg;
+    }
+
+    template<typename A>
+    static std::enable_if_t<!std::is_class<A>::value || !HasEquality<A>::value, bool>
+    same(const char* recorded, const A& arg) noexcept {
+        return memcmp(recorded, &arg, sizeof(A)) == 0;
+    }
+
+    void checkInput(ReplayCursor& cursor, const char* arg, size_t index) {
+        const auto length = cursor.read<std::uint32_t>();
+        const auto recorded = length == ReplayCodec<const char*>::nullLength() ? nullptr : cursor.bytes(length);
+        if(_mode != ReplayMode::checkArguments) return;
+        const bool same = recorded == nullptr || arg == nullptr ?
+            recorded == arg :
+            strlen(arg) == length && memcmp(arg, recorded, length) == 0;
+        if(!same) mismatch(index, arg ? arg : "nullptr");
+    }
+
+    template<typename A>
+    std::enable_if_t<std::is_pointer<A>::value> checkInput(ReplayCursor&, A, size_t) {}
+
+    // how many bytes the buffer at position index has room for, if known
+    template<typename... A>
+    std::uint64_t bufferSize(size_t index, const A&... args) const noexcept {
+        const auto sizeParam = _sizeParams[index];
+        return sizeParam == noParam ? std::numeric_limits<std::uint64_t>::max() : countParameterAt(sizeParam, args...);
+    }
+
+    template<typename A>
+    std::enable_if_t<ReplayCodec<A>::writable>
+    readOutput(ReplayCursor& cursor, A arg, size_t index, std::uint64_t size) {
+        const auto length = cursor.read<std::uint32_t>();
+        const auto bytes = cursor.bytes(length);
+        if(!arg || !length) return;
+        // pointers to single objects have room for one
+        const std::uint64_t objectSize = ReplayCodec<A>::defaultLength;
+        if(_sizeParams[index] == noParam && objectSize) size = objectSize;
+        if(length > size)
+            throw MockException("Call " + std::to_string(_next) + " to " + _name + " wrote " +
+                                std::to_string(length) + " bytes to parameter " + std::to_string(index) +
+                                " in the recording, but the buffer only has room for " + std::to_string(size) + "\n");
+        memcpy(arg, bytes, length);
+    }
+
+    template<typename A>
+    std::enable_if_t<!ReplayCodec<A>::writable> readOutput(ReplayCursor&, const A&, size_t, std::uint64_t) {}
+
+    void mismatch(size_t index, const std::string& actual) const {
+        throw MockException("Call " + std::to_string(_next) + " to " + _name +
+                            " doesn't match the recording: parameter " + std::to_string(index) +
+                            " is " + actual + "\n");
+    }
+};
+
+
+/**
+ Helper function to create a RecordScope
+ */
+template<typename T>
+RecordScope<T> recordCalls(T& func, const std::string& name, CallRecording& recording) {
+    return {func, name, recording};
+}
+
+/**
+ Helper function to create a ReplayScope
+ */
+template<typename T>
+ReplayScope<T> replayCalls(T& func, const std::string& name, const CallPlayback& playback,
+                           ReplayMode mode = ReplayMode::checkArguments) {
+    return {func, name, playback, mode};
+}
+
+/**
+ Helper macro to record the calls to a particular "real" function
+ */
+#define RECORD_CALLS(func, recording) recordCalls(mock_##func, #func, recording)
+
+/**
+ Helper macro to replay the calls recorded for a particular "real" function
+ */
+#define REPLAY_CALLS(func, ...) replayCalls(mock_##func, #func, __VA_ARGS__)
+
+
+#endif // PREMOCK_REPLAY_HPP_
@@ -0,0 +1,211 @@
+/**
+Runs independent test cases in parallel in one process.
+
+Mocks are thread_local, so tests running on different threads can't see each
+other's `REPLACE`, `MOCK` or `SPY`. A `ParallelRunner` takes advantage of
+that: it runs the tests it's given on a pool of worker threads that steal
+work from each other when they run out, resets every registered mock to its
+default before each test, and collects the failures instead of stopping at
+the first one:
+
+```c++
+int main() {
+    ParallelRunner runner;
+    runner.add("send retries", [] { ... });
+    runner.add("recv times out", [] { ... });
+    const auto results = runner.run();
+    std::cout << results.report();
+    return results.failures.empty() ? 0 : 1;
+}
+```
+
+A test fails by throwing, usually a `MockException` from a failed
+expectation. Tests must not share state other than through their mocks, and
+assertion macros of test frameworks that aren't thread safe can't be used in
+them.
+ */
+
+#ifndef PREMOCK_RUNNER_HPP_
+#define PREMOCK_RUNNER_HPP_
+
+#include "premock.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ A test that threw, and what
+ */
+struct TestFailure {
+    std::string name;
+    std::string message;
+};
+
+
+/**
+ What a ParallelRunner run found
+ */
+struct TestResults {
+    size_t passed = 0;
+    std::vector<TestFailure> failures; // in the order the tests were added
+    std::chrono::nanoseconds elapsed{0};
+
+    std::string report() const {
+        std::string result;
+        for(const auto& failure: failures)
+            result += "FAILED: " + failure.name + "\n" + failure.message + "\n";
+        const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        return result + std::to_string(passed) + " passed, " + std::to_string(failures.size()) + " failed in " +
+            std::to_string(milliseconds) + "ms\n";
+    }
+
+    /**
+     Throws a MockException with every failure if there were any
+     */
+    void verify() const {
+        if(failures.empty()) return;
+        throw MockException(report());
+    }
+};
+
+
+/**
+ Runs tests on a work-stealing thread pool with clean mocks for each one
+ */
+class ParallelRunner {
+public:
+
+    /**
+     Uses as many worker threads as there are cores if threads is 0
+     */
+    explicit ParallelRunner(size_t threads = 0):
+        _threads{threads ? threads : std::max(1u, std::thread::hardware_concurrency())} {
+    }
+
+    ParallelRunner& add(std::string name, std::function<void()> test) {
+        _tests.push_back(Test{std::move(name), std::move(test)});
+        return *this;
+    }
+
+    size_t size() const noexcept { return _tests.size(); }
+    size_t threads() const noexcept { return _threads; }
+
+    /**
+     Runs every test once and waits for all of them to finish
+     */
+    TestResults run() const {
+        const auto start = std::chrono::steady_clock::now();
+        const auto workers = std::max<size_t>(1, std::min(_threads, _tests.size()));
+        std::unique_ptr<Queue[]> queues{new Queue[workers]};
+        // contiguous shares so that neighbouring tests, which often use the
+        // same mocks, tend to run on the same thread
+        for(size_t i = 0; i < workers; ++i)
+            queues[i].range.store(Queue::pack(_tests.size() * i / workers, _tests.size() * (i + 1) / workers));
+
+        std::vector<std::string> errors(_tests.size());
+        std::vector<char> failed(_tests.size(), 0);
+        // not on this thread, whose mocks the caller may have replaced
+        std::vector<std::thread> pool;
+        for(size_t i = 0; i < workers; ++i)
+            pool.emplace_back([&, i] { work(queues.get(), workers, i, errors, failed); });
+        for(auto& thread: pool) thread.join();
+
+        TestResults results;
+        for(size_t i = 0; i < _tests.size(); ++i) {
+            if(failed[i]) results.failures.push_back(TestFailure{_tests[i].name, std::move(errors[i])});
+            else ++results.passed;
+        }
+        results.elapsed = std::chrono::steady_clock::now() - start;
+        return results;
+    }
+
+private:
+
+    struct Test {
+        std::string name;
+        std::function<void()> body;
+    };
+
+    // The tests a worker has left, [begin, end) packed into one atomic so
+    // that the owner taking from the front and thieves taking the back half
+    // agree without a lock. Padded to keep queues off each other's cache lines.
+    struct Queue {
+        std::atomic<std::uint64_t> range{0};
+        char padding[64 - sizeof(std::atomic<std::uint64_t>)];
+
+        static std::uint64_t pack(size_t begin, size_t end) noexcept {
+            return static_cast<std::uint64_t>(begin) << 32 | static_cast<std::uint32_t>(end);
+        }
+
+        static size_t begin(std::uint64_t range) noexcept { return static_cast<size_t>(range >> 32); }
+        static size_t end(std::uint64_t range) noexcept { return static_cast<size_t>(range & 0xffffffff); }
+
+        bool take(size_t& test) noexcept {
+            auto current = range.load(std::memory_order_acquire);
+            while(begin(current) < end(current)) {
+                if(range.compare_exchange_weak(current, pack(begin(current) + 1, end(current)),
+                                               std::memory_order_acq_rel)) {
+                    test = begin(current);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // takes the back half of the victim's tests, returns the first and
+        // keeps the rest in this queue
+        bool stealFrom(Queue& victim, size_t& test) noexcept {
+            auto current = victim.range.load(std::memory_order_acquire);
+            while(begin(current) < end(current)) {
+                const auto middle = begin(current) + (end(current) - begin(current)) / 2;
+                if(victim.range.compare_exchange_weak(current, pack(begin(current), middle),
+                                                      std::memory_order_acq_rel)) {
+                    range.store(pack(middle + 1, end(current)), std::memory_order_release);
+                    test = middle;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    size_t _threads;
+    std::vector<Test> _tests;
+
+    void work(Queue* queues, size_t workers, size_t self,
+              std::vector<std::string>& errors, std::vector<char>& failed) const {
+        size_t test;
+        while(next(queues, workers, self, test)) {
+            // not what this thread started with, which it may have inherited
+            MockRegistry::resetOverrides();
+            MockRegistry::forEach([](const MockRegistration& registration) { registration.restoreDefault(); });
+            try {
+                _tests[test].body();
+            } catch(const std::exception& ex) {
+                failed[test] = 1;
+                errors[test] = ex.what();
+            } catch(...) {
+                failed[test] = 1;
+                errors[test] = "unknown exception";
+            }
+        }
+        MockRegistry::resetOverrides();
+    }
+
+    static bool next(Queue* queues, size_t workers, size_t self, size_t& test) noexcept {
+        if(queues[self].take(test)) return true;
+        for(size_t i = 1; i < workers; ++i)
+            if(queues[self].stealFrom(queues[(self + i) % workers], test)) return true;
+        return false;
+    }
+};
+
+
+#endif // PREMOCK_RUNNER_HPP_
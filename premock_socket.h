@@ -0,0 +1,15 @@
+#ifndef PREMOCK_SOCKET_H_
+#define PREMOCK_SOCKET_H_
+
+#define socket ut_premock_socket
+#define bind ut_premock_bind
+#define listen ut_premock_listen
+#define connect ut_premock_connect
+#define accept ut_premock_accept
+#define send ut_premock_send
+#define recv ut_premock_recv
+#define close ut_premock_close
+#define shutdown ut_premock_shutdown
+#define fcntl ut_premock_fcntl
+
+#endif // PREMOCK_SOCKET_H_
@@ -0,0 +1,704 @@
+/**
+In-memory loopback sockets for running client and server code paths in one
+test process at memory speed.
+
+The mocks for `socket`, `bind`, `listen`, `connect`, `accept`, `send`, `recv`,
+`close`, `shutdown` and `fcntl` declared here are backed by a `LoopbackNetwork`: sockets
+get fake file descriptors, connecting to a bound and listening address queues
+the connection for `accept`, and data sent on one end of a connection becomes
+readable on the other through a lock-free single-producer single-consumer ring
+buffer per direction. No kernel is involved, so throughput tests of network
+layers are fast and deterministic.
+
+`fcntl` is variadic, which the generic mock macros can't handle, so it has
+its own declaration and implementation macro. The production code needs the
+redefinitions in `premock_socket.h` and the test binary has to implement the
+mocks:
+
+```c++
+#include "premock_socket.hpp"
+extern "C" {
+    IMPL_MOCK_DEFAULT(3, socket);
+    IMPL_MOCK_DEFAULT(3, bind);
+    IMPL_MOCK_DEFAULT(2, listen);
+    IMPL_MOCK_DEFAULT(3, connect);
+    IMPL_MOCK_DEFAULT(3, accept);
+    IMPL_MOCK_DEFAULT(4, send);
+    IMPL_MOCK_DEFAULT(4, recv);
+    IMPL_MOCK_DEFAULT(1, close);
+    IMPL_MOCK_DEFAULT(2, shutdown);
+    IMPL_MOCK_FCNTL();
+}
+```
+
+Test code then does:
+
+```c++
+TEST(server, echo) {
+    LoopbackSockets sockets;
+    std::thread server{[&] {
+        LoopbackSockets serverSockets{sockets.network()}; // mocks are per thread
+        run_echo_server(8080);
+    }};
+    REQUIRE(echo_client(8080, "hello") == "hello");
+    server.join();
+}
+```
+
+Like with real sockets, calls on a blocking socket wait (by yielding) until they
+can make progress, so single-threaded tests should either order their calls so
+that doesn't happen or use non-blocking sockets, made so with `SOCK_NONBLOCK`
+or `fcntl(fd, F_SETFL, O_NONBLOCK)`, or `MSG_DONTWAIT`. Each direction
+of a connection must only be written to by one thread and read from by one
+thread at a time. File descriptors that don't belong to the network are forwarded
+to the previous implementation, so real sockets and files keep working. The
+buffers of a connection closed at both ends and the state of closed sockets
+are reused for the next ones, so tests that connect over and over don't keep
+allocating.
+ */
+
+#ifndef PREMOCK_SOCKET_HPP_
+#define PREMOCK_SOCKET_HPP_
+
+#include "premock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+DECL_MOCK(socket);
+DECL_MOCK(bind);
+DECL_MOCK(listen);
+DECL_MOCK(connect);
+DECL_MOCK(accept);
+DECL_MOCK(send);
+DECL_MOCK(recv);
+DECL_MOCK(close);
+DECL_MOCK(shutdown);
+
+/**
+ The mock for fcntl. It takes the third argument explicitly since the real
+ function is variadic and std::function can't be. Like glibc, it's read as
+ pointer-sized whether the command takes one or not.
+ */
+extern "C" MockRegistration premock_registration_fcntl;
+extern "C" thread_local std::function<int(int, int, std::intptr_t)> mock_fcntl;
+
+/**
+ The implementation of the mock for fcntl, defaulting to the real function.
+ Like IMPL_MOCK_DEFAULT, it should be used in an extern "C" block.
+ */
+#define IMPL_MOCK_FCNTL() \
+    int ut_premock_fcntl(int fd, int cmd, ...) { \
+        premockCallSite() = PREMOCK_RETURN_ADDRESS(); \
+        premock_registration_fcntl.called(); \
+        va_list args; \
+        va_start(args, cmd); \
+        const auto arg = va_arg(args, std::intptr_t); \
+        va_end(args); \
+        return mock_fcntl(fd, cmd, arg); \
+    } \
+    MOCK_REGISTRATION(fcntl); \
+    thread_local decltype(mock_fcntl) mock_fcntl = [](int fd, int cmd, std::intptr_t arg) { \
+        return fcntl(fd, cmd, arg); \
+    }
+
+
+/**
+ A lock-free ring buffer of bytes for one writer thread and one reader thread.
+ The capacity is rounded up to a power of two.
+ */
+class SpscRing {
+public:
+
+    explicit SpscRing(size_t capacity):
+        _capacity{roundUpToPowerOfTwo(capacity)},
+        _buffer{new char[_capacity]} {
+    }
+
+    /**
+     Writes as many bytes as fit, returns how many that was
+     */
+    size_t write(const void* data, size_t length) noexcept {
+        const auto tail = _tail.load(std::memory_order_relaxed);
+        const auto head = _head.load(std::memory_order_acquire);
+        const auto count = std::min(length, _capacity - (tail - head));
+        copyIn(tail, static_cast<const char*>(data), count);
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     Reads up to length bytes, returns how many were read. If peek is true
+     the bytes stay in the buffer.
+     */
+    size_t read(void* data, size_t length, bool peek = false) noexcept {
+        const auto head = _head.load(std::memory_order_relaxed);
+        const auto tail = _tail.load(std::memory_order_acquire);
+        const auto count = std::min(length, tail - head);
+        copyOut(head, static_cast<char*>(data), count);
+        if(!peek) _head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t size() const noexcept {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const noexcept { return _capacity; }
+
+    /**
+     Empties the buffer. Only while neither the writer nor the reader uses it.
+     */
+    void reset() noexcept {
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+
+    const size_t _capacity;
+    std::unique_ptr<char[]> _buffer;
+    // the indices only ever increase and are wrapped when used, which makes
+    // telling an empty buffer from a full one trivial. They're padded onto
+    // separate cache lines so the reader and writer don't fight over them
+    // (padding instead of alignas since C++14 has no aligned new).
+    char _padding0[64];
+    std::atomic<size_t> _head{0};
+    char _padding1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _tail{0};
+
+    void copyIn(size_t index, const char* data, size_t count) noexcept {
+        const auto start = index & (_capacity - 1);
+        const auto first = std::min(count, _capacity - start);
+        memcpy(&_buffer[start], data, first);
+        memcpy(&_buffer[0], data + first, count - first);
+    }
+
+    void copyOut(size_t index, char* data, size_t count) const noexcept {
+        const auto start = index & (_capacity - 1);
+        const auto first = std::min(count, _capacity - start);
+        memcpy(data, &_buffer[start], first);
+        memcpy(data + first, &_buffer[0], count - first);
+    }
+
+    static size_t roundUpToPowerOfTwo(size_t value) noexcept {
+        size_t result = 1;
+        while(result < value) result <<= 1;
+        return result;
+    }
+};
+
+
+/**
+ The state shared by all sockets in one emulated network. Can be used from
+ several threads at once, each with its own LoopbackSockets scope.
+ */
+class LoopbackNetwork {
+public:
+
+    /**
+     The first fake file descriptor handed out. High enough to not clash with
+     real ones.
+     */
+    static constexpr int firstFd() noexcept { return 1 << 20; }
+
+    explicit LoopbackNetwork(size_t maxSockets = 1024, size_t bufferSize = 64 * 1024):
+        _bufferSize{bufferSize},
+        _sockets(maxSockets) {
+    }
+
+    LoopbackNetwork(const LoopbackNetwork&) = delete;
+    LoopbackNetwork& operator=(const LoopbackNetwork&) = delete;
+
+    /**
+     Whether fd is one of this network's fake file descriptors
+     */
+    bool owns(int fd) const noexcept {
+        return fd >= firstFd() && static_cast<size_t>(fd - firstFd()) < _sockets.size();
+    }
+
+    int socket(int domain, int type, int) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto& endpoint = newEndpoint();
+        endpoint.domain = domain;
+        endpoint.nonBlocking.store((type & SOCK_NONBLOCK) != 0, std::memory_order_relaxed);
+        const auto fd = allocateFd(&endpoint);
+        if(fd == -1) _closedEndpoints.push_back(&endpoint);
+        return fd;
+    }
+
+    int bind(int fd, const sockaddr* address, socklen_t length) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+        if(!address) return fail(EFAULT);
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        if(!endpoint->address.empty()) return fail(EINVAL);
+        const auto key = addressKey(address, length);
+        if(isBound(key)) return fail(EADDRINUSE);
+        endpoint->address = key;
+        endpoint->addressBytes.assign(reinterpret_cast<const char*>(address), length);
+        return 0;
+    }
+
+    int listen(int fd, int) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        if(endpoint->address.empty() || endpoint->connection) return fail(EINVAL);
+        endpoint->listening = true;
+        return 0;
+    }
+
+    int connect(int fd, const sockaddr* address, socklen_t length) {
+        auto client = find(fd);
+        if(!client) return -1;
+        if(!address) return fail(EFAULT);
+        if(client->listening) return fail(EINVAL);
+        if(client->connection) return fail(EISCONN);
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto listener = findListener(addressKey(address, length));
+        if(!listener) return fail(ECONNREFUSED);
+
+        auto& connection = newConnection();
+        auto& server = newEndpoint();
+        server.domain = listener->domain;
+        server.addressBytes = listener->addressBytes;
+        server.peerAddressBytes = client->addressBytes;
+        server.connect(connection, true);
+        client->peerAddressBytes.assign(reinterpret_cast<const char*>(address), length);
+        client->connect(connection, false);
+
+        std::lock_guard<std::mutex> backlogLock{listener->backlogMutex};
+        listener->backlog.push_back(&server);
+        return 0;
+    }
+
+    int accept(int fd, sockaddr* address, socklen_t* length) {
+        auto listener = find(fd);
+        if(!listener) return -1;
+        if(!listener->listening) return fail(EINVAL);
+
+        Endpoint* endpoint = nullptr;
+        while(!(endpoint = popBacklog(*listener))) {
+            if(isNonBlocking(*listener)) return fail(EAGAIN);
+            std::this_thread::yield();
+        }
+
+        copyAddress(endpoint->peerAddressBytes, address, length);
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto accepted = allocateFd(endpoint);
+        if(accepted == -1) {
+            // out of descriptors, so the connection is refused after all
+            endpoint->in->readerClosed.store(true, std::memory_order_release);
+            endpoint->out->writerClosed.store(true, std::memory_order_release);
+            closeEnd(*endpoint->connection);
+            _closedEndpoints.push_back(endpoint);
+        }
+        return accepted;
+    }
+
+    ssize_t send(int fd, const void* buffer, size_t length, int flags) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+        if(!endpoint->connection) return fail(ENOTCONN);
+        auto& channel = *endpoint->out;
+        if(channel.writerClosed.load(std::memory_order_acquire) ||
+           channel.readerClosed.load(std::memory_order_acquire))
+            return fail(EPIPE);
+        if(length == 0) return 0;
+
+        for(;;) {
+            const auto written = channel.ring.write(buffer, length);
+            if(written) return static_cast<ssize_t>(written);
+            if(channel.readerClosed.load(std::memory_order_acquire)) return fail(EPIPE);
+            if(isNonBlocking(*endpoint) || (flags & MSG_DONTWAIT)) return fail(EAGAIN);
+            std::this_thread::yield();
+        }
+    }
+
+    ssize_t recv(int fd, void* buffer, size_t length, int flags) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+        if(!endpoint->connection) return fail(ENOTCONN);
+        auto& channel = *endpoint->in;
+        if(length == 0) return 0;
+
+        for(;;) {
+            // check for the writer closing first so that no data
+            // written before it did gets missed
+            const auto writerClosed = channel.writerClosed.load(std::memory_order_acquire);
+            const auto read = channel.ring.read(buffer, length, (flags & MSG_PEEK) != 0);
+            if(read) return static_cast<ssize_t>(read);
+            if(writerClosed || channel.readerClosed.load(std::memory_order_acquire)) return 0;
+            if(isNonBlocking(*endpoint) || (flags & MSG_DONTWAIT)) return fail(EAGAIN);
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     Only the file status flags, of which only O_NONBLOCK can be changed,
+     and the file descriptor flags, which are ignored
+     */
+    int fcntl(int fd, int cmd, std::intptr_t arg) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+        switch(cmd) {
+        case F_GETFL:
+            return O_RDWR | (isNonBlocking(*endpoint) ? O_NONBLOCK : 0);
+        case F_SETFL:
+            endpoint->nonBlocking.store((arg & O_NONBLOCK) != 0, std::memory_order_relaxed);
+            return 0;
+        case F_GETFD:
+        case F_SETFD:
+            return 0;
+        default:
+            return fail(EINVAL);
+        }
+    }
+
+    int shutdown(int fd, int how) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+        if(!endpoint->connection) return fail(ENOTCONN);
+        if(how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) return fail(EINVAL);
+        if(how != SHUT_WR) endpoint->in->readerClosed.store(true, std::memory_order_release);
+        if(how != SHUT_RD) endpoint->out->writerClosed.store(true, std::memory_order_release);
+        return 0;
+    }
+
+    int close(int fd) {
+        auto endpoint = find(fd);
+        if(!endpoint) return -1;
+
+        if(endpoint->connection) {
+            endpoint->in->readerClosed.store(true, std::memory_order_release);
+            endpoint->out->writerClosed.store(true, std::memory_order_release);
+        }
+
+        std::deque<Endpoint*> refused;
+        if(endpoint->listening) {
+            // refuse the connections nobody is going to accept
+            std::lock_guard<std::mutex> lock{endpoint->backlogMutex};
+            for(auto pending: endpoint->backlog) {
+                pending->in->readerClosed.store(true, std::memory_order_release);
+                pending->out->writerClosed.store(true, std::memory_order_release);
+            }
+            refused.swap(endpoint->backlog);
+        }
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        // another thread closing the same fd got here first
+        if(_sockets[fd - firstFd()].load(std::memory_order_relaxed) != endpoint) return fail(EBADF);
+        if(endpoint->connection) closeEnd(*endpoint->connection);
+        for(auto pending: refused) {
+            closeEnd(*pending->connection);
+            _closedEndpoints.push_back(pending);
+        }
+        _sockets[fd - firstFd()].store(nullptr, std::memory_order_release);
+        _closedEndpoints.push_back(endpoint);
+        return 0;
+    }
+
+    /**
+     How many bytes are waiting to be received on fd
+     */
+    size_t pending(int fd) const {
+        auto endpoint = find(fd);
+        return endpoint && endpoint->connection ? endpoint->in->ring.size() : 0;
+    }
+
+    /**
+     How many connections have buffers allocated, whether they're open or
+     closed at both ends and waiting to be reused
+     */
+    size_t connectionsAllocated() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _connections.size();
+    }
+
+    /**
+     How many sockets have state allocated, whether they're open, waiting to
+     be accepted or closed and waiting to be reused
+     */
+    size_t endpointsAllocated() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _endpoints.size();
+    }
+
+private:
+
+    struct Channel {
+        explicit Channel(size_t size):ring{size} {}
+        SpscRing ring;
+        std::atomic<bool> writerClosed{false};
+        std::atomic<bool> readerClosed{false};
+
+        void reset() noexcept {
+            ring.reset();
+            writerClosed.store(false, std::memory_order_relaxed);
+            readerClosed.store(false, std::memory_order_relaxed);
+        }
+    };
+
+    struct Connection {
+        explicit Connection(size_t size):toServer{size}, toClient{size} {}
+        Channel toServer;
+        Channel toClient;
+        int openEnds = 2; // guarded by the network's mutex
+    };
+
+    struct Endpoint {
+        int domain = AF_UNSPEC;
+        std::atomic<bool> nonBlocking{false}; // fcntl can change it while others look
+        bool listening = false;
+        std::string address;
+        std::string addressBytes;
+        std::string peerAddressBytes;
+        Connection* connection = nullptr;
+        Channel* in = nullptr;
+        Channel* out = nullptr;
+        std::mutex backlogMutex;
+        std::deque<Endpoint*> backlog;
+
+        void connect(Connection& newConnection, bool isServer) noexcept {
+            connection = &newConnection;
+            out = isServer ? &newConnection.toClient : &newConnection.toServer;
+            in = isServer ? &newConnection.toServer : &newConnection.toClient;
+        }
+
+        // keeps the memory the strings have
+        void reset() noexcept {
+            domain = AF_UNSPEC;
+            nonBlocking.store(false, std::memory_order_relaxed);
+            listening = false;
+            address.clear();
+            addressBytes.clear();
+            peerAddressBytes.clear();
+            connection = nullptr;
+            in = out = nullptr;
+            backlog.clear();
+        }
+    };
+
+    const size_t _bufferSize;
+    // the endpoints and connections are only freed when the network is, so a
+    // lookup racing with close never touches freed memory. Closed endpoints
+    // and connections closed at both ends are reused for new ones instead.
+    // _sockets is lock-free for the hot path.
+    std::vector<std::atomic<Endpoint*>> _sockets;
+    std::deque<std::unique_ptr<Endpoint>> _endpoints;
+    std::vector<Endpoint*> _closedEndpoints;
+    std::deque<std::unique_ptr<Connection>> _connections;
+    std::vector<Connection*> _closedConnections;
+    mutable std::mutex _mutex;
+
+    // must be called with _mutex locked
+    Endpoint& newEndpoint() {
+        if(_closedEndpoints.empty()) {
+            _endpoints.emplace_back(new Endpoint);
+            return *_endpoints.back();
+        }
+        auto& endpoint = *_closedEndpoints.back();
+        _closedEndpoints.pop_back();
+        endpoint.reset();
+        return endpoint;
+    }
+
+    // must be called with _mutex locked
+    Connection& newConnection() {
+        if(_closedConnections.empty()) {
+            _connections.emplace_back(new Connection{_bufferSize});
+            return *_connections.back();
+        }
+        auto& connection = *_closedConnections.back();
+        _closedConnections.pop_back();
+        connection.toServer.reset();
+        connection.toClient.reset();
+        connection.openEnds = 2;
+        return connection;
+    }
+
+    // must be called with _mutex locked
+    void closeEnd(Connection& connection) {
+        if(--connection.openEnds == 0) _closedConnections.push_back(&connection);
+    }
+
+    // must be called with _mutex locked
+    int allocateFd(Endpoint* endpoint) {
+        for(size_t i = 0; i < _sockets.size(); ++i) {
+            if(!_sockets[i].load(std::memory_order_relaxed)) {
+                _sockets[i].store(endpoint, std::memory_order_release);
+                return firstFd() + static_cast<int>(i);
+            }
+        }
+        return fail(EMFILE);
+    }
+
+    static bool isNonBlocking(const Endpoint& endpoint) noexcept {
+        return endpoint.nonBlocking.load(std::memory_order_relaxed);
+    }
+
+    static Endpoint* popBacklog(Endpoint& listener) {
+        std::lock_guard<std::mutex> lock{listener.backlogMutex};
+        if(listener.backlog.empty()) return nullptr;
+        auto endpoint = listener.backlog.front();
+        listener.backlog.pop_front();
+        return endpoint;
+    }
+
+    Endpoint* find(int fd) const noexcept {
+        auto endpoint = owns(fd) ? _sockets[fd - firstFd()].load(std::memory_order_acquire) : nullptr;
+        if(!endpoint) errno = EBADF;
+        return endpoint;
+    }
+
+    // must be called with _mutex locked
+    bool isBound(const std::string& key) const noexcept {
+        return std::any_of(_sockets.begin(), _sockets.end(), [&key](const std::atomic<Endpoint*>& socket) {
+            const auto endpoint = socket.load(std::memory_order_relaxed);
+            return endpoint && endpoint->address == key;
+        });
+    }
+
+    // must be called with _mutex locked
+    Endpoint* findListener(const std::string& key) const noexcept {
+        for(const auto& socket: _sockets) {
+            const auto endpoint = socket.load(std::memory_order_relaxed);
+            if(endpoint && endpoint->listening && endpoint->address == key) return endpoint;
+        }
+        return nullptr;
+    }
+
+    // only the parts of the address that identify it, ignoring padding
+    static std::string addressKey(const sockaddr* address, socklen_t length) {
+        const auto bytes = reinterpret_cast<const char*>(address);
+        switch(address->sa_family) {
+        case AF_INET: {
+            const auto in = reinterpret_cast<const sockaddr_in*>(address);
+            return std::string(bytes, sizeof(sa_family_t)) +
+                std::string(reinterpret_cast<const char*>(&in->sin_port), sizeof(in->sin_port)) +
+                std::string(reinterpret_cast<const char*>(&in->sin_addr), sizeof(in->sin_addr));
+        }
+        case AF_INET6: {
+            const auto in6 = reinterpret_cast<const sockaddr_in6*>(address);
+            return std::string(bytes, sizeof(sa_family_t)) +
+                std::string(reinterpret_cast<const char*>(&in6->sin6_port), sizeof(in6->sin6_port)) +
+                std::string(reinterpret_cast<const char*>(&in6->sin6_addr), sizeof(in6->sin6_addr));
+        }
+        case AF_UNIX: {
+            const auto un = reinterpret_cast<const sockaddr_un*>(address);
+            const auto pathLength = length - offsetof(sockaddr_un, sun_path);
+            return std::string(bytes, sizeof(sa_family_t)) +
+                std::string(un->sun_path, strnlen(un->sun_path, pathLength));
+        }
+        default:
+            return std::string(bytes, length);
+        }
+    }
+
+    static void copyAddress(const std::string& bytes, sockaddr* address, socklen_t* length) noexcept {
+        if(!address || !length) return;
+        memcpy(address, bytes.data(), std::min(static_cast<size_t>(*length), bytes.size()));
+        *length = static_cast<socklen_t>(bytes.size());
+    }
+
+    static int fail(int error) noexcept {
+        errno = error;
+        return -1;
+    }
+};
+
+
+/**
+ RAII class that makes the socket mocks of the current thread use a
+ LoopbackNetwork until the end of scope.
+ */
+class LoopbackSockets {
+public:
+
+    LoopbackSockets():LoopbackSockets{std::unique_ptr<LoopbackNetwork>{new LoopbackNetwork}, nullptr} {}
+
+    /**
+     Use an externally owned network, e.g. to share it with other threads
+     */
+    explicit LoopbackSockets(LoopbackNetwork& network):
+        LoopbackSockets{nullptr, &network} {
+    }
+
+    LoopbackNetwork& network() noexcept { return _network; }
+
+private:
+
+    std::unique_ptr<LoopbackNetwork> _ownNetwork; // only if no network was passed in
+    LoopbackNetwork& _network;
+    MockScope<decltype(mock_socket)> _socket;
+    MockScope<decltype(mock_bind)> _bind;
+    MockScope<decltype(mock_listen)> _listen;
+    MockScope<decltype(mock_connect)> _connect;
+    MockScope<decltype(mock_accept)> _accept;
+    MockScope<decltype(mock_send)> _send;
+    MockScope<decltype(mock_recv)> _recv;
+    MockScope<decltype(mock_close)> _close;
+    MockScope<decltype(mock_shutdown)> _shutdown;
+    MockScope<decltype(mock_fcntl)> _fcntl;
+
+    LoopbackSockets(std::unique_ptr<LoopbackNetwork> ownNetwork, LoopbackNetwork* network):
+        _ownNetwork{std::move(ownNetwork)},
+        _network(network ? *network : *_ownNetwork),
+        _socket{mock_socket, [this](int domain, int type, int protocol) {
+                return _network.socket(domain, type, protocol);
+            }},
+        _bind{mock_bind, [this](int fd, const sockaddr* address, socklen_t length) {
+                return _network.owns(fd) ? _network.bind(fd, address, length) :
+                    _bind.displaced()(fd, address, length);
+            }},
+        _listen{mock_listen, [this](int fd, int backlog) {
+                return _network.owns(fd) ? _network.listen(fd, backlog) : _listen.displaced()(fd, backlog);
+            }},
+        _connect{mock_connect, [this](int fd, const sockaddr* address, socklen_t length) {
+                return _network.owns(fd) ? _network.connect(fd, address, length) :
+                    _connect.displaced()(fd, address, length);
+            }},
+        _accept{mock_accept, [this](int fd, sockaddr* address, socklen_t* length) {
+                return _network.owns(fd) ? _network.accept(fd, address, length) :
+                    _accept.displaced()(fd, address, length);
+            }},
+        _send{mock_send, [this](int fd, const void* buffer, size_t length, int flags) {
+                return _network.owns(fd) ? _network.send(fd, buffer, length, flags) :
+                    _send.displaced()(fd, buffer, length, flags);
+            }},
+        _recv{mock_recv, [this](int fd, void* buffer, size_t length, int flags) {
+                return _network.owns(fd) ? _network.recv(fd, buffer, length, flags) :
+                    _recv.displaced()(fd, buffer, length, flags);
+            }},
+        _close{mock_close, [this](int fd) {
+                return _network.owns(fd) ? _network.close(fd) : _close.displaced()(fd);
+            }},
+        _shutdown{mock_shutdown, [this](int fd, int how) {
+                return _network.owns(fd) ? _network.shutdown(fd, how) : _shutdown.displaced()(fd, how);
+            }},
+        _fcntl{mock_fcntl, [this](int fd, int cmd, std::intptr_t arg) {
+                return _network.owns(fd) ? _network.fcntl(fd, cmd, arg) : _fcntl.displaced()(fd, cmd, arg);
+            }} {
+    }
+};
+
+
+#endif // PREMOCK_SOCKET_HPP_
@@ -0,0 +1,132 @@
+/**
+Mocks that follow the test into the threads the production code starts.
+
+The storage for mocks is `thread_local`, so a `REPLACE` or `MOCK` in the
+test thread doesn't affect threads started by the code under test. While an
+`InheritMocks` is in scope, every thread it creates with `pthread_create`, or
+`std::thread` which uses it, starts with a copy of the mocks replaced in the
+creating thread and passes them on to the threads it creates in turn. Each
+thread keeps calling its own thread_local mock without any synchronisation:
+
+```c++
+TEST(server, workers_send) {
+    auto m = MOCK(send);
+    m.recordConcurrently(); // called from the workers
+    InheritMocks inherit;
+    start_worker_pool(4);   // std::thread or pthread_create
+    stop_worker_pool();
+    m.expectCalled(4);
+}
+```
+
+Threads are intercepted by defining `pthread_create` in the test binary with
+`IMPL_MOCK_INHERITANCE()`, which forwards to the real one found with
+`dlsym` and so needs `-ldl` with glibc older than 2.34. Without an
+`InheritMocks` in scope threads start as they always do. The copies refer to
+the same objects as the originals, so the mocks must outlive the threads and
+be safe to call from them. Threads started by other means can install a
+`MockSnapshot` themselves.
+
+Of premock's own wrappers, these are safe to inherit: `REPLACE` with an
+implementation that is, a `MOCK` or `SPY` after `recordConcurrently` (and
+`returnConcurrently` for a mock's return values), a spy's `timeCalls`,
+`TRACE_CALLS` and `LockProfile`. `CALL_SITES`, `CallBudget`, `LATENCY`,
+`CpuProfile`, `RECORD_CALLS`, `REPLAY_CALLS` and `FUZZ_MOCK` keep state
+without synchronisation and must only be called from the thread that
+created them, so they must not be in scope when threads inherit mocks.
+ */
+
+#ifndef PREMOCK_THREAD_HPP_
+#define PREMOCK_THREAD_HPP_
+
+#include "premock.hpp"
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <dlfcn.h>
+#include <pthread.h>
+
+
+/**
+ RAII class that makes the threads the current thread creates inherit its
+ mocks until the end of scope. Threads created by other threads, e.g. by
+ tests running in parallel, aren't affected.
+ */
+class InheritMocks {
+public:
+
+    InheritMocks() noexcept { ++depth(); }
+    ~InheritMocks() { --depth(); }
+
+    InheritMocks(const InheritMocks&) = delete;
+    InheritMocks& operator=(const InheritMocks&) = delete;
+
+    /**
+     Whether threads created by the current thread inherit its mocks
+     */
+    static bool active() noexcept { return depth() > 0; }
+
+private:
+
+    static int& depth() noexcept {
+        static thread_local int depth = 0;
+        return depth;
+    }
+};
+
+
+/**
+ What a thread started by inheritingPthreadCreate runs: the creator's mocks
+ are installed before the real start routine, and are passed on to the
+ threads it creates in turn
+ */
+struct InheritingStart {
+    MockSnapshot snapshot;
+    void* (*start)(void*);
+    void* arg;
+
+    static void* run(void* self) {
+        std::unique_ptr<InheritingStart> started{static_cast<InheritingStart*>(self)};
+        started->snapshot.install();
+        const auto start = started->start;
+        const auto arg = started->arg;
+        started.reset();
+        InheritMocks inherit;
+        return start(arg);
+    }
+};
+
+
+/**
+ pthread_create that passes the calling thread's mocks on to the new thread
+ if an InheritMocks is in scope
+ */
+inline int inheritingPthreadCreate(pthread_t* thread, const pthread_attr_t* attr,
+                                   void* (*start)(void*), void* arg) noexcept {
+    using Create = int (*)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*);
+    static const auto real = reinterpret_cast<Create>(dlsym(RTLD_NEXT, "pthread_create"));
+    if(real == nullptr) return ENOSYS;
+    if(!InheritMocks::active()) return real(thread, attr, start, arg);
+
+    try {
+        auto started = new InheritingStart{MockSnapshot{}, start, arg};
+        const auto result = real(thread, attr, &InheritingStart::run, started);
+        if(result != 0) delete started;
+        return result;
+    } catch(...) {
+        return EAGAIN;
+    }
+}
+
+/**
+ Defines pthread_create to call inheritingPthreadCreate. To be used once in
+ the test binary.
+ */
+#define IMPL_MOCK_INHERITANCE() \
+    extern "C" int pthread_create(pthread_t* thread, const pthread_attr_t* attr, \
+                                  void* (*start)(void*), void* arg) noexcept { \
+        return inheritingPthreadCreate(thread, attr, start, arg); \
+    }
+
+
+#endif // PREMOCK_THREAD_HPP_
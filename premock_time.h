@@ -0,0 +1,9 @@
+#ifndef PREMOCK_TIME_H_
+#define PREMOCK_TIME_H_
+
+#define nanosleep ut_premock_nanosleep
+#define usleep ut_premock_usleep
+#define clock_gettime ut_premock_clock_gettime
+#define select ut_premock_select
+
+#endif // PREMOCK_TIME_H_
@@ -0,0 +1,231 @@
+/**
+Virtual time for code that sleeps, reads clocks and waits on timeouts.
+
+The mocks for `nanosleep`, `usleep`, `clock_gettime` and `select` declared
+here all share one `VirtualClock`. Sleeping advances the clock instantly and
+timeouts fire immediately, so code with minutes of retry and backoff logic
+runs in microseconds while still observing a consistent passage of time.
+
+The production code needs the redefinitions in `premock_time.h` and the test
+binary has to implement the mocks as usual, e.g. in a `mock_time.cpp`:
+
+```c++
+#include "premock_time.hpp"
+extern "C" {
+    IMPL_MOCK_DEFAULT(2, nanosleep);
+    IMPL_MOCK_DEFAULT(1, usleep);
+    IMPL_MOCK_DEFAULT(2, clock_gettime);
+    IMPL_MOCK_DEFAULT(5, select);
+}
+```
+
+Test code then does:
+
+```c++
+TEST(retry, backoff) {
+    VirtualTime time;
+    function_that_retries_for_ten_minutes();
+    REQUIRE(time.clock().now() == std::chrono::minutes{10});
+}
+```
+ */
+
+#ifndef PREMOCK_TIME_HPP_
+#define PREMOCK_TIME_HPP_
+
+#include "premock.hpp"
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+DECL_MOCK(nanosleep);
+DECL_MOCK(usleep);
+DECL_MOCK(clock_gettime);
+DECL_MOCK(select);
+
+
+/**
+ A clock that only moves when told to. Monotonic clocks read the time elapsed
+ since construction and realtime clocks read that plus the epoch offset passed
+ in. Can be shared between threads.
+ */
+class VirtualClock {
+public:
+
+    using Duration = std::chrono::nanoseconds;
+
+    explicit VirtualClock(Duration realtimeEpoch = Duration{}):
+        _realtimeEpoch{realtimeEpoch.count()} {
+    }
+
+    /**
+     The time elapsed on this clock
+     */
+    Duration now() const noexcept {
+        return Duration{_now.load(std::memory_order_acquire)};
+    }
+
+    /**
+     Moves time forward by duration
+     */
+    void advance(Duration duration) noexcept {
+        _now.fetch_add(duration.count(), std::memory_order_acq_rel);
+    }
+
+    /**
+     Moves time forward to a point in time, does nothing if it's already past it
+     */
+    void advanceTo(Duration time) noexcept {
+        auto current = _now.load(std::memory_order_acquire);
+        while(current < time.count() &&
+              !_now.compare_exchange_weak(current, time.count(), std::memory_order_acq_rel)) {
+        }
+    }
+
+    /**
+     Virtual implementation of nanosleep: never blocks and never gets interrupted
+     */
+    int nanosleep(const timespec* request, timespec* remaining) noexcept {
+        if(request == nullptr || request->tv_nsec < 0 || request->tv_nsec >= 1000000000L ||
+           request->tv_sec < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        advance(toDuration(*request));
+        if(remaining) *remaining = timespec{};
+        return 0;
+    }
+
+    /**
+     Virtual implementation of usleep
+     */
+    int usleep(useconds_t microseconds) noexcept {
+        advance(std::chrono::microseconds{microseconds});
+        return 0;
+    }
+
+    /**
+     Virtual implementation of clock_gettime. All clocks derive from the same
+     virtual time so that they agree with each other.
+     */
+    int clock_gettime(clockid_t clockId, timespec* time) noexcept {
+        if(time == nullptr) {
+            errno = EFAULT;
+            return -1;
+        }
+
+        auto nanoseconds = now().count();
+        if(isRealtime(clockId)) nanoseconds += _realtimeEpoch;
+
+        time->tv_sec = static_cast<time_t>(nanoseconds / 1000000000LL);
+        time->tv_nsec = static_cast<long>(nanoseconds % 1000000000LL);
+        return 0;
+    }
+
+    /**
+     Virtual implementation of the timeout in select. There are no file descriptors
+     to wait on here, so if none of them are ready according to poll, the timeout
+     expires immediately.
+     */
+    template<typename F>
+    int select(const F& poll, int nfds, fd_set* readFds, fd_set* writeFds, fd_set* exceptFds,
+               timeval* timeout) {
+
+        if(timeout == nullptr) return poll(nfds, readFds, writeFds, exceptFds, nullptr);
+
+        if(timeout->tv_sec < 0 || timeout->tv_usec < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if(nfds > 0) {
+            timeval zero{};
+            const auto ret = poll(nfds, readFds, writeFds, exceptFds, &zero);
+            if(ret != 0) return ret;
+        }
+
+        advance(std::chrono::seconds{timeout->tv_sec} + std::chrono::microseconds{timeout->tv_usec});
+        *timeout = timeval{};
+        return 0;
+    }
+
+private:
+
+    std::atomic<std::int64_t> _now{0};
+    const std::int64_t _realtimeEpoch;
+
+    static Duration toDuration(const timespec& time) noexcept {
+        return std::chrono::seconds{time.tv_sec} + Duration{time.tv_nsec};
+    }
+
+    static bool isRealtime(clockid_t clockId) noexcept {
+        switch(clockId) {
+        case CLOCK_REALTIME:
+#ifdef CLOCK_REALTIME_COARSE
+        case CLOCK_REALTIME_COARSE:
+#endif
+#ifdef CLOCK_TAI
+        case CLOCK_TAI:
+#endif
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+
+/**
+ RAII class that makes all the time mocks use a VirtualClock until the end of
+ scope. select only consults the previous implementation to check for file
+ descriptors that are already ready, or if it was called without a timeout.
+ */
+class VirtualTime {
+public:
+
+    explicit VirtualTime(VirtualClock::Duration realtimeEpoch = VirtualClock::Duration{}):
+        VirtualTime{std::unique_ptr<VirtualClock>{new VirtualClock{realtimeEpoch}}, nullptr} {
+    }
+
+    /**
+     Use an externally owned clock, e.g. to share it with other threads
+     */
+    explicit VirtualTime(VirtualClock& clock):
+        VirtualTime{nullptr, &clock} {
+    }
+
+    VirtualClock& clock() noexcept { return _clock; }
+
+private:
+
+    std::unique_ptr<VirtualClock> _ownClock; // only if no clock was passed in
+    VirtualClock& _clock;
+    MockScope<decltype(mock_nanosleep)> _nanosleep;
+    MockScope<decltype(mock_usleep)> _usleep;
+    MockScope<decltype(mock_clock_gettime)> _clockGettime;
+    MockScope<decltype(mock_select)> _select;
+
+    VirtualTime(std::unique_ptr<VirtualClock> ownClock, VirtualClock* clock):
+        _ownClock{std::move(ownClock)},
+        _clock(clock ? *clock : *_ownClock),
+        _nanosleep{mock_nanosleep, [this](const timespec* req, timespec* rem) {
+                return _clock.nanosleep(req, rem);
+            }},
+        _usleep{mock_usleep, [this](useconds_t usec) { return _clock.usleep(usec); }},
+        _clockGettime{mock_clock_gettime, [this](clockid_t id, timespec* time) {
+                return _clock.clock_gettime(id, time);
+            }},
+        _select{mock_select, [this](int nfds, fd_set* r, fd_set* w, fd_set* e, timeval* timeout) {
+                return _clock.select(_select.displaced(), nfds, r, w, e, timeout);
+            }} {
+    }
+};
+
+
+#endif // PREMOCK_TIME_HPP_
@@ -0,0 +1,245 @@
+/**
+Exports the timeline of calls to mocked functions as a Chrome trace.
+
+Every call going through a `TRACE_CALLS` scope becomes a complete event in
+the [Trace Event Format](https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU),
+which both `chrome://tracing` and the Perfetto UI open. Each thread appends
+to a buffer of its own without locking and the buffers are merged into a
+JSON file when the `ChromeTrace` goes out of scope, or at process exit for a
+static one:
+
+```c++
+TEST(server, load) {
+    ChromeTrace trace{"server_load.json"};
+    auto s = TRACE_CALLS(send, trace);
+    auto r = TRACE_CALLS(recv, trace);
+    run_server_with_clients(16);
+} // server_load.json written here
+```
+
+Arguments are only formatted if the trace is constructed to record them,
+since that's by far the most expensive part of tracing a call.
+ */
+
+#ifndef PREMOCK_TRACE_HPP_
+#define PREMOCK_TRACE_HPP_
+
+#include "premock.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+
+/**
+ Collects the calls to traced mocks from all threads and writes them
+ out as Chrome Trace Event JSON
+ */
+class ChromeTrace {
+public:
+
+    /**
+     The trace is written to fileName when flushed and on destruction. An empty
+     file name means it's only ever available from json().
+     */
+    explicit ChromeTrace(std::string fileName = "", bool recordArguments = false):
+        _fileName(std::move(fileName)),
+        _recordArguments{recordArguments},
+        _origin{CycleClock::now()} {
+        CycleClock::nanosecondsPerTick(); // calibrate now, not in the first call
+    }
+
+    ~ChromeTrace() {
+        try {
+            flush();
+        } catch(...) {
+        }
+    }
+
+    ChromeTrace(const ChromeTrace&) = delete;
+    ChromeTrace& operator=(const ChromeTrace&) = delete;
+
+    bool recordsArguments() const noexcept { return _recordArguments; }
+
+    /**
+     Records a call to name between start and end as measured by CycleClock.
+     name has to outlive the trace.
+     */
+    void record(const char* name, std::uint64_t start, std::uint64_t end, std::string arguments = "") {
+        _logs.local().emplace(name, start, end, std::move(arguments));
+    }
+
+    /**
+     How many calls have been recorded, by all threads
+     */
+    size_t events() const {
+        size_t count = 0;
+        _logs.forEachLog([&count](const ThreadLog<Event>& log) { count += log.forEach([](const Event&) {}); });
+        return count;
+    }
+
+    /**
+     The trace so far in Chrome Trace Event JSON. Safe to call while other
+     threads are still recording, their latest calls just might not make it.
+     */
+    std::string json() const {
+        std::ostringstream stream;
+        stream.setf(std::ios::fixed);
+        stream.precision(3);
+        stream << "{\"traceEvents\":[";
+
+        const auto pid = getpid();
+        bool first = true;
+        size_t tid = 0;
+        _logs.forEachLog([&](const ThreadLog<Event>& log) {
+            ++tid;
+            log.forEach([&](const Event& event) {
+                if(!first) stream << ",";
+                first = false;
+                stream << "\n{\"name\":" << jsonString(event.name) <<
+                    ",\"cat\":\"premock\",\"ph\":\"X\"" <<
+                    ",\"ts\":" << microseconds(event.start - _origin) <<
+                    ",\"dur\":" << microseconds(event.end - event.start) <<
+                    ",\"pid\":" << pid << ",\"tid\":" << tid;
+                if(_recordArguments) stream << ",\"args\":{\"args\":" << jsonString(event.arguments) << "}";
+                stream << "}";
+            });
+        });
+
+        stream << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        return stream.str();
+    }
+
+    /**
+     Writes the trace so far to the file it was constructed with, if any
+     */
+    void flush() const {
+        if(_fileName.empty()) return;
+        std::ofstream file{_fileName};
+        if(!file) throw std::runtime_error("Could not open trace file " + _fileName);
+        file << json();
+    }
+
+private:
+
+    struct Event {
+        const char* name;
+        std::uint64_t start;
+        std::uint64_t end;
+        std::string arguments;
+    };
+
+    std::string _fileName;
+    const bool _recordArguments;
+    const std::uint64_t _origin;
+    ThreadLogs<Event> _logs;
+
+    static double microseconds(std::uint64_t ticks) noexcept {
+        return static_cast<double>(CycleClock::toNanoseconds(ticks)) / 1000.0;
+    }
+
+    static std::string jsonString(const std::string& value) {
+        std::string result{"\""};
+        for(const auto c: value) {
+            switch(c) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    result += escaped;
+                } else {
+                    result += c;
+                }
+            }
+        }
+        return result + "\"";
+    }
+};
+
+
+/**
+ Times a call from construction to destruction into a ChromeTrace
+ */
+class TraceSpan {
+public:
+
+    TraceSpan(ChromeTrace& trace, const char* name, std::string arguments):
+        _trace(trace),
+        _name{name},
+        _arguments(std::move(arguments)),
+        _start{CycleClock::now()} {
+    }
+
+    ~TraceSpan() {
+        _trace.record(_name, _start, CycleClock::now(), std::move(_arguments));
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+
+    ChromeTrace& _trace;
+    const char* _name;
+    std::string _arguments;
+    std::uint64_t _start;
+};
+
+
+// Writable char buffers are usually output parameters that haven't been
+// written to yet, so they're printed as pointers instead of as strings.
+template<typename A>
+const A& traceArgument(const A& arg) { return arg; }
+inline const void* traceArgument(char* arg) { return arg; }
+inline const void* traceArgument(unsigned char* arg) { return arg; }
+
+
+/**
+ RAII class that records every call to the mock in a ChromeTrace and
+ forwards it to the implementation it replaced
+ */
+template<typename T>
+class TraceScope {
+public:
+
+    using ReturnType = typename MockScope<T>::ReturnType;
+
+    TraceScope(T& func, const char* name, ChromeTrace& trace):
+        _trace(trace),
+        _name{name},
+        _mockScope{func, [this](auto&&... args) -> ReturnType {
+                TraceSpan span{_trace, _name,
+                               _trace.recordsArguments() ? toString(std::make_tuple(traceArgument(args)...)) : ""};
+                return _mockScope.displaced()(std::forward<decltype(args)>(args)...);
+            }} {
+    }
+
+private:
+
+    ChromeTrace& _trace;
+    const char* _name;
+    MockScope<T> _mockScope;
+};
+
+
+/**
+ Helper function to create a TraceScope
+ */
+template<typename T>
+TraceScope<T> traceCalls(T& func, const char* name, ChromeTrace& trace) {
+    return {func, name, trace};
+}
+
+/**
+ Helper macro to trace calls to a particular "real" function, named after it
+ */
+#define TRACE_CALLS(func, trace) traceCalls(mock_##func, #func, trace)
+
+
+#endif // PREMOCK_TRACE_HPP_
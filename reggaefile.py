@@ -11,7 +11,7 @@ common_flags = san_opts + " -Wall -Werror -Wextra -g"
 c_flags = common_flags
 prod_flags = c_flags + " -include mocks.h"
 cpp_flags = common_flags + " -std=c++14"
-linker_flags = san_opts
+linker_flags = san_opts + " -pthread"
 
 # production code we want to test
 prod_objs = object_files(src_dirs=["example/src"],
@@ -44,6 +44,20 @@ ut_cpp_objs = object_files(src_dirs=["tests"],
                            includes=[".", "tests"])
 ut_cpp = link(exe_name="ut_cpp", dependencies=ut_cpp_objs, flags=linker_flags)
 
+# Stress test and benchmark of calling mocks from many threads, optimised
+stress_objs = object_files(src_dirs=["bench"],
+                           flags=cpp_flags + " -O2",
+                           includes=["."])
+stress_cpp = link(exe_name="stress_cpp", dependencies=stress_objs, flags=linker_flags)
+
+# The same under ThreadSanitizer, which must not report anything
+tsan_flags = "-fsanitize=thread -Wall -Werror -Wextra -g -O1 -std=c++14"
+stress_tsan_objs = object_files(src_dirs=["bench"],
+                                flags=tsan_flags,
+                                includes=["."])
+stress_tsan = link(exe_name="stress_tsan", dependencies=stress_tsan_objs,
+                   flags="-fsanitize=thread -pthread")
+
 
 d_objs = object_files(src_dirs=["example/d"],
                       src_files=["premock.d"],
@@ -54,4 +68,4 @@ ut_d = link(exe_name="example_d",
             flags="-L-lstdc++")
 
 
-build = Build(example_cpp, ut_cpp, optional(ut_d))
+build = Build(example_cpp, ut_cpp, optional(stress_cpp), optional(stress_tsan), optional(ut_d))
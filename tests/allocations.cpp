@@ -0,0 +1,24 @@
+#include "allocations.hpp"
+#include <cstdlib>
+#include <new>
+
+
+static thread_local size_t gAllocations;
+
+size_t allocationsInThisThread() noexcept {
+    return gAllocations;
+}
+
+void* operator new(size_t size) {
+    ++gAllocations;
+    if(auto ptr = malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,10 @@
+#ifndef PREMOCK_TESTS_ALLOCATIONS_HPP_
+#define PREMOCK_TESTS_ALLOCATIONS_HPP_
+
+#include <cstddef>
+
+// the number of times global operator new has been called in this thread,
+// to check that code paths that shouldn't allocate don't
+size_t allocationsInThisThread() noexcept;
+
+#endif // PREMOCK_TESTS_ALLOCATIONS_HPP_
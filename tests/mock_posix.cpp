@@ -0,0 +1,60 @@
+#include "premock_time.hpp"
+#include "premock_socket.hpp"
+#include "premock_fs.hpp"
+#include "premock_epoll.hpp"
+#include "premock_alloc.hpp"
+#include "premock_thread.hpp"
+#include "premock_pthread.hpp"
+
+extern "C" {
+    IMPL_MOCK_DEFAULT(2, nanosleep);
+    IMPL_MOCK_DEFAULT(1, usleep);
+    IMPL_MOCK_DEFAULT(2, clock_gettime);
+    IMPL_MOCK_DEFAULT(5, select);
+
+    IMPL_MOCK_DEFAULT(3, socket);
+    IMPL_MOCK_DEFAULT(3, bind);
+    IMPL_MOCK_DEFAULT(2, listen);
+    IMPL_MOCK_DEFAULT(3, connect);
+    IMPL_MOCK_DEFAULT(3, accept);
+    IMPL_MOCK_DEFAULT(4, send);
+    IMPL_MOCK_DEFAULT(4, recv);
+    IMPL_MOCK_DEFAULT(1, close);
+    IMPL_MOCK_DEFAULT(2, shutdown);
+    IMPL_MOCK_FCNTL();
+
+    IMPL_MOCK_OPEN();
+    IMPL_MOCK_DEFAULT(3, read);
+    IMPL_MOCK_DEFAULT(3, write);
+    IMPL_MOCK_DEFAULT(3, lseek);
+    IMPL_MOCK_DEFAULT(2, fstat);
+
+    IMPL_MOCK_DEFAULT(1, epoll_create);
+    IMPL_MOCK_DEFAULT(1, epoll_create1);
+    IMPL_MOCK_DEFAULT(4, epoll_ctl);
+    IMPL_MOCK_DEFAULT(4, epoll_wait);
+    IMPL_MOCK_DEFAULT(3, poll);
+
+    IMPL_MOCK_ALLOCATORS();
+
+    IMPL_MOCK_INHERITANCE();
+
+    IMPL_MOCK_DEFAULT(4, pthread_create);
+    IMPL_MOCK_DEFAULT(2, pthread_join);
+    IMPL_MOCK_DEFAULT(1, pthread_detach);
+    IMPL_MOCK_DEFAULT(0, pthread_self);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_lock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_trylock);
+    IMPL_MOCK_DEFAULT(2, pthread_mutex_timedlock);
+    IMPL_MOCK_DEFAULT(1, pthread_mutex_unlock);
+    IMPL_MOCK_DEFAULT(2, pthread_cond_wait);
+    IMPL_MOCK_DEFAULT(3, pthread_cond_timedwait);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_signal);
+    IMPL_MOCK_DEFAULT(1, pthread_cond_broadcast);
+    IMPL_MOCK_DEFAULT(0, sched_yield);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_rdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_tryrdlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_wrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_trywrlock);
+    IMPL_MOCK_DEFAULT(1, pthread_rwlock_unlock);
+}
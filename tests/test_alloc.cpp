@@ -0,0 +1,102 @@
+#include "catch.hpp"
+#include "premock_alloc.hpp"
+#include "allocations.hpp"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+
+using namespace std;
+
+
+extern "C" {
+    void* ut_premock_malloc(size_t);
+    void* ut_premock_calloc(size_t, size_t);
+    void* ut_premock_realloc(void*, size_t);
+    void ut_premock_free(void*);
+}
+
+// production code that allocates a buffer, grows it and frees it
+static int handleRequest(size_t size) {
+    auto buffer = static_cast<char*>(ut_premock_malloc(size));
+    if(buffer == nullptr) return -1;
+    auto bigger = static_cast<char*>(ut_premock_realloc(buffer, size * 2));
+    if(bigger == nullptr) {
+        ut_premock_free(buffer);
+        return -1;
+    }
+    memset(bigger, 0, size * 2);
+    ut_premock_free(bigger);
+    return 0;
+}
+
+
+TEST_CASE("AllocationTracker counts calls and bytes") {
+    AllocationTracker allocations;
+    REQUIRE(handleRequest(16) == 0);
+    auto zeroed = static_cast<int*>(ut_premock_calloc(4, sizeof(int)));
+    REQUIRE(zeroed[3] == 0);
+
+    REQUIRE(allocations.allocations() == 2);
+    REQUIRE(allocations.reallocations() == 1);
+    REQUIRE(allocations.frees() == 1);
+    REQUIRE(allocations.bytes() == 16 + 32 + 4 * sizeof(int));
+    REQUIRE(allocations.live() == 1);
+    REQUIRE(allocations.failures() == 0);
+
+    ut_premock_free(zeroed);
+    REQUIRE(allocations.live() == 0);
+}
+
+TEST_CASE("AllocationTracker logs recent calls") {
+    AllocationTracker allocations{3};
+    handleRequest(8);
+    ut_premock_free(nullptr);
+
+    vector<AllocationEvent::Kind> kinds;
+    allocations.forEachEvent([&kinds](const AllocationEvent& event) { kinds.push_back(event.kind); });
+    REQUIRE(kinds == (vector<AllocationEvent::Kind>{AllocationEvent::Kind::realloc,
+                                                    AllocationEvent::Kind::free,
+                                                    AllocationEvent::Kind::free}));
+}
+
+TEST_CASE("AllocationTracker makes allocations fail") {
+    AllocationTracker allocations;
+    allocations.failAfter(1);
+    errno = 0;
+    REQUIRE(handleRequest(8) == -1);
+    REQUIRE(errno == ENOMEM);
+    REQUIRE(allocations.failures() == 1);
+    REQUIRE(allocations.live() == 0);
+
+    allocations.failAfter(0);
+    REQUIRE(handleRequest(8) == -1);
+    allocations.stopFailing();
+    REQUIRE(handleRequest(8) == 0);
+}
+
+TEST_CASE("AllocationTracker does not allocate") {
+    AllocationTracker allocations;
+    handleRequest(64); // the thread local mocks get initialised in the first call
+    const auto before = allocationsInThisThread();
+    for(int i = 0; i < 100; ++i) handleRequest(64);
+    const auto after = allocationsInThisThread();
+    REQUIRE(after == before);
+    REQUIRE(allocations.allocations() == 101);
+}
+
+TEST_CASE("Allocations from inside the allocator mocks go to the real allocator") {
+    AllocationTracker allocations;
+    // a replacement that allocates through the mocked malloc itself
+    REPLACE(malloc, [](size_t size) {
+        ut_premock_free(ut_premock_malloc(1));
+        vector<int> premockAllocates(100);
+        return calloc(1, size);
+    });
+    auto ptr = ut_premock_malloc(10);
+    REQUIRE(ptr != nullptr);
+    ut_premock_free(ptr);
+    // neither the nested calls nor the one the tracker displaced are seen by it
+    REQUIRE(allocations.allocations() == 0);
+    REQUIRE(allocations.frees() == 1);
+}
@@ -0,0 +1,114 @@
+#include "catch.hpp"
+#include "premock_budget.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+static function<long(int, const void*, size_t)> mock_budget_send = [](int, const void*, size_t len) {
+    return static_cast<long>(len);
+};
+static function<int(int)> mock_budget_flush = [](int fd) { return fd; };
+
+// a handler that sends a response in chunks and flushes after each one
+static void handleRequest(size_t chunks) {
+    for(size_t i = 0; i < chunks; ++i) {
+        mock_budget_send(3, "chunk", 5);
+        mock_budget_flush(3);
+    }
+}
+
+static string readFile(const string& fileName) {
+    ifstream file{fileName};
+    return {istreambuf_iterator<char>{file}, istreambuf_iterator<char>{}};
+}
+
+
+TEST_CASE("CallBudget counts calls and bytes across mocks") {
+    CallBudget budget{"handler"};
+    budget.watchBytes<2>(mock_budget_send).watch(mock_budget_flush);
+    handleRequest(3);
+    REQUIRE(budget.calls() == 6);
+    REQUIRE(budget.bytes() == 15);
+}
+
+TEST_CASE("CallBudget forwards calls and restores the mocks") {
+    {
+        CallBudget budget{"handler"};
+        budget.watch(mock_budget_flush).watch(mock_budget_flush);
+        REQUIRE(mock_budget_flush(7) == 7);
+        REQUIRE(budget.calls() == 2);
+    }
+    REQUIRE(mock_budget_flush(8) == 8);
+}
+
+TEST_CASE("CallBudget within budget") {
+    CallBudget budget{"handler"};
+    budget.watchBytes<2>(mock_budget_send).maxCalls(3).maxBytes(15);
+    handleRequest(3);
+    budget.verify();
+}
+
+TEST_CASE("CallBudget over budget") {
+    CallBudget budget{"handler"};
+    budget.watchBytes<2>(mock_budget_send).watch(mock_budget_flush).maxCalls(4).maxBytes(10);
+    handleRequest(3);
+    try {
+        budget.verify();
+        FAIL("verify should have thrown");
+    } catch(const MockException& ex) {
+        REQUIRE(string{ex.what()} ==
+                "Budget 'handler' exceeded the budget:\n"
+                "  6 calls, at most 4 allowed\n"
+                "  15 bytes, at most 10 allowed\n");
+    }
+}
+
+TEST_CASE("CallBudget names are one word") {
+    REQUIRE_THROWS_AS(CallBudget{"two words"}, const logic_error&);
+}
+
+TEST_CASE("CallBudget baselines") {
+    char fileName[] = "/tmp/premock_budgets_XXXXXX";
+    const auto fd = mkstemp(fileName);
+    REQUIRE(fd != -1);
+    close(fd);
+
+    {
+        CallBudget other{"other"};
+        other.saveBaseline(fileName);
+    }
+
+    {
+        CallBudget budget{"handler"};
+        budget.watchBytes<2>(mock_budget_send);
+        handleRequest(10);
+        budget.verifyBaseline(fileName, 0.1); // first run saves
+    }
+    REQUIRE(readFile(fileName) == "handler 10 50\nother 0 0\n");
+
+    {
+        CallBudget budget{"handler"};
+        budget.watchBytes<2>(mock_budget_send);
+        handleRequest(11);
+        budget.verifyBaseline(fileName, 0.1);
+    }
+
+    {
+        CallBudget budget{"handler"};
+        budget.watchBytes<2>(mock_budget_send);
+        handleRequest(12);
+        REQUIRE_THROWS_AS(budget.verifyBaseline(fileName, 0.1), const MockException&);
+        budget.saveBaseline(fileName);
+    }
+    REQUIRE(readFile(fileName) == "handler 12 60\nother 0 0\n");
+
+    remove(fileName);
+}
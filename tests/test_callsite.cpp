@@ -0,0 +1,82 @@
+#include "catch.hpp"
+#include "premock_callsite.hpp"
+#include <string>
+
+
+using namespace std;
+
+
+extern "C" int callsite_target(int i, size_t len) { return i + static_cast<int>(len); }
+
+extern "C" {
+    DECL_MOCK(callsite_target);
+    IMPL_MOCK_DEFAULT(2, callsite_target);
+}
+
+// stand-ins for production code, which calls the trampoline
+__attribute__((noinline)) static int callsOnce(size_t len) {
+    return ut_premock_callsite_target(1, len);
+}
+
+__attribute__((noinline)) static int callsTwice(size_t len) {
+    return ut_premock_callsite_target(2, len) + ut_premock_callsite_target(3, len);
+}
+
+
+TEST_CASE("CALL_SITES counts calls per call site") {
+    auto sites = CALL_SITES(callsite_target);
+    for(int i = 0; i < 5; ++i) REQUIRE(callsOnce(10) == 11);
+    for(int i = 0; i < 3; ++i) REQUIRE(callsTwice(10) == 25);
+
+    const auto hotspots = sites.hotspots();
+    REQUIRE(hotspots.size() == 3);
+    REQUIRE(hotspots[0].calls == 5);
+    REQUIRE(hotspots[1].calls == 3);
+    REQUIRE(hotspots[2].calls == 3);
+    REQUIRE(hotspots[0].bytes == 0);
+    REQUIRE(hotspots[1].address != hotspots[2].address);
+}
+
+TEST_CASE("CALL_SITES_BYTES sums a parameter per call site") {
+    auto sites = CALL_SITES_BYTES(callsite_target, 1);
+    callsOnce(100);
+    callsOnce(23);
+    callsTwice(7);
+
+    const auto hotspots = sites.hotspots();
+    REQUIRE(hotspots.size() == 3);
+    REQUIRE(hotspots[0].calls == 2);
+    REQUIRE(hotspots[0].bytes == 123);
+    REQUIRE(hotspots[1].bytes == 7);
+}
+
+TEST_CASE("CALL_SITES attributes direct calls to an unknown call site") {
+    auto sites = CALL_SITES(callsite_target);
+    callsOnce(0);
+    mock_callsite_target(1, 2);
+
+    const auto hotspots = sites.hotspots();
+    REQUIRE(hotspots.size() == 2);
+    const auto unknown = hotspots[0].address == nullptr ? hotspots[0] : hotspots[1];
+    REQUIRE(unknown.address == nullptr);
+    REQUIRE(unknown.symbol() == "<unknown>");
+}
+
+TEST_CASE("CALL_SITES report") {
+    auto sites = CALL_SITES_BYTES(callsite_target, 1);
+    callsOnce(4);
+    callsTwice(5);
+
+    const auto report = sites.report(3);
+    REQUIRE(report.find("callsite_target: 3 calls from 3 call sites\n") == 0);
+    REQUIRE(report.find("1 calls, 4 bytes: ") != string::npos);
+    REQUIRE(sites.hotspots()[0].symbol().find("+0x") != string::npos);
+}
+
+TEST_CASE("CallSiteTable counts overflow") {
+    CallSiteTable table;
+    for(size_t i = 1; i <= CallSiteTable::capacity() + 1; ++i)
+        table.record(reinterpret_cast<const void*>(i * 16), 1);
+    REQUIRE(table.ranked().size() + table.overflow() == CallSiteTable::capacity() + 1);
+    REQUIRE(table.overflow() >= 1);
+}
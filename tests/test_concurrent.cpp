@@ -0,0 +1,232 @@
+#include "catch.hpp"
+#include "premock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+// shared by all threads, as mocks are when production code starts threads
+static function<int(int, int)> mock_work = [](int thread, int i) { return thread * i; };
+static function<void(int)> mock_done = [](int) {};
+
+
+static void runWorkers(int threads, int calls) {
+    vector<thread> workers;
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([t, calls] {
+            for(int i = 0; i < calls; ++i) mock_work(t, i);
+            mock_done(t);
+        });
+    }
+    for(auto& worker: workers) worker.join();
+}
+
+
+TEST_CASE("Spies record calls from many threads concurrently") {
+    auto s = spy(mock_work);
+    s.recordConcurrently(64); // small chunks so that each thread needs several
+    runWorkers(8, 1000);
+
+    REQUIRE(s.sequenceNumbers().size() == 8000);
+    REQUIRE(is_sorted(s.sequenceNumbers().begin(), s.sequenceNumbers().end()));
+
+    s.expectCalled(8000);
+    REQUIRE(s.sequenceNumbers().empty());
+}
+
+TEST_CASE("Calls recorded concurrently can be checked by value") {
+    auto s = spy(mock_work);
+    s.recordConcurrently();
+    thread{[] { mock_work(1, 2); }}.join();
+    thread{[] { mock_work(3, 4); }}.join();
+    s.expectCalled(2).withValues({make_tuple(1, 2), make_tuple(3, 4)});
+}
+
+TEST_CASE("A thread alternating between concurrent recorders keeps one log per recorder") {
+    auto work = spy(mock_work);
+    auto done = spy(mock_done);
+    work.recordConcurrently();
+    done.recordConcurrently();
+    mock_work(0, 0);
+    mock_done(0);
+    const auto bytes = work.historyBytes() + done.historyBytes();
+
+    for(int i = 0; i < 100; ++i) {
+        mock_work(0, i);
+        mock_done(0);
+    }
+    REQUIRE(work.historyBytes() + done.historyBytes() == bytes);
+    REQUIRE(callOrder(work, done).size() == 202);
+}
+
+TEST_CASE("Concurrently recorded calls can be put in sequence with other mocks") {
+    auto work = spy(mock_work);
+    auto done = spy(mock_done);
+    work.recordConcurrently();
+    done.recordConcurrently();
+    thread{[] {
+        for(int i = 0; i < 10; ++i) mock_work(0, i);
+        mock_done(0);
+    }}.join();
+
+    expectInSequence(work, done);
+    REQUIRE(work.timestamps().empty());
+}
+
+TEST_CASE("Concurrent recording picks up new calls every time it's looked at") {
+    auto s = spy(mock_work);
+    s.recordConcurrently(4);
+    s.timestampCalls();
+    thread{[] { for(int i = 0; i < 10; ++i) mock_work(1, i); }}.join();
+    REQUIRE(s.sequenceNumbers().size() == 10);
+    thread{[] { for(int i = 0; i < 5; ++i) mock_work(2, i); }}.join();
+    REQUIRE(s.sequenceNumbers().size() == 15);
+    REQUIRE(s.timestamps().size() == 15);
+    REQUIRE(s.historyBytes() > 0);
+}
+
+TEST_CASE("expectCalledWithin returns as soon as the calls are made") {
+    auto s = spy(mock_work);
+    s.recordConcurrently();
+    atomic<chrono::steady_clock::rep> called{0};
+    thread worker{[&called] {
+        this_thread::sleep_for(chrono::milliseconds{20});
+        mock_work(1, 2);
+        mock_work(3, 4);
+        called = chrono::steady_clock::now().time_since_epoch().count();
+    }};
+
+    s.expectCalledWithin(2, chrono::seconds{10}).withValues({make_tuple(1, 2), make_tuple(3, 4)});
+    const auto returned = chrono::steady_clock::now();
+    worker.join();
+    // woken up by the second call, not by the timeout or a periodic check
+    const auto latency = returned - chrono::steady_clock::time_point{chrono::steady_clock::duration{called}};
+    REQUIRE(latency < chrono::milliseconds{100});
+}
+
+TEST_CASE("expectCalledWithin doesn't miss calls racing with it") {
+    auto s = spy(mock_work);
+    s.recordConcurrently();
+    const auto start = chrono::steady_clock::now();
+    for(int i = 0; i < 500; ++i) {
+        thread worker{[i] { mock_work(i, i); }};
+        s.expectCalledWithin(1, chrono::seconds{2}).withValues(i, i);
+        worker.join();
+    }
+    // a single missed wake up would wait for the whole timeout
+    REQUIRE(chrono::steady_clock::now() - start < chrono::seconds{2});
+}
+
+TEST_CASE("expectCalledWithin returns straight away if the calls were already made") {
+    auto s = spy(mock_work);
+    s.recordConcurrently();
+    thread{[] { mock_work(1, 2); }}.join();
+    s.expectCalledWithin(1, chrono::hours{1}).withValues(1, 2);
+}
+
+TEST_CASE("expectCalledWithin throws when the calls don't arrive in time") {
+    auto s = spy(mock_work);
+    s.recordConcurrently();
+    thread{[] { mock_work(1, 2); }}.join();
+
+    const auto start = chrono::steady_clock::now();
+    REQUIRE_THROWS_AS(s.expectCalledWithin(2, chrono::milliseconds{30}), const MockException&);
+    REQUIRE(chrono::steady_clock::now() - start >= chrono::milliseconds{30});
+}
+
+TEST_CASE("expectCalledWithin needs concurrent recording") {
+    auto s = spy(mock_work);
+    REQUIRE_THROWS_AS(s.expectCalledWithin(1, chrono::milliseconds{1}), const logic_error&);
+}
+
+TEST_CASE("Return values taken concurrently go to exactly one call each and the last sticks") {
+    auto m = mock(mock_work);
+    m.returnValue(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 0);
+    m.returnConcurrently();
+    m.recordConcurrently();
+
+    vector<vector<int>> returned(8);
+    vector<thread> workers;
+    for(int t = 0; t < 8; ++t)
+        workers.emplace_back([t, &returned] { for(int i = 0; i < 3; ++i) returned[t].push_back(mock_work(t, i)); });
+    for(auto& worker: workers) worker.join();
+
+    vector<int> all;
+    for(const auto& values: returned) all.insert(all.end(), values.begin(), values.end());
+    sort(all.begin(), all.end());
+    vector<int> expected(8, 0);
+    for(int i = 1; i <= 16; ++i) expected.push_back(i);
+    REQUIRE(all == expected);
+    m.expectCalled(24);
+}
+
+TEST_CASE("Return values set while returning concurrently replace the old ones") {
+    auto m = mock(mock_work);
+    m.returnConcurrently();
+    m.returnValue(1, 2);
+    m.returnValue(3, 4, 5);
+    REQUIRE(mock_work(0, 0) == 3);
+    REQUIRE(mock_work(0, 0) == 4);
+    REQUIRE(mock_work(0, 0) == 5);
+    REQUIRE(mock_work(0, 0) == 5);
+}
+
+TEST_CASE("Concurrent queues say when they're full or empty") {
+    ConcurrentQueue<int> queue{3};
+    REQUIRE(queue.capacity() == 4);
+    int value = 0;
+    REQUIRE(!queue.pop(value));
+    for(int i = 0; i < 4; ++i) REQUIRE(queue.push(i));
+    REQUIRE(!queue.push(4));
+    REQUIRE(queue.pop(value));
+    REQUIRE(value == 0);
+    REQUIRE(queue.push(4));
+    queue.clear();
+    REQUIRE(!queue.pop(value));
+}
+
+TEST_CASE("Concurrent queues hand every value to exactly one consumer") {
+    ConcurrentQueue<int> queue{64};
+    const int perProducer = 20000;
+    atomic<long long> sum{0};
+    atomic<int> popped{0};
+    vector<thread> threads;
+    for(int p = 0; p < 4; ++p) {
+        threads.emplace_back([&queue, p] {
+            for(int i = 1; i <= perProducer; ++i) while(!queue.push(p * perProducer + i)) this_thread::yield();
+        });
+    }
+    for(int c = 0; c < 4; ++c) {
+        threads.emplace_back([&] {
+            int value;
+            while(popped.load() < 4 * perProducer) {
+                if(queue.pop(value)) {
+                    sum += value;
+                    ++popped;
+                } else {
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+    for(auto& t: threads) t.join();
+
+    const long long n = 4 * perProducer;
+    REQUIRE(popped == n);
+    REQUIRE(sum == n * (n + 1) / 2);
+}
+
+TEST_CASE("Collected calls are freed from the thread logs") {
+    auto s = spy(mock_work);
+    s.recordConcurrently(64);
+    runWorkers(2, 10000);
+    s.expectCalled(20000);
+    // at most the chunk each thread is still writing to
+    REQUIRE(s.historyBytes() <= 2 * 64 * (sizeof(tuple<int, int>) + 2 * sizeof(uint64_t)));
+}
@@ -0,0 +1,158 @@
+#include "catch.hpp"
+#include "premock_contention.hpp"
+#include "premock_thread.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+static pthread_mutex_t hotMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t coldMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t tableLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_cond_t readyCond = PTHREAD_COND_INITIALIZER;
+
+
+// LockProfile only blocks on a lock after failing to take it with trylock,
+// so this sees the threads that are about to wait
+struct BlockingLocks {
+    atomic<int> blocking{0};
+    MockScope<decltype(mock_pthread_mutex_lock)> lock{mock_pthread_mutex_lock, [this](pthread_mutex_t* mutex) {
+            ++blocking;
+            return pthread_mutex_lock(mutex);
+        }};
+
+    void waitFor(int threads) const {
+        while(blocking < threads) this_thread::yield();
+    }
+};
+
+
+TEST_CASE("LockProfile counts uncontended acquisitions and hold times") {
+    LockProfile locks;
+    for(int i = 0; i < 10; ++i) {
+        REQUIRE(mock_pthread_mutex_lock(&coldMutex) == 0);
+        REQUIRE(mock_pthread_mutex_unlock(&coldMutex) == 0);
+    }
+
+    const auto stats = locks.stats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats[0].lock == &coldMutex);
+    REQUIRE(!stats[0].rwlock);
+    REQUIRE(stats[0].acquisitions == 10);
+    REQUIRE(stats[0].contended == 0);
+    REQUIRE(stats[0].hold.count() == 10);
+}
+
+TEST_CASE("LockProfile tells contended acquisitions apart") {
+    BlockingLocks blocking;
+    LockProfile locks;
+    InheritMocks inherit;
+
+    REQUIRE(mock_pthread_mutex_lock(&hotMutex) == 0);
+    thread waiter{[] {
+        mock_pthread_mutex_lock(&hotMutex);
+        mock_pthread_mutex_unlock(&hotMutex);
+    }};
+    blocking.waitFor(1);
+    const auto blocked = CycleClock::now();
+    const auto unlocking = CycleClock::now();
+    REQUIRE(mock_pthread_mutex_unlock(&hotMutex) == 0);
+    waiter.join();
+
+    const auto stats = locks.stats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats[0].acquisitions == 2);
+    REQUIRE(stats[0].contended == 1);
+    // the waiter waited, and this thread held the lock, at least from when
+    // the waiter blocked until this thread unlocked
+    const auto atLeast = CycleClock::toNanoseconds(unlocking - blocked);
+    REQUIRE(stats[0].wait.max() >= atLeast);
+    REQUIRE(stats[0].hold.max() >= atLeast);
+}
+
+TEST_CASE("LockProfile counts failed tries and rwlocks") {
+    LockProfile locks;
+    REQUIRE(mock_pthread_rwlock_rdlock(&tableLock) == 0);
+    REQUIRE(mock_pthread_rwlock_tryrdlock(&tableLock) == 0);
+    REQUIRE(mock_pthread_rwlock_trywrlock(&tableLock) != 0);
+    REQUIRE(mock_pthread_rwlock_unlock(&tableLock) == 0);
+    REQUIRE(mock_pthread_rwlock_unlock(&tableLock) == 0);
+    REQUIRE(mock_pthread_rwlock_wrlock(&tableLock) == 0);
+    REQUIRE(mock_pthread_rwlock_unlock(&tableLock) == 0);
+
+    const auto stats = locks.stats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats[0].rwlock);
+    REQUIRE(stats[0].acquisitions == 3);
+    REQUIRE(stats[0].failedTries == 1);
+    REQUIRE(stats[0].hold.count() == 3);
+}
+
+TEST_CASE("LockProfile ranks the locks by time waited and writes a report") {
+    char fileName[] = "/tmp/premock_locks_XXXXXX";
+    const auto fd = mkstemp(fileName);
+    REQUIRE(fd != -1);
+    close(fd);
+    {
+        BlockingLocks blocking;
+        LockProfile locks{fileName};
+        locks.name(&hotMutex, "hot").name(&coldMutex, "cold");
+        InheritMocks inherit;
+
+        mock_pthread_mutex_lock(&coldMutex);
+        mock_pthread_mutex_unlock(&coldMutex);
+        mock_pthread_mutex_lock(&hotMutex);
+        thread waiter{[] {
+            mock_pthread_mutex_lock(&hotMutex);
+            mock_pthread_mutex_unlock(&hotMutex);
+        }};
+        blocking.waitFor(1);
+        mock_pthread_mutex_unlock(&hotMutex);
+        waiter.join();
+
+        const auto stats = locks.stats();
+        REQUIRE(stats.size() == 2);
+        REQUIRE(stats[0].name == "hot");
+        REQUIRE(stats[1].name == "cold");
+        REQUIRE(locks.report(1).find("Lock contention: 2 locks, 3 acquisitions, 1 contended\n  hot (mutex): 2 acquisitions, 1 contended, 0 failed tries") == 0);
+    }
+
+    ifstream file{fileName};
+    const string report{istreambuf_iterator<char>{file}, istreambuf_iterator<char>{}};
+    REQUIRE(report.find("  cold (mutex): 1 acquisitions") != string::npos);
+    remove(fileName);
+}
+
+TEST_CASE("LockProfile counts waking up from pthread_cond_wait as an acquisition") {
+    LockProfile locks;
+    InheritMocks inherit;
+    bool ready = false;
+
+    REQUIRE(mock_pthread_mutex_lock(&coldMutex) == 0);
+    thread signaller{[&ready] {
+        mock_pthread_mutex_lock(&coldMutex);
+        ready = true;
+        pthread_cond_signal(&readyCond);
+        mock_pthread_mutex_unlock(&coldMutex);
+    }};
+    while(!ready) REQUIRE(mock_pthread_cond_wait(&readyCond, &coldMutex) == 0);
+    REQUIRE(mock_pthread_mutex_unlock(&coldMutex) == 0);
+    signaller.join();
+
+    const auto stats = locks.stats();
+    REQUIRE(stats.size() == 1);
+    // this thread's lock and wakeups (more than one if spurious), the signaller's lock
+    REQUIRE(stats[0].wakeups >= 1);
+    REQUIRE(stats[0].acquisitions == 2 + stats[0].wakeups);
+    REQUIRE(stats[0].wait.count() == 2);
+    // one hold per acquisition rather than one lasting through the wait
+    REQUIRE(stats[0].hold.count() == stats[0].acquisitions);
+}
@@ -0,0 +1,205 @@
+#include "catch.hpp"
+#include "premock_epoll.hpp"
+#include "premock_fs.hpp"
+#include <vector>
+
+
+using namespace std;
+
+
+static int watch(int epfd, int fd, uint32_t events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    return mock_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+
+TEST_CASE("epoll_wait returns the events that are ready straight away") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(0);
+    REQUIRE(epfd >= ReadinessTable::firstFd());
+    REQUIRE(watch(epfd, 100, EPOLLIN) == 0);
+    REQUIRE(watch(epfd, 101, EPOLLIN | EPOLLOUT) == 0);
+
+    epoll_event events[4];
+    REQUIRE(mock_epoll_wait(epfd, events, 4, 1000) == 0);
+
+    polling.table().set(101, EPOLLOUT);
+    REQUIRE(mock_epoll_wait(epfd, events, 4, -1) == 1);
+    REQUIRE(events[0].data.fd == 101);
+    REQUIRE(events[0].events == EPOLLOUT);
+
+    // level-triggered, so still there
+    polling.table().raise(100, EPOLLIN | EPOLLOUT);
+    REQUIRE(mock_epoll_wait(epfd, events, 4, 0) == 2);
+    REQUIRE(events[0].data.fd == 100);
+    REQUIRE(events[0].events == EPOLLIN); // not interested in EPOLLOUT
+    REQUIRE(events[1].data.fd == 101);
+    REQUIRE(polling.table().waits() == 3);
+}
+
+TEST_CASE("epoll_ctl checks its arguments like the real one") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create(1);
+    epoll_event event{};
+    REQUIRE(watch(epfd, 5, EPOLLIN) == 0);
+    REQUIRE(watch(epfd, 5, EPOLLIN) == -1);
+    REQUIRE(errno == EEXIST);
+    REQUIRE(mock_epoll_ctl(epfd, EPOLL_CTL_MOD, 6, &event) == -1);
+    REQUIRE(errno == ENOENT);
+    REQUIRE(mock_epoll_ctl(epfd, EPOLL_CTL_ADD, epfd, &event) == -1);
+    REQUIRE(errno == EINVAL);
+    REQUIRE(mock_epoll_ctl(epfd, EPOLL_CTL_DEL, 5, nullptr) == 0);
+    REQUIRE(mock_epoll_create(0) == -1);
+    REQUIRE(errno == EINVAL);
+    REQUIRE(mock_epoll_create1(42) == -1);
+    REQUIRE(errno == EINVAL);
+    epoll_event events[1];
+    REQUIRE(mock_epoll_wait(epfd, events, 0, 0) == -1);
+    REQUIRE(errno == EINVAL);
+}
+
+TEST_CASE("A timeline scripts what becomes ready at each wait") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(EPOLL_CLOEXEC);
+    watch(epfd, 10, EPOLLIN);
+    watch(epfd, 11, EPOLLIN);
+    bool stopped = false;
+    polling.table()
+        .then({{10, EPOLLIN}})
+        .then({{10, 0}, {11, EPOLLIN}})
+        .then()
+        .then([&stopped] { stopped = true; });
+
+    epoll_event events[4];
+    REQUIRE(mock_epoll_wait(epfd, events, 4, 0) == 1);
+    REQUIRE(events[0].data.fd == 10);
+    REQUIRE(mock_epoll_wait(epfd, events, 4, 0) == 1);
+    REQUIRE(events[0].data.fd == 11);
+    REQUIRE(polling.table().remainingSteps() == 2);
+
+    // without a timeout, waits go through the timeline until something's ready
+    polling.table().clear(11);
+    REQUIRE_THROWS_AS(mock_epoll_wait(epfd, events, 4, -1), const MockException&);
+    REQUIRE(stopped);
+    REQUIRE(polling.table().remainingSteps() == 0);
+}
+
+TEST_CASE("Edge-triggered interests report each change once") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(0);
+    polling.table().set(7, EPOLLIN);
+    watch(epfd, 7, EPOLLIN | EPOLLET);
+
+    epoll_event events[1];
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 1);
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 0);
+    polling.table().raise(7, EPOLLIN); // more data arrived
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 1);
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 0);
+}
+
+TEST_CASE("One-shot interests need rearming") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(0);
+    polling.table().set(7, EPOLLIN);
+    watch(epfd, 7, EPOLLIN | EPOLLONESHOT);
+
+    epoll_event events[1];
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 1);
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 0);
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    REQUIRE(mock_epoll_ctl(epfd, EPOLL_CTL_MOD, 7, &event) == 0);
+    REQUIRE(mock_epoll_wait(epfd, events, 1, 0) == 1);
+}
+
+TEST_CASE("Ready fds take turns when they don't all fit") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(0);
+    for(int fd = 20; fd < 23; ++fd) {
+        watch(epfd, fd, EPOLLIN);
+        polling.table().set(fd, EPOLLIN);
+    }
+
+    vector<int> reported;
+    epoll_event events[2];
+    for(int i = 0; i < 3; ++i) {
+        const auto count = mock_epoll_wait(epfd, events, 2, 0);
+        for(int j = 0; j < count; ++j) reported.push_back(events[j].data.fd);
+    }
+    REQUIRE(reported == (vector<int>{20, 21, 22, 20, 21, 22}));
+}
+
+TEST_CASE("poll reports readiness from the table") {
+    VirtualPolling polling;
+    polling.table().set(30, EPOLLIN | EPOLLOUT).set(31, EPOLLHUP);
+    pollfd fds[] = {{30, POLLIN, 0}, {31, POLLIN, 0}, {32, POLLIN, 0}, {-1, POLLIN, 0}};
+    REQUIRE(mock_poll(fds, 4, -1) == 2);
+    REQUIRE(fds[0].revents == POLLIN);
+    REQUIRE(fds[1].revents == POLLHUP); // always reported
+    REQUIRE(fds[2].revents == 0);
+    REQUIRE(fds[3].revents == 0);
+
+    polling.table().clear(30).clear(31);
+    REQUIRE(mock_poll(fds, 4, 10) == 0);
+    REQUIRE_THROWS_AS(mock_poll(fds, 4, -1), const MockException&);
+}
+
+TEST_CASE("Closing an fd removes it from the table and from epoll instances") {
+    VirtualPolling polling;
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    const auto epfd = mock_epoll_create1(0);
+    watch(epfd, fds[0], EPOLLIN);
+    polling.table().set(fds[0], EPOLLIN);
+
+    REQUIRE(mock_close(fds[0]) == 0);
+    REQUIRE(mock_close(fds[1]) == 0);
+    REQUIRE(polling.table().readiness(fds[0]) == 0);
+    REQUIRE(mock_epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], nullptr) == -1);
+    REQUIRE(errno == ENOENT);
+
+    REQUIRE(mock_close(epfd) == 0);
+    REQUIRE(!polling.table().owns(epfd));
+    REQUIRE(mock_epoll_create1(0) == epfd); // reused
+}
+
+TEST_CASE("An event loop can be driven through many iterations") {
+    VirtualPolling polling;
+    const auto epfd = mock_epoll_create1(0);
+    watch(epfd, 40, EPOLLIN);
+    watch(epfd, 41, EPOLLOUT);
+    for(int i = 0; i < 1000; ++i) polling.table().then({{40, EPOLLIN}, {41, 0}}).then({{40, 0}, {41, EPOLLOUT}});
+    bool running = true;
+    polling.table().then([&running] { running = false; });
+
+    int reads = 0, writes = 0;
+    epoll_event events[8];
+    while(running) {
+        const auto count = mock_epoll_wait(epfd, events, 8, -1);
+        for(int i = 0; i < count; ++i) {
+            if(events[i].events & EPOLLIN) ++reads;
+            if(events[i].events & EPOLLOUT) ++writes;
+        }
+    }
+    REQUIRE(reads == 1000);
+    REQUIRE(writes == 1001); // still writable when the loop was stopped
+}
+
+TEST_CASE("Epoll instances and in-memory files get different fds") {
+    MemoryFiles files;
+    VirtualPolling polling;
+    const auto fileFd = mock_open("/tmp/epoll_file", O_WRONLY | O_CREAT, 0600);
+    const auto epfd = mock_epoll_create1(0);
+    REQUIRE(files.fileSystem().owns(fileFd));
+    REQUIRE(polling.table().owns(epfd));
+    REQUIRE(fileFd != epfd);
+
+    REQUIRE(mock_close(fileFd) == 0);
+    REQUIRE(polling.table().owns(epfd));
+    REQUIRE(mock_write(fileFd, "x", 1) == -1);
+    REQUIRE(errno == EBADF);
+    REQUIRE(mock_close(epfd) == 0);
+}
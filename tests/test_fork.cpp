@@ -0,0 +1,93 @@
+#include "catch.hpp"
+#include "premock_fork.hpp"
+#include <functional>
+#include <stdexcept>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+static function<int(int, int)> mock_child_work = [](int child, int i) { return child * i; };
+
+
+static void forkChildren(int children, int calls) {
+    vector<pid_t> pids;
+    for(int c = 0; c < children; ++c) {
+        const auto pid = fork();
+        REQUIRE(pid != -1);
+        if(pid == 0) {
+            for(int i = 0; i < calls; ++i) mock_child_work(c, i);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for(const auto pid: pids) {
+        int status = 0;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        REQUIRE(WIFEXITED(status));
+    }
+}
+
+
+TEST_CASE("Spies record calls made by child processes") {
+    auto s = spy(mock_child_work);
+    recordAcrossProcesses(s);
+    forkChildren(4, 250);
+
+    s.expectCalled(1000);
+}
+
+TEST_CASE("Calls recorded across processes can't be put in sequence with other mocks") {
+    auto s = spy(mock_child_work);
+    recordAcrossProcesses(s);
+    auto other = spy(mock_child_work);
+    REQUIRE_THROWS_AS(s.sequenceNumbers(), const logic_error&);
+    REQUIRE_THROWS_AS(callOrder(s, other), const logic_error&);
+    REQUIRE_THROWS_AS(expectInSequence(other, s), const logic_error&);
+}
+
+TEST_CASE("Calls from each child process are in the order that child made them") {
+    auto s = spy(mock_child_work);
+    recordAcrossProcesses(s);
+    forkChildren(1, 3);
+    s.expectCalled(3).withValues({make_tuple(0, 0), make_tuple(0, 1), make_tuple(0, 2)});
+}
+
+TEST_CASE("Mocks record calls made by the test process and its children together") {
+    auto m = mock(mock_child_work);
+    m.returnValue(42);
+    recordAcrossProcesses(m, 16);
+    REQUIRE(mock_child_work(7, 7) == 42);
+    forkChildren(2, 1);
+    m.expectCalled(3);
+}
+
+TEST_CASE("The shared call ring can be drained and reused") {
+    auto s = spy(mock_child_work);
+    recordAcrossProcesses(s, 4);
+    for(int round = 0; round < 3; ++round) {
+        forkChildren(1, 4);
+        s.expectCalled(4);
+    }
+}
+
+TEST_CASE("Calls that don't fit in the shared call ring are reported") {
+    auto s = spy(mock_child_work);
+    recordAcrossProcesses(s, 4);
+    forkChildren(1, 6);
+    REQUIRE_THROWS_AS(s.expectCalled(4), const MockException&);
+    s.expectCalled(4);
+}
+
+TEST_CASE("Shared call rings round their capacity up to a power of two") {
+    SharedCallRing<tuple<int, double>> ring{100};
+    REQUIRE(ring.capacity() == 128);
+    ring.record(make_tuple(1, 2.5));
+    vector<tuple<int, double>> calls;
+    ring.collect([&calls](const tuple<int, double>& call) { calls.push_back(call); });
+    REQUIRE(calls.size() == 1);
+    REQUIRE(calls[0] == make_tuple(1, 2.5));
+}
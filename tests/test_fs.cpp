@@ -0,0 +1,136 @@
+#include "catch.hpp"
+#include "premock_fs.hpp"
+#include <cstdio>
+#include <string>
+
+
+using namespace std;
+
+
+static string readAll(int fd) {
+    string result;
+    char buf[4];
+    ssize_t count;
+    while((count = mock_read(fd, buf, sizeof(buf))) > 0) result.append(buf, count);
+    return result;
+}
+
+
+TEST_CASE("MemoryFiles read an added file") {
+    MemoryFiles files;
+    files.fileSystem().addFile("/etc/app.conf", "port = 8080\n");
+    const auto fd = mock_open("/etc/app.conf", O_RDONLY, 0);
+    REQUIRE(files.fileSystem().owns(fd));
+    REQUIRE(readAll(fd) == "port = 8080\n");
+    REQUIRE(mock_close(fd) == 0);
+}
+
+TEST_CASE("MemoryFiles create, write and read back") {
+    MemoryFiles files;
+    auto fd = mock_open("/tmp/out", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    REQUIRE(mock_write(fd, "hello ", 6) == 6);
+    REQUIRE(mock_write(fd, "world", 5) == 5);
+    REQUIRE(mock_close(fd) == 0);
+    REQUIRE(files.fileSystem().contents("/tmp/out") == "hello world");
+
+    fd = mock_open("/tmp/out", O_RDWR, 0);
+    struct stat info;
+    REQUIRE(mock_fstat(fd, &info) == 0);
+    REQUIRE(info.st_size == 11);
+    REQUIRE(S_ISREG(info.st_mode));
+    REQUIRE((info.st_mode & 0777) == 0600);
+
+    REQUIRE(mock_lseek(fd, -5, SEEK_END) == 6);
+    REQUIRE(mock_write(fd, "there", 5) == 5);
+    REQUIRE(mock_lseek(fd, 0, SEEK_SET) == 0);
+    REQUIRE(readAll(fd) == "hello there");
+    mock_close(fd);
+}
+
+TEST_CASE("MemoryFiles append and holes") {
+    MemoryFiles files;
+    files.fileSystem().addFile("/log", "a");
+    auto fd = mock_open("/log", O_WRONLY | O_APPEND, 0);
+    mock_lseek(fd, 0, SEEK_SET);
+    mock_write(fd, "b", 1); // O_APPEND ignores the offset
+    mock_close(fd);
+    REQUIRE(files.fileSystem().contents("/log") == "ab");
+
+    fd = mock_open("/log", O_WRONLY, 0);
+    REQUIRE(mock_lseek(fd, 4, SEEK_SET) == 4);
+    mock_write(fd, "c", 1);
+    mock_close(fd);
+    REQUIRE(files.fileSystem().contents("/log") == string("ab\0\0c", 5));
+}
+
+TEST_CASE("MemoryFiles errors") {
+    MemoryFiles files;
+    REQUIRE(mock_open("/nope", O_RDONLY, 0) == -1);
+    REQUIRE(errno == ENOENT);
+
+    files.fileSystem().addFile("/exists", "");
+    REQUIRE(mock_open("/exists", O_WRONLY | O_CREAT | O_EXCL, 0644) == -1);
+    REQUIRE(errno == EEXIST);
+
+    const auto fd = mock_open("/exists", O_RDONLY, 0);
+    REQUIRE(mock_write(fd, "x", 1) == -1);
+    REQUIRE(errno == EBADF);
+    REQUIRE(mock_lseek(fd, -1, SEEK_SET) == -1);
+    REQUIRE(errno == EINVAL);
+    REQUIRE(mock_close(fd) == 0);
+    REQUIRE(mock_close(fd) == -1);
+    REQUIRE(errno == EBADF);
+    char buf[1];
+    REQUIRE(mock_read(fd, buf, 1) == -1);
+    REQUIRE(errno == EBADF);
+}
+
+TEST_CASE("MemoryFiles reuses file descriptors") {
+    MemoryFiles files;
+    files.fileSystem().addFile("/f", "");
+    const auto fd1 = mock_open("/f", O_RDONLY, 0);
+    mock_close(fd1);
+    const auto fd2 = mock_open("/f", O_RDONLY, 0);
+    REQUIRE(fd1 == fd2);
+    mock_close(fd2);
+}
+
+TEST_CASE("MemoryFiles seeded from a real file") {
+    char realPath[] = "/tmp/premock_fs_XXXXXX";
+    const auto realFd = mkstemp(realPath);
+    REQUIRE(realFd != -1);
+    REQUIRE(write(realFd, "seed data", 9) == 9);
+    close(realFd);
+
+    {
+        MemoryFiles files;
+        files.fileSystem().seedFromFile("/seeded", realPath);
+        auto fd = mock_open("/seeded", O_RDWR, 0);
+        REQUIRE(readAll(fd) == "seed data");
+        mock_lseek(fd, 0, SEEK_SET);
+        mock_write(fd, "SEED", 4);
+        mock_close(fd);
+        REQUIRE(files.fileSystem().contents("/seeded") == "SEED data");
+    }
+
+    // the real file is untouched
+    const auto fd = open(realPath, O_RDONLY);
+    char buf[9];
+    REQUIRE(read(fd, buf, sizeof(buf)) == 9);
+    REQUIRE(string(buf, 9) == "seed data");
+    close(fd);
+    unlink(realPath);
+}
+
+TEST_CASE("MemoryFiles only handles paths under the mount point") {
+    MemoryFiles files{"/mem/"};
+    files.fileSystem().addFile("/mem/a", "in memory");
+    const auto memFd = mock_open("/mem/a", O_RDONLY, 0);
+    REQUIRE(files.fileSystem().owns(memFd));
+    mock_close(memFd);
+
+    const auto realFd = mock_open("/dev/null", O_RDONLY, 0);
+    REQUIRE(realFd != -1);
+    REQUIRE(!files.fileSystem().owns(realFd));
+    REQUIRE(mock_close(realFd) == 0);
+}
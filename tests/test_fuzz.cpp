@@ -0,0 +1,150 @@
+#include "catch.hpp"
+#include "premock_fuzz.hpp"
+#include "allocations.hpp"
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+
+static function<int(int, char*)> mock_read_header;
+static function<const char*(int)> mock_lookup;
+static function<void(int)> mock_notify;
+
+// something like a parser that depends on what it reads
+static int parseHeader() {
+    char header[4] = {};
+    const auto length = mock_read_header(4, header);
+    if(length < 0) return -1;
+    return header[0] == 'P' && header[1] == 'K' ? 1 : 0;
+}
+
+
+TEST_CASE("FuzzMock return values come from the input") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    const vector<uint8_t> data{1, 0, 0, 0, 0xff, 0xff, 0xff, 0xff};
+    input.reset(data.data(), data.size());
+    char buf[4];
+    REQUIRE(mock_read_header(4, buf) == 1);
+    REQUIRE(mock_read_header(4, buf) == -1);
+    REQUIRE(mock_read_header(4, buf) == 0); // input exhausted
+    REQUIRE(m.calls() == 3);
+}
+
+TEST_CASE("FuzzMock output arrays come from the input") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    m.outputArray<1>(4);
+    // return value, then the length of the output and the output itself
+    const vector<uint8_t> data{0, 0, 0, 0, 2, 0, 0, 0, 'P', 'K'};
+    input.reset(data.data(), data.size());
+    REQUIRE(parseHeader() == 1);
+    REQUIRE(input.remaining() == 0);
+}
+
+TEST_CASE("FuzzMock output arrays never overflow") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    m.outputArray<1>(2);
+    const vector<uint8_t> data{0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 'a', 'b', 'c', 'd'};
+    input.reset(data.data(), data.size());
+    char buf[4] = {'x', 'x', 'x', 'x'};
+    mock_read_header(4, buf);
+    REQUIRE(buf[2] == 'x');
+    REQUIRE(buf[3] == 'x');
+}
+
+TEST_CASE("FuzzMock output arrays are bounded by a length parameter") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    m.outputArray<1, 0>(4);
+    const vector<uint8_t> data{0, 0, 0, 0, 5, 0, 0, 0, 'a', 'b', 'c', 'd'}; // 5 % (2 + 1) bytes
+    input.reset(data.data(), data.size());
+    char buf[4] = {'x', 'x', 'x', 'x'};
+    mock_read_header(2, buf);
+    REQUIRE(buf[0] == 'a');
+    REQUIRE(buf[1] == 'b');
+    REQUIRE(buf[2] == 'x');
+    REQUIRE(input.remaining() == 2);
+
+    input.reset(data.data(), data.size());
+    mock_read_header(-1, buf); // nothing written
+    REQUIRE(input.remaining() == 8);
+}
+
+TEST_CASE("FuzzMock can return the number of bytes written") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    m.outputArray<1, 0>(4).returnBytesWritten<1>();
+    // no return value, the length of the output and the output itself
+    const vector<uint8_t> data{3, 0, 0, 0, 'P', 'K', 'T', 2, 0, 0, 0, 'x', 'y'};
+    input.reset(data.data(), data.size());
+    char buf[4] = {};
+    REQUIRE(mock_read_header(4, buf) == 3);
+    REQUIRE(string(buf, 3) == "PKT");
+    REQUIRE(mock_read_header(4, buf) == 2);
+    REQUIRE(mock_read_header(4, buf) == 0); // input exhausted
+}
+
+TEST_CASE("FuzzInput consumeBytes with no limit on the length") {
+    FuzzInput input;
+    const vector<uint8_t> data{3, 0, 0, 0, 'a', 'b', 'c', 'd'};
+    input.reset(data.data(), data.size());
+    char buf[4] = {};
+    REQUIRE(input.consumeBytes(buf, numeric_limits<size_t>::max()) == 3);
+    REQUIRE(string(buf, 3) == "abc");
+}
+
+TEST_CASE("FuzzMock records the calls of the current iteration") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    const vector<uint8_t> data{1, 0, 0, 0};
+    char buf[4];
+    input.reset(data.data(), data.size());
+    mock_read_header(4, buf);
+    mock_read_header(3, buf);
+    input.reset(data.data(), data.size());
+    mock_read_header(2, buf);
+    m.expectCalled(1).withValues(2, buf);
+    REQUIRE_THROWS_AS(m.expectCalled(1), const MockException&);
+}
+
+TEST_CASE("FuzzMock returnOneOf") {
+    FuzzInput input;
+    static const char* strings[] = {"foo", "bar"};
+    auto m = FUZZ_MOCK(lookup, input);
+    REQUIRE(mock_lookup(0) == nullptr); // pointers aren't read from the input
+    m.returnOneOf({strings[0], strings[1]});
+    const vector<uint8_t> data{1, 0, 0, 0, 2, 0, 0, 0};
+    input.reset(data.data(), data.size());
+    REQUIRE(mock_lookup(0) == strings[1]);
+    REQUIRE(mock_lookup(0) == strings[0]);
+}
+
+TEST_CASE("FuzzMock void return") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(notify, input);
+    mock_notify(3);
+    REQUIRE(m.calls() == 1);
+}
+
+TEST_CASE("FuzzMock reset starts a new iteration without allocating") {
+    FuzzInput input;
+    auto m = FUZZ_MOCK(read_header, input);
+    m.outputArray<1>(4);
+    const vector<uint8_t> data{0, 0, 0, 0, 2, 0, 0, 0, 'P', 'K'};
+
+    const auto allocations = allocationsInThisThread();
+    for(int i = 0; i < 1000; ++i) {
+        input.reset(data.data(), data.size());
+        parseHeader();
+        parseHeader();
+    }
+    const auto allocationsInLoop = allocationsInThisThread() - allocations;
+    REQUIRE(allocationsInLoop == 0);
+    REQUIRE(m.calls() == 2);
+}
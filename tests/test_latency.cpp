@@ -0,0 +1,80 @@
+#include "catch.hpp"
+#include "premock_latency.hpp"
+#include <functional>
+
+
+using namespace std;
+using namespace std::chrono;
+
+
+static function<int(int)> mock_slow = [](int i) { return i + 1; };
+
+
+TEST_CASE("Fixed latency with a virtual clock") {
+    VirtualClock clock;
+    {
+        auto latency = LATENCY(slow, FixedLatency{microseconds{3}}, VirtualDelay{clock});
+        REQUIRE(mock_slow(1) == 2);
+        REQUIRE(mock_slow(2) == 3);
+        REQUIRE(latency.calls() == 2);
+        REQUIRE(latency.injected() == microseconds{6});
+        REQUIRE(latency.lastInjected() == microseconds{3});
+    }
+    REQUIRE(clock.now() == microseconds{6});
+    mock_slow(3); // no more latency
+    REQUIRE(clock.now() == microseconds{6});
+}
+
+TEST_CASE("Latency composes with REPLACE") {
+    VirtualClock clock;
+    REPLACE(slow, [](int i) { return i * 10; });
+    auto latency = LATENCY(slow, FixedLatency{nanoseconds{5}}, VirtualDelay{clock});
+    REQUIRE(mock_slow(4) == 40);
+    REQUIRE(latency.injected() == nanoseconds{5});
+}
+
+TEST_CASE("Latency composes with MOCK") {
+    VirtualClock clock;
+    auto m = MOCK(slow);
+    m.returnValue(7);
+    auto latency = LATENCY(slow, FixedLatency{nanoseconds{5}}, VirtualDelay{clock});
+    REQUIRE(mock_slow(4) == 7);
+    m.expectCalled().withValues(4);
+}
+
+TEST_CASE("Uniform latency stays within bounds") {
+    UniformLatency policy{microseconds{10}, microseconds{20}, 42};
+    for(int i = 0; i < 1000; ++i) {
+        const auto delay = policy();
+        REQUIRE(delay >= microseconds{10});
+        REQUIRE(delay <= microseconds{20});
+    }
+}
+
+TEST_CASE("Log-normal latency has the requested median") {
+    LogNormalLatency policy{microseconds{100}, 0.5, 42};
+    vector<nanoseconds> delays;
+    for(int i = 0; i < 10001; ++i) delays.push_back(policy());
+    nth_element(delays.begin(), delays.begin() + delays.size() / 2, delays.end());
+    const auto median = delays[delays.size() / 2];
+    REQUIRE(median > microseconds{90});
+    REQUIRE(median < microseconds{110});
+}
+
+TEST_CASE("Replayed latency cycles through the recording") {
+    VirtualClock clock;
+    auto latency = LATENCY(slow, ReplayLatency{{nanoseconds{1}, nanoseconds{2}, nanoseconds{4}}},
+                           VirtualDelay{clock});
+    for(int i = 0; i < 4; ++i) mock_slow(i);
+    REQUIRE(latency.injected() == nanoseconds{8});
+    REQUIRE(latency.lastInjected() == nanoseconds{1});
+}
+
+TEST_CASE("Busy waiting takes at least as long as the delay") {
+    auto latency = LATENCY(slow, FixedLatency{microseconds{20}});
+    const auto start = steady_clock::now();
+    mock_slow(1);
+    const auto elapsed = steady_clock::now() - start;
+    REQUIRE(latency.lastInjected() >= microseconds{20});
+    REQUIRE(elapsed >= microseconds{19}); // minus the clock overhead
+}
@@ -50,6 +50,18 @@ TEST_CASE("REPLACE works correctly") {
 }
 
 
+TEST_CASE("WatchedMocks wrap the mocks until the end of scope") {
+    {
+        WatchedMocks watched;
+        watched.watch(mock_twice, [](const auto& displaced, int i) { return displaced(i) + 1; });
+        REQUIRE(mock_twice(3) == 7);
+        watched.watch(mock_twice, [](const auto& displaced, int i) { return displaced(i) * 10; });
+        REQUIRE(mock_twice(3) == 70);
+    }
+    REQUIRE(mock_twice(3) == 6); // restored in reverse, so the original is back
+}
+
+
 TEST_CASE("MOCK returnValue") {
     {
         auto m = MOCK(twice);
@@ -0,0 +1,120 @@
+#include "catch.hpp"
+#include "premock_perf.hpp"
+#include <functional>
+#include <time.h>
+
+
+using namespace std;
+
+
+static function<int(int)> mock_perf_dependency = [](int i) { return i; };
+static function<int(int)> mock_perf_other = [](int i) { return mock_perf_dependency(i); };
+
+static uint64_t threadCpuTime() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_nsec);
+}
+
+// uses up CPU time, not wall clock time, so that it doesn't matter how
+// busy the machine is
+static void burnCpu(uint64_t nanoseconds) {
+    const auto start = threadCpuTime();
+    while(threadCpuTime() - start < nanoseconds) {}
+}
+
+
+TEST_CASE("PerfCounters count at least CPU time") {
+    PerfCounters counters;
+    const auto start = counters.read();
+    burnCpu(2000000);
+    const auto elapsed = counters.read() - start;
+    REQUIRE(elapsed.taskClock >= 1500000);
+    if(counters.hardware()) REQUIRE(elapsed.instructions > 0);
+}
+
+TEST_CASE("PerfSample scales multiplexed counts") {
+    // counters, enabled, running, cycles, instructions, cache misses, task clock
+    const uint64_t multiplexed[] = {4, 2000, 500, 100, 200, 3, 400};
+    const auto sample = PerfCounters::decode(multiplexed, true).estimate();
+    REQUIRE(sample.scaled());
+    REQUIRE(!sample.unreliable());
+    REQUIRE(sample.cycles == 400);
+    REQUIRE(sample.instructions == 800);
+    REQUIRE(sample.cacheMisses == 12);
+    REQUIRE(sample.taskClock == 1600);
+
+    const uint64_t counting[] = {1, 2000, 2000, 700};
+    REQUIRE(!PerfCounters::decode(counting, false).scaled());
+    REQUIRE(PerfCounters::decode(counting, false).estimate().taskClock == 700);
+
+    const uint64_t never[] = {1, 2000, 0, 0};
+    REQUIRE(PerfCounters::decode(never, false).unreliable());
+    REQUIRE(PerfCounters::decode(never, false).estimate().taskClock == 0);
+}
+
+TEST_CASE("PerfSample scales the difference between reads, not the reads") {
+    // counting 10% of the time at first and all of the time since
+    const uint64_t first[] = {1, 100, 10, 10};
+    const uint64_t second[] = {1, 1100, 1010, 20};
+    const auto difference = PerfCounters::decode(second, false) - PerfCounters::decode(first, false);
+    REQUIRE(!difference.scaled());
+    REQUIRE(difference.estimate().taskClock == 10);
+
+    const uint64_t third[] = {1, 2100, 1510, 30};
+    const auto halfTime = PerfCounters::decode(third, false) - PerfCounters::decode(second, false);
+    REQUIRE(halfTime.scaled());
+    REQUIRE(halfTime.estimate().taskClock == 20);
+}
+
+TEST_CASE("PerfCounters say how long they counted") {
+    PerfCounters counters;
+    const auto start = counters.read();
+    burnCpu(1000000);
+    const auto elapsed = counters.read() - start;
+    REQUIRE(elapsed.timeRunning <= elapsed.timeEnabled);
+    if(counters.perfEvents()) REQUIRE(elapsed.timeEnabled > 0);
+}
+
+TEST_CASE("CpuProfile splits production code from dependencies") {
+    REPLACE(perf_dependency, [](int i) {
+        burnCpu(10000000);
+        return i;
+    });
+
+    CpuProfile profile;
+    profile.watch(mock_perf_dependency);
+    burnCpu(5000000);
+    REQUIRE(mock_perf_dependency(3) == 3);
+    burnCpu(5000000);
+
+    const auto production = profile.production();
+    const auto dependencies = profile.dependencies();
+    REQUIRE(production.taskClock >= 9000000);
+    REQUIRE(production.taskClock < 15000000);
+    REQUIRE(dependencies.taskClock >= 9000000);
+    REQUIRE(dependencies.taskClock < 15000000);
+    REQUIRE(profile.report().find("production:   ") == 0);
+}
+
+TEST_CASE("CpuProfile counts nested dependencies once") {
+    REPLACE(perf_dependency, [](int i) {
+        burnCpu(5000000);
+        return i;
+    });
+
+    CpuProfile profile;
+    profile.watch(mock_perf_dependency).watch(mock_perf_other);
+    REQUIRE(mock_perf_other(4) == 4);
+
+    REQUIRE(profile.dependencies().taskClock >= 4500000);
+    REQUIRE(profile.production().taskClock < 4000000);
+}
+
+TEST_CASE("CpuProfile restores the mocks") {
+    {
+        CpuProfile profile;
+        profile.watch(mock_perf_dependency);
+    }
+    REQUIRE(mock_perf_dependency(5) == 5);
+}
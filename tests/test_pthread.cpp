@@ -0,0 +1,321 @@
+#include "catch.hpp"
+#include "premock_pthread.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+
+// "production" code, calling the pthread functions through the mocks as if
+// it had been compiled with premock_pthread.h
+
+static int counter;
+static pthread_mutex_t counterMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* incrementLocked(void*) {
+    mock_pthread_mutex_lock(&counterMutex);
+    const auto value = counter;
+    mock_sched_yield();
+    counter = value + 1;
+    mock_pthread_mutex_unlock(&counterMutex);
+    return nullptr;
+}
+
+static void* incrementRacy(void*) {
+    const auto value = counter;
+    mock_sched_yield();
+    counter = value + 1;
+    return nullptr;
+}
+
+static void runThreads(int count, void* (*start)(void*)) {
+    vector<pthread_t> threads(count);
+    for(auto& thread: threads) mock_pthread_create(&thread, nullptr, start, nullptr);
+    for(auto thread: threads) mock_pthread_join(thread, nullptr);
+}
+
+
+TEST_CASE("Mutexes keep increments from being lost under every schedule") {
+    CooperativeScheduler::explore(200, [] {
+        counter = 0;
+        runThreads(4, &incrementLocked);
+        if(counter != 4) throw logic_error("lost an update");
+    });
+}
+
+TEST_CASE("Exploring schedules finds a data race") {
+    try {
+        CooperativeScheduler::explore(200, [] {
+            counter = 0;
+            runThreads(2, &incrementRacy);
+            if(counter != 2) throw logic_error("lost an update");
+        });
+        FAIL("no schedule lost an update");
+    } catch(const MockException& ex) {
+        REQUIRE(string{ex.what()}.find("Schedule with seed ") == 0);
+        REQUIRE(string{ex.what()}.find("lost an update") != string::npos);
+    }
+}
+
+TEST_CASE("The same seed gives the same schedule") {
+    const auto test = [] {
+        counter = 0;
+        runThreads(4, &incrementLocked);
+    };
+
+    CooperativeScheduler first{42};
+    first.run(test);
+    CooperativeScheduler second{42};
+    second.run(test);
+    REQUIRE(!first.schedule().empty());
+    REQUIRE(first.schedule() == second.schedule());
+    REQUIRE(first.switches() == second.switches());
+
+    // a different seed replaying the schedule makes the same decisions
+    CooperativeScheduler replayed{7};
+    replayed.replay(first.schedule());
+    replayed.run(test);
+    REQUIRE(replayed.schedule() == first.schedule());
+
+    // only the next run replays
+    replayed.run(test);
+    CooperativeScheduler seven{7};
+    seven.run(test);
+    REQUIRE(replayed.schedule() == seven.schedule());
+}
+
+TEST_CASE("A failing schedule can be replayed exactly") {
+    int failingSeed = -1;
+    for(int seed = 0; seed < 200 && failingSeed < 0; ++seed) {
+        CooperativeScheduler scheduler(seed);
+        scheduler.run([] {
+            counter = 0;
+            runThreads(2, &incrementRacy);
+        });
+        if(counter != 2) failingSeed = seed;
+    }
+    REQUIRE(failingSeed >= 0);
+
+    CooperativeScheduler scheduler(failingSeed);
+    scheduler.run([] {
+        counter = 0;
+        runThreads(2, &incrementRacy);
+    });
+    REQUIRE(counter == 1);
+}
+
+static pthread_mutex_t deadlockMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* lockDeadlockMutex(void*) {
+    mock_pthread_mutex_lock(&deadlockMutex);
+    mock_pthread_mutex_unlock(&deadlockMutex);
+    return nullptr;
+}
+
+TEST_CASE("Threads that all block are reported as a deadlock") {
+    CooperativeScheduler scheduler{1};
+    try {
+        scheduler.run([] {
+            mock_pthread_mutex_lock(&deadlockMutex);
+            pthread_t thread;
+            mock_pthread_create(&thread, nullptr, &lockDeadlockMutex, nullptr);
+            mock_pthread_join(thread, nullptr);
+        });
+        FAIL("didn't deadlock");
+    } catch(const MockException& ex) {
+        REQUIRE(string{ex.what()}.find("Deadlock:\n  thread 1 blocked on") == 0);
+    }
+}
+
+struct Queue {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+    vector<int> items;
+    bool done = false;
+};
+
+static void* consume(void* arg) {
+    auto& queue = *static_cast<Queue*>(arg);
+    auto sum = new int{0};
+    mock_pthread_mutex_lock(&queue.mutex);
+    for(;;) {
+        while(queue.items.empty() && !queue.done) mock_pthread_cond_wait(&queue.ready, &queue.mutex);
+        if(queue.items.empty()) break;
+        *sum += queue.items.back();
+        queue.items.pop_back();
+    }
+    mock_pthread_mutex_unlock(&queue.mutex);
+    return sum;
+}
+
+TEST_CASE("Condition variables wake up waiting threads") {
+    CooperativeScheduler::explore(100, [] {
+        Queue queue;
+        pthread_t consumers[2];
+        for(auto& consumer: consumers) mock_pthread_create(&consumer, nullptr, &consume, &queue);
+
+        for(int i = 1; i <= 10; ++i) {
+            mock_pthread_mutex_lock(&queue.mutex);
+            queue.items.push_back(i);
+            mock_pthread_cond_signal(&queue.ready);
+            mock_pthread_mutex_unlock(&queue.mutex);
+        }
+        mock_pthread_mutex_lock(&queue.mutex);
+        queue.done = true;
+        mock_pthread_cond_broadcast(&queue.ready);
+        mock_pthread_mutex_unlock(&queue.mutex);
+
+        int total = 0;
+        for(auto consumer: consumers) {
+            void* sum;
+            mock_pthread_join(consumer, &sum);
+            total += *static_cast<int*>(sum);
+            delete static_cast<int*>(sum);
+        }
+        if(total != 55) throw logic_error("lost items");
+    });
+}
+
+TEST_CASE("Exceptions escaping a thread are rethrown by run") {
+    CooperativeScheduler scheduler;
+    REQUIRE_THROWS_AS(scheduler.run([] {
+        pthread_t thread;
+        mock_pthread_create(&thread, nullptr, [](void*) -> void* { throw runtime_error("oops"); }, nullptr);
+        mock_pthread_join(thread, nullptr);
+    }), const runtime_error&);
+}
+
+TEST_CASE("Scheduled threads have their own ids and errors are checked") {
+    CooperativeScheduler scheduler;
+    REQUIRE(mock_pthread_self() == pthread_self()); // not running yet
+    scheduler.run([] {
+        REQUIRE(mock_pthread_self() == 1);
+        pthread_t thread;
+        mock_pthread_create(&thread, nullptr, [](void*) -> void* {
+            return reinterpret_cast<void*>(mock_pthread_self());
+        }, nullptr);
+        void* id;
+        REQUIRE(mock_pthread_join(thread, &id) == 0);
+        REQUIRE(reinterpret_cast<pthread_t>(id) == 2);
+        REQUIRE(mock_pthread_join(1, nullptr) == EDEADLK);
+        REQUIRE(mock_pthread_join(99, nullptr) == ESRCH);
+
+        pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        REQUIRE(mock_pthread_mutex_unlock(&mutex) == EPERM);
+        REQUIRE(mock_pthread_mutex_trylock(&mutex) == 0);
+        REQUIRE(mock_pthread_mutex_lock(&mutex) == EDEADLK);
+        REQUIRE(mock_pthread_mutex_unlock(&mutex) == 0);
+    });
+}
+
+TEST_CASE("Read-write locks are scheduled") {
+    CooperativeScheduler::explore(100, [] {
+        static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+        counter = 0;
+        const auto writer = [](void*) -> void* {
+            mock_pthread_rwlock_wrlock(&rwlock);
+            const auto value = counter;
+            mock_sched_yield();
+            counter = value + 1;
+            mock_pthread_rwlock_unlock(&rwlock);
+            return nullptr;
+        };
+        const auto reader = [](void*) -> void* {
+            mock_pthread_rwlock_rdlock(&rwlock);
+            const auto value = counter;
+            mock_sched_yield();
+            if(counter != value) throw logic_error("written while read locked");
+            mock_pthread_rwlock_unlock(&rwlock);
+            return nullptr;
+        };
+        pthread_t threads[4];
+        mock_pthread_create(&threads[0], nullptr, writer, nullptr);
+        mock_pthread_create(&threads[1], nullptr, reader, nullptr);
+        mock_pthread_create(&threads[2], nullptr, writer, nullptr);
+        mock_pthread_create(&threads[3], nullptr, reader, nullptr);
+        for(auto thread: threads) mock_pthread_join(thread, nullptr);
+        if(counter != 2) throw logic_error("lost an update");
+    });
+}
+
+TEST_CASE("Blocking on a write lock held by another thread is a deadlock") {
+    CooperativeScheduler scheduler;
+    static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+    try {
+        scheduler.run([] {
+            REQUIRE(mock_pthread_rwlock_rdlock(&rwlock) == 0);
+            REQUIRE(mock_pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+            pthread_t thread;
+            mock_pthread_create(&thread, nullptr, [](void*) -> void* {
+                mock_pthread_rwlock_wrlock(&rwlock);
+                return nullptr;
+            }, nullptr);
+            mock_pthread_join(thread, nullptr);
+        });
+        FAIL("didn't deadlock");
+    } catch(const MockException& ex) {
+        REQUIRE(string{ex.what()}.find("Deadlock:\n") == 0);
+    }
+}
+
+TEST_CASE("Timed waits time out once nothing else can run") {
+    CooperativeScheduler scheduler;
+    scheduler.run([] {
+        pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+        const timespec deadline{0, 0};
+        REQUIRE(mock_pthread_mutex_lock(&mutex) == 0);
+        REQUIRE(mock_pthread_cond_timedwait(&cond, &mutex, &deadline) == ETIMEDOUT);
+        REQUIRE(mock_pthread_mutex_unlock(&mutex) == 0); // held again after timing out
+
+        static pthread_mutex_t held = PTHREAD_MUTEX_INITIALIZER;
+        REQUIRE(mock_pthread_mutex_lock(&held) == 0);
+        pthread_t thread;
+        mock_pthread_create(&thread, nullptr, [](void*) -> void* {
+            const timespec never{0, 0};
+            return reinterpret_cast<void*>(static_cast<intptr_t>(mock_pthread_mutex_timedlock(&held, &never)));
+        }, nullptr);
+        void* result;
+        REQUIRE(mock_pthread_join(thread, &result) == 0);
+        REQUIRE(reinterpret_cast<intptr_t>(result) == ETIMEDOUT);
+        REQUIRE(mock_pthread_mutex_unlock(&held) == 0);
+    });
+}
+
+TEST_CASE("Timed waits are woken up like the others") {
+    CooperativeScheduler::explore(50, [] {
+        static Queue queue;
+        queue.items.clear();
+        queue.done = false;
+        pthread_t thread;
+        mock_pthread_create(&thread, nullptr, [](void*) -> void* {
+            mock_pthread_mutex_lock(&queue.mutex);
+            queue.items.push_back(1);
+            mock_pthread_cond_signal(&queue.ready);
+            mock_pthread_mutex_unlock(&queue.mutex);
+            return nullptr;
+        }, nullptr);
+
+        const timespec deadline{0, 0};
+        mock_pthread_mutex_lock(&queue.mutex);
+        while(queue.items.empty())
+            if(mock_pthread_cond_timedwait(&queue.ready, &queue.mutex, &deadline) == ETIMEDOUT)
+                throw logic_error("timed out while another thread could still signal");
+        mock_pthread_mutex_unlock(&queue.mutex);
+        mock_pthread_join(thread, nullptr);
+    });
+}
+
+TEST_CASE("Scheduled threads can be detached") {
+    CooperativeScheduler scheduler;
+    scheduler.run([] {
+        pthread_t thread;
+        mock_pthread_create(&thread, nullptr, [](void*) -> void* { return nullptr; }, nullptr);
+        REQUIRE(mock_pthread_detach(thread) == 0);
+        REQUIRE(mock_pthread_detach(thread) == EINVAL);
+        REQUIRE(mock_pthread_join(thread, nullptr) == EINVAL);
+        REQUIRE(mock_pthread_detach(99) == ESRCH);
+    });
+}
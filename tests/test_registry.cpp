@@ -0,0 +1,162 @@
+#include "catch.hpp"
+#include "premock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+extern "C" int registry_target(int i) { return i + 1; }
+extern "C" int registry_unused(int i) { return i - 1; }
+
+extern "C" {
+    DECL_MOCK(registry_target);
+    DECL_MOCK(registry_unused);
+    IMPL_MOCK_DEFAULT(1, registry_target);
+    IMPL_MOCK_DEFAULT(1, registry_unused);
+}
+
+static MockRegistry::Stats statsFor(const string& name) {
+    const auto stats = MockRegistry::stats();
+    return *find_if(stats.begin(), stats.end(), [&name](const MockRegistry::Stats& s) { return s.name == name; });
+}
+
+
+TEST_CASE("IMPL_MOCK registers the mock") {
+    REQUIRE(MockRegistry::size() >= 2);
+    const auto registration = MockRegistry::find("registry_target");
+    REQUIRE(registration != nullptr);
+    REQUIRE(string{registration->name()} == "registry_target");
+    REQUIRE(registration->mock() == &mock_registry_target);
+    REQUIRE(MockRegistry::find("not_a_mock") == nullptr);
+}
+
+TEST_CASE("MockRegistry counts calls through the trampoline") {
+    const auto registration = MockRegistry::find("registry_target");
+    const auto before = registration->calls();
+    REQUIRE(ut_premock_registry_target(1) == 2);
+    REQUIRE(ut_premock_registry_target(2) == 3);
+    REQUIRE(registration->calls() == before + 2);
+
+    const auto neverCalled = MockRegistry::neverCalled();
+    REQUIRE(find(neverCalled.begin(), neverCalled.end(), "registry_unused") != neverCalled.end());
+    REQUIRE(find(neverCalled.begin(), neverCalled.end(), "registry_target") == neverCalled.end());
+}
+
+TEST_CASE("MockRegistry counts the calls of every thread") {
+    const auto registration = MockRegistry::find("registry_target");
+    const auto before = registration->calls();
+
+    atomic<bool> counted{false}, done{false};
+    thread running{[&] {
+        ut_premock_registry_target(1);
+        counted = true;
+        while(!done) this_thread::yield();
+    }};
+    vector<thread> exited;
+    for(int i = 0; i < 4; ++i)
+        exited.emplace_back([] { for(int j = 0; j < 1000; ++j) ut_premock_registry_target(j); });
+    for(auto& thread: exited) thread.join();
+    while(!counted) this_thread::yield();
+
+    REQUIRE(registration->calls() == before + 4001);
+    done = true;
+    running.join();
+    REQUIRE(registration->calls() == before + 4001);
+}
+
+TEST_CASE("MockRegistry resets all overrides") {
+    REPLACE(registry_target, [](int) { return 42; });
+    auto m = MOCK(registry_unused);
+    m.returnValue(33);
+    auto s = SPY(registry_target);
+    REQUIRE(ut_premock_registry_target(1) == 42);
+    REQUIRE(ut_premock_registry_unused(1) == 33);
+
+    REQUIRE(MockRegistry::resetOverrides() == 3);
+    REQUIRE(ut_premock_registry_target(1) == 2);
+    REQUIRE(ut_premock_registry_unused(1) == 0);
+    REQUIRE(MockRegistry::resetOverrides() == 0);
+    // the scopes going out of scope now must not undo the reset
+}
+
+TEST_CASE("MockRegistry is still right after the reset scopes end") {
+    REQUIRE(ut_premock_registry_target(1) == 2);
+    REQUIRE(ut_premock_registry_unused(1) == 0);
+    REQUIRE(statsFor("registry_target").scopeDepth == 0);
+}
+
+TEST_CASE("MockRegistry scope depth and history size") {
+    REQUIRE(statsFor("registry_target").scopeDepth == 0);
+
+    REPLACE(registry_target, [](int i) { return i; });
+    auto s = SPY(registry_target);
+    ut_premock_registry_target(5);
+    ut_premock_registry_target(6);
+
+    const auto stats = statsFor("registry_target");
+    REQUIRE(stats.scopeDepth == 2);
+    REQUIRE(stats.historyBytes == 2 * (sizeof(tuple<int>) + sizeof(uint64_t)));
+    REQUIRE(statsFor("registry_unused").scopeDepth == 0);
+}
+
+TEST_CASE("MockRegistry scope depth of nested scopes") {
+    auto outer = MOCK(registry_target);
+    outer.returnValue(1);
+    {
+        auto inner = MOCK(registry_target);
+        inner.returnValue(2);
+        REQUIRE(ut_premock_registry_target(0) == 2);
+    }
+    REQUIRE(ut_premock_registry_target(0) == 1);
+    REQUIRE(statsFor("registry_target").scopeDepth == 1);
+}
+
+TEST_CASE("MockRegistry stats as JSON") {
+    const auto json = MockRegistry::statsJson();
+    REQUIRE(json.find("{\"mocks\":[") == 0);
+    REQUIRE(json.find("{\"name\":\"registry_unused\",\"calls\":") != string::npos);
+    REQUIRE(json.find("\"scopeDepth\":0}") != string::npos);
+}
+
+// run by the test below in a process of its own, so that nothing has been
+// counted yet when the stats are set up to be dumped at exit
+TEST_CASE("MockRegistry dumps stats set up before any call", "[.][stats_at_exit]") {
+    MockRegistry::dumpStatsAtExit(getenv("PREMOCK_STATS_FILE"));
+    ut_premock_registry_target(1);
+}
+
+TEST_CASE("MockRegistry dumps stats at exit even if set up before any call") {
+    char fileName[] = "/tmp/premock_stats_XXXXXX";
+    const auto fd = mkstemp(fileName);
+    REQUIRE(fd != -1);
+    close(fd);
+
+    const auto pid = fork();
+    REQUIRE(pid != -1);
+    if(pid == 0) {
+        setenv("PREMOCK_STATS_FILE", fileName, 1);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        execl("/proc/self/exe", "ut_cpp", "[stats_at_exit]", static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    ifstream file{fileName};
+    const string json{istreambuf_iterator<char>{file}, istreambuf_iterator<char>{}};
+    unlink(fileName);
+
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(json.find("{\"name\":\"registry_target\",\"calls\":1,") != string::npos);
+}
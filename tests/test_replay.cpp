@@ -0,0 +1,216 @@
+#include "catch.hpp"
+#include "premock_replay.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+struct Info {
+    int size;
+    double mtime;
+};
+
+// a dependency that fills a buffer like recv and one with an output struct
+static function<long(int, void*, size_t, const char*)> mock_fetch;
+static function<int(const char*, Info*)> mock_info;
+static function<void(int)> mock_notify = [](int) {};
+
+static const string fileName = [] {
+    char name[] = "/tmp/premock_replay_XXXXXX";
+    const auto fd = mkstemp(name);
+    if(fd != -1) close(fd);
+    return string{name};
+}();
+
+static long realFetch(int id, void* buf, size_t len, const char*) {
+    if(id < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    const string data = "data for " + to_string(id);
+    const auto size = min(len, data.size());
+    memcpy(buf, data.data(), size);
+    return static_cast<long>(size);
+}
+
+static int realInfo(const char* path, Info* info) {
+    info->size = static_cast<int>(strlen(path));
+    info->mtime = 1.5;
+    return 0;
+}
+
+static void record() {
+    mock_fetch = realFetch;
+    mock_info = realInfo;
+    CallRecording recording{fileName};
+    auto fetch = RECORD_CALLS(fetch, recording);
+    fetch.outputBufferFromReturn<1>();
+    auto info = RECORD_CALLS(info, recording);
+    auto notify = RECORD_CALLS(notify, recording);
+
+    char buf[64];
+    REQUIRE(mock_fetch(7, buf, sizeof(buf), "first") == 10);
+    Info i;
+    REQUIRE(mock_info("/etc/hosts", &i) == 0);
+    REQUIRE(mock_fetch(-1, buf, sizeof(buf), nullptr) == -1);
+    mock_notify(3);
+    REQUIRE(recording.size() > sizeof(ReplayFileHeader));
+}
+
+static void breakDependencies() {
+    mock_fetch = [](int, void*, size_t, const char*) -> long { throw std::logic_error("the real fetch was called"); };
+    mock_info = [](const char*, Info*) -> int { throw std::logic_error("the real info was called"); };
+}
+
+
+TEST_CASE("Replayed calls return what was recorded") {
+    record();
+    breakDependencies();
+
+    CallPlayback playback{fileName};
+    auto fetch = REPLAY_CALLS(fetch, playback);
+    auto info = REPLAY_CALLS(info, playback);
+    auto notify = REPLAY_CALLS(notify, playback);
+    REQUIRE(fetch.remaining() == 2);
+
+    char buf[64] = {};
+    REQUIRE(mock_fetch(7, buf, sizeof(buf), "first") == 10);
+    REQUIRE(string{buf} == "data for 7");
+
+    Info i{};
+    REQUIRE(mock_info("/etc/hosts", &i) == 0);
+    REQUIRE(i.size == 10);
+    REQUIRE(i.mtime == 1.5);
+
+    errno = 0;
+    REQUIRE(mock_fetch(-1, buf, sizeof(buf), nullptr) == -1);
+    REQUIRE(errno == EBADF);
+    mock_notify(3);
+
+    REQUIRE(fetch.remaining() == 0);
+    REQUIRE_THROWS_AS(mock_fetch(7, buf, sizeof(buf), "first"), const MockException&);
+    remove(fileName.c_str());
+}
+
+TEST_CASE("Replay checks the arguments") {
+    record();
+    breakDependencies();
+
+    CallPlayback playback{fileName};
+    {
+        auto fetch = REPLAY_CALLS(fetch, playback);
+        char buf[64];
+        REQUIRE_THROWS_AS(mock_fetch(8, buf, sizeof(buf), "first"), const MockException&);
+    }
+    {
+        auto fetch = REPLAY_CALLS(fetch, playback);
+        char buf[64];
+        REQUIRE_THROWS_AS(mock_fetch(7, buf, sizeof(buf), "second"), const MockException&);
+    }
+    {
+        auto fetch = REPLAY_CALLS(fetch, playback, ReplayMode::inOrder);
+        char buf[64] = {};
+        REQUIRE(mock_fetch(8, buf, sizeof(buf), "second") == 10);
+        REQUIRE(string{buf} == "data for 7");
+    }
+    remove(fileName.c_str());
+}
+
+TEST_CASE("Replay checks the trace") {
+    record();
+    CallPlayback playback{fileName};
+    function<int(int)> mock_other;
+    REQUIRE_THROWS_AS(replayCalls(mock_other, "other", playback), const runtime_error&);
+    // same name, different signature
+    function<int(int)> mock_info;
+    REQUIRE_THROWS_AS(REPLAY_CALLS(info, playback), const runtime_error&);
+    remove(fileName.c_str());
+
+    REQUIRE_THROWS_AS(CallPlayback{fileName}, const runtime_error&); // removed
+    {
+        FILE* file = fopen(fileName.c_str(), "w");
+        fputs("not a trace at all", file);
+        fclose(file);
+    }
+    REQUIRE_THROWS_AS(CallPlayback{fileName}, const runtime_error&);
+    remove(fileName.c_str());
+}
+
+TEST_CASE("Replay doesn't write more than the buffer has room for") {
+    record();
+    breakDependencies();
+
+    CallPlayback playback{fileName};
+    {
+        auto fetch = REPLAY_CALLS(fetch, playback, ReplayMode::inOrder);
+        fetch.outputBuffer<1, 2>();
+        char buf[8] = {'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x'};
+        REQUIRE_THROWS_AS(mock_fetch(7, buf, 4, "first"), const MockException&);
+        REQUIRE(buf[0] == 'x');
+    }
+    {
+        auto fetch = REPLAY_CALLS(fetch, playback, ReplayMode::inOrder);
+        fetch.outputBuffer<1, 2>();
+        char buf[10] = {}; // exactly enough
+        REQUIRE(mock_fetch(7, buf, sizeof(buf), "first") == 10);
+        REQUIRE(string(buf, sizeof(buf)) == "data for 7");
+    }
+    remove(fileName.c_str());
+}
+
+struct Key {
+    char kind;
+    int id;
+};
+
+static bool operator==(const Key& lhs, const Key& rhs) {
+    return lhs.kind == rhs.kind && lhs.id == rhs.id;
+}
+
+TEST_CASE("Replay compares structs with their operator==") {
+    function<int(Key)> mock_lookup = [](Key key) { return key.id; };
+    {
+        CallRecording recording{fileName};
+        auto lookup = RECORD_CALLS(lookup, recording);
+        Key key;
+        memset(&key, 0xff, sizeof(key)); // the padding too
+        key.kind = 'k';
+        key.id = 3;
+        REQUIRE(mock_lookup(key) == 3);
+    }
+
+    CallPlayback playback{fileName};
+    auto lookup = REPLAY_CALLS(lookup, playback);
+    Key key;
+    memset(&key, 0, sizeof(key));
+    key.kind = 'k';
+    key.id = 3;
+    REQUIRE(mock_lookup(key) == 3);
+    remove(fileName.c_str());
+}
+
+TEST_CASE("Recordings grow as needed") {
+    mock_notify = [](int) {};
+    {
+        CallRecording recording{fileName};
+        auto notify = RECORD_CALLS(notify, recording);
+        for(int i = 0; i < 200000; ++i) mock_notify(i);
+    }
+    CallPlayback playback{fileName};
+    auto notify = REPLAY_CALLS(notify, playback);
+    REQUIRE(notify.remaining() == 200000);
+    for(int i = 0; i < 200000; ++i) mock_notify(i);
+    remove(fileName.c_str());
+}
+
+TEST_CASE("Replay layouts") {
+    REQUIRE(ReplayLayout<function<long(int, void*, size_t, const char*)>>::get() == "v8:v4,o,v8,s");
+    REQUIRE(ReplayLayout<function<void(const int*, Info*)>>::get() == "v0:p,o");
+}
@@ -0,0 +1,116 @@
+#include "catch.hpp"
+#include "premock_runner.hpp"
+#include "premock_thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+extern "C" int runner_target(int i) { return i + 1; }
+
+extern "C" {
+    DECL_MOCK(runner_target);
+    IMPL_MOCK_DEFAULT(1, runner_target);
+}
+
+
+TEST_CASE("ParallelRunner runs every test once") {
+    ParallelRunner runner{4};
+    vector<atomic<int>> runs(1000);
+    for(auto& count: runs) {
+        count = 0;
+        runner.add("test", [&count] { ++count; });
+    }
+
+    const auto results = runner.run();
+    REQUIRE(results.passed == 1000);
+    REQUIRE(results.failures.empty());
+    for(const auto& count: runs) REQUIRE(count == 1);
+    results.verify();
+}
+
+TEST_CASE("ParallelRunner collects failures in the order the tests were added") {
+    ParallelRunner runner{3};
+    runner.add("passes", [] {});
+    runner.add("mock not called", [] {
+        auto m = MOCK(runner_target);
+        m.expectCalled();
+    });
+    runner.add("throws", [] { throw 42; });
+    runner.add("also passes", [] {});
+
+    const auto results = runner.run();
+    REQUIRE(results.passed == 2);
+    REQUIRE(results.failures.size() == 2);
+    REQUIRE(results.failures[0].name == "mock not called");
+    REQUIRE(results.failures[0].message.find("Was not called enough times") == 0);
+    REQUIRE(results.failures[1].name == "throws");
+    REQUIRE(results.failures[1].message == "unknown exception");
+    REQUIRE(results.report().find("2 passed, 2 failed in ") != string::npos);
+    REQUIRE_THROWS_AS(results.verify(), const MockException&);
+}
+
+TEST_CASE("ParallelRunner gives each test the default mocks") {
+    ParallelRunner runner{4};
+    atomic<int> dirty{0};
+    for(int i = 0; i < 500; ++i) {
+        // half of the tests replace the mock without restoring it
+        runner.add("pollutes", [] { mock_runner_target = [](int) { return 0; }; });
+        runner.add("checks", [&dirty] { if(ut_premock_runner_target(1) != 2) ++dirty; });
+    }
+
+    REQUIRE(runner.run().passed == 1000);
+    REQUIRE(dirty == 0);
+}
+
+TEST_CASE("ParallelRunner doesn't run tests with the caller's mocks") {
+    REPLACE(runner_target, [](int) { return 0; });
+    ParallelRunner runner{2};
+    atomic<int> result{0};
+    runner.add("default", [&result] { result = ut_premock_runner_target(1); });
+    runner.run().verify();
+    REQUIRE(result == 2);
+}
+
+TEST_CASE("ParallelRunner doesn't run tests with mocks the workers inherited") {
+    REPLACE(runner_target, [](int) { return 0; });
+    InheritMocks inherit;
+    ParallelRunner runner{2};
+    atomic<int> dirty{0};
+    for(int i = 0; i < 10; ++i)
+        runner.add("default", [&dirty] { if(ut_premock_runner_target(1) != 2) ++dirty; });
+    runner.run().verify();
+    REQUIRE(dirty == 0);
+}
+
+TEST_CASE("ParallelRunner workers steal tests from busy ones") {
+    // the slow tests are all at the front, in the first worker's share
+    ParallelRunner runner{4};
+    vector<thread::id> threads(40);
+    for(size_t i = 0; i < threads.size(); ++i) {
+        runner.add("test", [&threads, i] {
+            if(i < 10) this_thread::sleep_for(chrono::milliseconds{5});
+            threads[i] = this_thread::get_id();
+        });
+    }
+    runner.run().verify();
+
+    // the first worker's share was taken by more than one thread
+    vector<thread::id> ran(threads.begin(), threads.begin() + 10);
+    sort(ran.begin(), ran.end());
+    REQUIRE(unique(ran.begin(), ran.end()) - ran.begin() > 1);
+}
+
+TEST_CASE("ParallelRunner with no tests") {
+    ParallelRunner runner;
+    REQUIRE(runner.threads() > 0);
+    const auto results = runner.run();
+    REQUIRE(results.passed == 0);
+    REQUIRE(results.failures.empty());
+}
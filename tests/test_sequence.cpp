@@ -0,0 +1,100 @@
+#include "catch.hpp"
+#include "premock.hpp"
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+static function<int(int)> mock_seq_open = [](int i) { return i; };
+static function<int(int)> mock_seq_read = [](int i) { return i; };
+static function<void(int)> mock_seq_close = [](int) {};
+
+
+TEST_CASE("Calls to different mocks get increasing sequence numbers") {
+    auto open = mock(mock_seq_open);
+    auto close = mock(mock_seq_close);
+    mock_seq_open(1);
+    mock_seq_close(1);
+    mock_seq_open(2);
+
+    REQUIRE(open.sequenceNumbers().size() == 2);
+    REQUIRE(close.sequenceNumbers().size() == 1);
+    REQUIRE(open.sequenceNumbers()[0] < close.sequenceNumbers()[0]);
+    REQUIRE(close.sequenceNumbers()[0] < open.sequenceNumbers()[1]);
+    REQUIRE(open.timestamps().empty());
+
+    open.expectCalled(2);
+    REQUIRE(open.sequenceNumbers().empty());
+}
+
+TEST_CASE("Timestamps are only recorded when asked for") {
+    auto s = spy(mock_seq_read);
+    mock_seq_read(1);
+    s.timestampCalls();
+    mock_seq_read(2);
+    mock_seq_read(3);
+    REQUIRE(s.timestamps().size() == 2);
+    REQUIRE(s.timestamps()[0] <= s.timestamps()[1]);
+}
+
+TEST_CASE("callOrder merges the histories of several mocks") {
+    auto open = mock(mock_seq_open);
+    auto read = spy(mock_seq_read);
+    auto close = mock(mock_seq_close);
+    mock_seq_open(1);
+    mock_seq_read(1);
+    mock_seq_read(1);
+    mock_seq_close(1);
+    mock_seq_open(2);
+
+    REQUIRE(callOrder(open, read, close) == (vector<size_t>{0, 1, 1, 2, 0}));
+    REQUIRE(callOrder(close, open) == (vector<size_t>{1, 0, 1}));
+}
+
+TEST_CASE("expectInSequence passes when calls are in order") {
+    auto open = mock(mock_seq_open);
+    auto read = mock(mock_seq_read);
+    auto close = mock(mock_seq_close);
+    mock_seq_open(1);
+    mock_seq_read(1);
+    mock_seq_read(1);
+    mock_seq_close(1);
+
+    expectInSequence(open, read, close);
+    // a mock that wasn't called is in sequence with anything
+    expectInSequence(open, mock(mock_seq_open), close);
+}
+
+TEST_CASE("expectInSequence throws when calls are out of order") {
+    auto open = mock(mock_seq_open);
+    auto close = mock(mock_seq_close);
+    mock_seq_open(1);
+    mock_seq_close(1);
+    mock_seq_open(2);
+
+    REQUIRE_THROWS_AS(expectInSequence(open, close), const MockException&);
+    try {
+        expectInSequence(open, close);
+    } catch(const MockException& ex) {
+        REQUIRE(string{ex.what()} == "Calls were not in sequence\n"
+                "Expected: #1, then #2\n"
+                "Actual:   #1 #2 #1\n");
+    }
+}
+
+TEST_CASE("Sequence numbers order calls made from different threads") {
+    auto open = mock(mock_seq_open);
+    mock_seq_open(1);
+
+    // mock_ variables are shared here, so the other thread's call goes through the mock
+    thread{[] { mock_seq_open(2); }}.join();
+    mock_seq_open(3);
+
+    const auto& sequence = open.sequenceNumbers();
+    REQUIRE(sequence.size() == 3);
+    REQUIRE(is_sorted(sequence.begin(), sequence.end()));
+}
@@ -0,0 +1,233 @@
+#include "catch.hpp"
+#include "premock_socket.hpp"
+#include <arpa/inet.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+static sockaddr_in localAddress(int port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+static int listenOn(int port) {
+    const auto fd = mock_socket(AF_INET, SOCK_STREAM, 0);
+    const auto address = localAddress(port);
+    if(mock_bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) return -1;
+    if(mock_listen(fd, 16) != 0) return -1;
+    return fd;
+}
+
+static int connectTo(int port) {
+    const auto fd = mock_socket(AF_INET, SOCK_STREAM, 0);
+    const auto address = localAddress(port);
+    if(mock_connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) return -1;
+    return fd;
+}
+
+
+TEST_CASE("SpscRing wraps around") {
+    SpscRing ring{6};
+    REQUIRE(ring.capacity() == 8);
+    char buf[8];
+    REQUIRE(ring.write("abcdef", 6) == 6);
+    REQUIRE(ring.read(buf, 4) == 4);
+    REQUIRE(string(buf, 4) == "abcd");
+    REQUIRE(ring.write("ghijklmn", 8) == 6); // only 6 bytes free
+    REQUIRE(ring.size() == 8);
+    REQUIRE(ring.read(buf, 8, true) == 8);
+    REQUIRE(ring.read(buf, 8) == 8);
+    REQUIRE(string(buf, 8) == "efghijkl");
+    REQUIRE(ring.read(buf, 8) == 0);
+}
+
+TEST_CASE("Loopback client and server in one thread") {
+    LoopbackSockets sockets;
+    const auto server = listenOn(8080);
+    REQUIRE(sockets.network().owns(server));
+    const auto client = connectTo(8080);
+    REQUIRE(client >= 0);
+
+    const auto connection = mock_accept(server, nullptr, nullptr);
+    REQUIRE(sockets.network().owns(connection));
+
+    REQUIRE(mock_send(client, "ping", 4, 0) == 4);
+    char buf[16];
+    REQUIRE(mock_recv(connection, buf, sizeof(buf), 0) == 4);
+    REQUIRE(string(buf, 4) == "ping");
+
+    REQUIRE(mock_send(connection, "pong", 4, 0) == 4);
+    REQUIRE(mock_recv(client, buf, sizeof(buf), 0) == 4);
+    REQUIRE(string(buf, 4) == "pong");
+
+    REQUIRE(mock_close(client) == 0);
+    REQUIRE(mock_recv(connection, buf, sizeof(buf), 0) == 0); // EOF
+    REQUIRE(mock_send(connection, "x", 1, 0) == -1);
+    REQUIRE(errno == EPIPE);
+    REQUIRE(mock_close(connection) == 0);
+    REQUIRE(mock_close(server) == 0);
+}
+
+TEST_CASE("Loopback connections closed at both ends are reused") {
+    LoopbackSockets sockets;
+    const auto server = listenOn(8081);
+    char buf[16];
+    for(int i = 0; i < 100; ++i) {
+        const auto client = connectTo(8081);
+        const auto connection = mock_accept(server, nullptr, nullptr);
+        REQUIRE(mock_send(client, "ping", 4, 0) == 4);
+        REQUIRE(mock_recv(connection, buf, sizeof(buf), 0) == 4);
+        REQUIRE(mock_close(client) == 0);
+        REQUIRE(mock_recv(connection, buf, sizeof(buf), MSG_DONTWAIT) == 0); // EOF, not the old data
+        REQUIRE(mock_close(connection) == 0);
+    }
+    REQUIRE(sockets.network().connectionsAllocated() == 1);
+    REQUIRE(sockets.network().endpointsAllocated() == 3); // the listener and both ends
+
+    // one end still open, so not reused
+    const auto client = connectTo(8081);
+    REQUIRE(sockets.network().connectionsAllocated() == 1);
+    REQUIRE(mock_close(client) == 0);
+    const auto other = connectTo(8081);
+    REQUIRE(sockets.network().connectionsAllocated() == 2);
+
+    // the ones nobody accepted are closed with the listening socket
+    REQUIRE(mock_close(other) == 0);
+    REQUIRE(mock_close(server) == 0);
+    const auto again = listenOn(8081);
+    REQUIRE(mock_close(connectTo(8081)) == 0);
+    REQUIRE(sockets.network().connectionsAllocated() == 2);
+    REQUIRE(mock_close(again) == 0);
+}
+
+TEST_CASE("Loopback errors") {
+    LoopbackSockets sockets;
+    REQUIRE(connectTo(9999) == -1);
+    REQUIRE(errno == ECONNREFUSED);
+
+    const auto server = listenOn(8080);
+    REQUIRE(listenOn(8080) == -1);
+    REQUIRE(errno == EADDRINUSE);
+
+    const auto unconnected = mock_socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(mock_send(unconnected, "x", 1, 0) == -1);
+    REQUIRE(errno == ENOTCONN);
+
+    const auto nonBlocking = mock_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    const auto address = localAddress(8081);
+    mock_bind(nonBlocking, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    mock_listen(nonBlocking, 1);
+    REQUIRE(mock_accept(nonBlocking, nullptr, nullptr) == -1);
+    REQUIRE(errno == EAGAIN);
+
+    const auto client = connectTo(8080);
+    char buf[4];
+    REQUIRE(mock_recv(client, buf, sizeof(buf), MSG_DONTWAIT) == -1);
+    REQUIRE(errno == EAGAIN);
+
+    mock_close(server);
+    REQUIRE(mock_recv(client, buf, sizeof(buf), 0) == 0); // never accepted
+    REQUIRE(mock_close(server) == -1);
+    REQUIRE(errno == EBADF);
+}
+
+TEST_CASE("Loopback connections accepted without a descriptor left are refused") {
+    LoopbackNetwork network{2};
+    LoopbackSockets sockets{network};
+    const auto server = listenOn(8080);
+    const auto client = connectTo(8080);
+    REQUIRE(mock_accept(server, nullptr, nullptr) == -1);
+    REQUIRE(errno == EMFILE);
+    char buf[4];
+    REQUIRE(mock_recv(client, buf, sizeof(buf), 0) == 0);
+    REQUIRE(mock_send(client, "x", 1, 0) == -1);
+    REQUIRE(errno == EPIPE);
+}
+
+TEST_CASE("Loopback sockets made non-blocking with fcntl") {
+    LoopbackSockets sockets;
+    const auto server = listenOn(8080);
+    REQUIRE(mock_fcntl(server, F_GETFL, 0) == O_RDWR);
+    REQUIRE(mock_fcntl(server, F_SETFL, O_RDWR | O_NONBLOCK) == 0);
+    REQUIRE(mock_fcntl(server, F_GETFL, 0) == (O_RDWR | O_NONBLOCK));
+    REQUIRE(mock_accept(server, nullptr, nullptr) == -1);
+    REQUIRE(errno == EAGAIN);
+
+    const auto client = connectTo(8080);
+    REQUIRE(mock_fcntl(client, F_SETFL, O_NONBLOCK) == 0);
+    char buf[4];
+    REQUIRE(mock_recv(client, buf, sizeof(buf), 0) == -1);
+    REQUIRE(errno == EAGAIN);
+    REQUIRE(mock_fcntl(client, F_SETFL, 0) == 0);
+    REQUIRE(mock_fcntl(client, F_GETFL, 0) == O_RDWR);
+
+    REQUIRE(mock_fcntl(client, F_GETLK, 0) == -1);
+    REQUIRE(errno == EINVAL);
+    mock_close(client);
+    REQUIRE(mock_fcntl(client, F_GETFL, 0) == -1);
+    REQUIRE(errno == EBADF);
+}
+
+TEST_CASE("Loopback shutdown") {
+    LoopbackSockets sockets;
+    const auto server = listenOn(8080);
+    const auto client = connectTo(8080);
+    const auto connection = mock_accept(server, nullptr, nullptr);
+
+    mock_send(client, "bye", 3, 0);
+    REQUIRE(mock_shutdown(client, SHUT_WR) == 0);
+    char buf[8];
+    REQUIRE(mock_recv(connection, buf, sizeof(buf), 0) == 3);
+    REQUIRE(mock_recv(connection, buf, sizeof(buf), 0) == 0);
+    // the other direction still works
+    REQUIRE(mock_send(connection, "ok", 2, 0) == 2);
+    REQUIRE(mock_recv(client, buf, sizeof(buf), 0) == 2);
+}
+
+TEST_CASE("Loopback forwards real file descriptors") {
+    LoopbackSockets sockets;
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    REQUIRE(mock_send(fds[0], "real", 4, 0) == 4);
+    char buf[4];
+    REQUIRE(mock_recv(fds[1], buf, sizeof(buf), 0) == 4);
+    REQUIRE(mock_close(fds[0]) == 0);
+    REQUIRE(mock_close(fds[1]) == 0);
+}
+
+TEST_CASE("Loopback throughput across threads") {
+    LoopbackNetwork network{16, 4096};
+    LoopbackSockets sockets{network};
+    const auto server = listenOn(8080);
+    const size_t total = 1 << 20;
+
+    thread producer{[&network] {
+        LoopbackSockets producerSockets{network};
+        const auto client = connectTo(8080);
+        vector<unsigned char> data(total);
+        for(size_t i = 0; i < total; ++i) data[i] = static_cast<unsigned char>(i);
+        size_t sent = 0;
+        while(sent < total) sent += mock_send(client, &data[sent], total - sent, 0);
+        mock_close(client);
+    }};
+
+    const auto connection = mock_accept(server, nullptr, nullptr);
+    vector<unsigned char> received;
+    unsigned char buf[1000];
+    ssize_t count;
+    while((count = mock_recv(connection, buf, sizeof(buf), 0)) > 0)
+        received.insert(received.end(), buf, buf + count);
+    producer.join();
+
+    REQUIRE(received.size() == total);
+    bool intact = true;
+    for(size_t i = 0; i < total; ++i) intact = intact && received[i] == static_cast<unsigned char>(i);
+    REQUIRE(intact);
+}
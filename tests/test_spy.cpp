@@ -0,0 +1,141 @@
+#include "catch.hpp"
+#include "premock.hpp"
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+static function<int(int, string)> mock_spied = [](int i, string s) { return i + static_cast<int>(s.size()); };
+static int spiedClient(int i) { return mock_spied(i * 2, "foo"); }
+
+static function<void(int*)> mock_spied_output = [](int* i) { *i = 42; };
+
+
+TEST_CASE("SPY forwards to the real implementation") {
+    auto s = SPY(spied);
+    REQUIRE(spiedClient(1) == 5);
+    REQUIRE(spiedClient(2) == 7);
+    s.expectCalled(2).withValues({make_tuple(2, "foo"), make_tuple(4, "foo")});
+}
+
+TEST_CASE("SPY verification failures") {
+    auto s = SPY(spied);
+    REQUIRE_THROWS_AS(s.expectCalled(), const MockException&);
+    spiedClient(3);
+    REQUIRE_THROWS_AS(s.expectCalled().withValues(7, "foo"), const MockException&);
+}
+
+TEST_CASE("SPY forwards to whatever it displaced") {
+    REPLACE(spied, [](int i, string) { return i * 100; });
+    auto s = SPY(spied);
+    REQUIRE(spiedClient(1) == 200);
+    s.expectCalled().withValues(2, "foo");
+}
+
+TEST_CASE("SPY on a MOCK") {
+    auto m = MOCK(spied);
+    m.returnValue(33);
+    auto s = SPY(spied);
+    REQUIRE(spiedClient(1) == 33);
+    s.expectCalled().withValues(2, "foo");
+    m.expectCalled().withValues(2, "foo");
+}
+
+TEST_CASE("SPY lets the real function write output parameters") {
+    auto s = SPY(spied_output);
+    int i = 0;
+    mock_spied_output(&i);
+    REQUIRE(i == 42);
+    s.expectCalled().withValues(&i);
+}
+
+TEST_CASE("SPY restores the previous implementation") {
+    {
+        REPLACE(spied, [](int, string) { return -1; });
+        {
+            auto s = SPY(spied);
+            REQUIRE(spiedClient(1) == -1);
+        }
+        REQUIRE(spiedClient(1) == -1);
+    }
+    REQUIRE(spiedClient(1) == 5);
+}
+
+TEST_CASE("SPY does not time calls unless asked to") {
+    auto s = SPY(spied);
+    REQUIRE_THROWS_AS(s.latencies(), const logic_error&);
+}
+
+TEST_CASE("SPY times forwarded calls") {
+    REPLACE(spied, [](int i, string) {
+        const auto start = chrono::steady_clock::now();
+        while(chrono::steady_clock::now() - start < chrono::microseconds{200}) {}
+        return i;
+    });
+    auto s = SPY(spied);
+    s.timeCalls();
+    for(int i = 0; i < 10; ++i) spiedClient(i);
+
+    const auto& latencies = s.latencies();
+    REQUIRE(latencies.count() == 10);
+    REQUIRE(latencies.min() >= 150000);
+    REQUIRE(latencies.p50() >= latencies.min());
+    REQUIRE(latencies.max() >= latencies.p999());
+    REQUIRE(latencies.total() >= 10 * latencies.min());
+}
+
+TEST_CASE("SPY times calls forwarded by several threads") {
+    auto s = SPY(spied);
+    s.recordConcurrently();
+    s.timeCalls();
+    vector<thread> threads;
+    for(int t = 0; t < 4; ++t)
+        threads.emplace_back([] { for(int i = 0; i < 1000; ++i) spiedClient(i); });
+    REQUIRE(s.latencies().count() <= 4000); // merged while they're still calling
+    for(auto& thread: threads) thread.join();
+
+    REQUIRE(s.latencies().count() == 4000);
+    s.expectCalled(4000);
+}
+
+TEST_CASE("LatencyHistogram percentiles") {
+    LatencyHistogram histogram;
+    REQUIRE(histogram.p50() == 0);
+    REQUIRE(histogram.min() == 0);
+
+    for(uint64_t i = 1; i <= 1000; ++i) histogram.record(i * 1000);
+
+    REQUIRE(histogram.count() == 1000);
+    REQUIRE(histogram.total() == 500500000);
+    REQUIRE(histogram.min() == 1000);
+    REQUIRE(histogram.max() == 1000000);
+    // buckets are accurate to ~3%
+    REQUIRE(histogram.p50() >= 500000);
+    REQUIRE(histogram.p50() <= 500000 * 1.04);
+    REQUIRE(histogram.p99() >= 990000);
+    REQUIRE(histogram.p99() <= 1000000);
+    REQUIRE(histogram.p999() >= 999000);
+    REQUIRE(histogram.p999() <= 1000000);
+    REQUIRE(histogram.percentile(1.0) == 1000000);
+}
+
+TEST_CASE("LatencyHistogram small values are exact") {
+    LatencyHistogram histogram;
+    for(uint64_t i = 0; i < 64; ++i) histogram.record(i);
+    REQUIRE(histogram.p50() == 31);
+    REQUIRE(histogram.percentile(0) == 0);
+    REQUIRE(histogram.max() == 63);
+}
+
+TEST_CASE("LatencyHistogram huge values") {
+    LatencyHistogram histogram;
+    histogram.record(~uint64_t{0});
+    REQUIRE(histogram.p50() == ~uint64_t{0});
+    REQUIRE(histogram.report().find("calls: 1") == 0);
+}
@@ -0,0 +1,112 @@
+#include "catch.hpp"
+#include "premock_thread.hpp"
+#include <atomic>
+#include <pthread.h>
+#include <thread>
+
+
+using namespace std;
+
+
+extern "C" int thread_target(int i) { return i + 1; }
+
+extern "C" {
+    DECL_MOCK(thread_target);
+    IMPL_MOCK_DEFAULT(1, thread_target);
+}
+
+static int callInThread() {
+    int result = 0;
+    thread{[&result] { result = ut_premock_thread_target(1); }}.join();
+    return result;
+}
+
+static void* callFromPthread(void* result) {
+    *static_cast<int*>(result) = ut_premock_thread_target(1);
+    return nullptr;
+}
+
+
+TEST_CASE("Threads don't inherit mocks by default") {
+    REPLACE(thread_target, [](int) { return 42; });
+    REQUIRE(ut_premock_thread_target(1) == 42);
+    REQUIRE(callInThread() == 2);
+}
+
+TEST_CASE("std::thread inherits mocks while InheritMocks is in scope") {
+    REPLACE(thread_target, [](int) { return 42; });
+    {
+        InheritMocks inherit;
+        REQUIRE(callInThread() == 42);
+    }
+    REQUIRE(callInThread() == 2);
+}
+
+TEST_CASE("pthread_create inherits mocks while InheritMocks is in scope") {
+    auto m = MOCK(thread_target);
+    m.returnValue(7);
+    m.recordConcurrently();
+    InheritMocks inherit;
+
+    int result = 0;
+    pthread_t thread;
+    REQUIRE(pthread_create(&thread, nullptr, &callFromPthread, &result) == 0);
+    REQUIRE(pthread_join(thread, nullptr) == 0);
+    REQUIRE(result == 7);
+    m.expectCalled().withValues(1);
+}
+
+TEST_CASE("Inherited mocks are passed on to grandchildren") {
+    REPLACE(thread_target, [](int i) { return i * 10; });
+    InheritMocks inherit;
+    int result = 0;
+    thread{[&result] { result = callInThread(); }}.join();
+    REQUIRE(result == 10);
+}
+
+TEST_CASE("Mocks replaced after the thread starts aren't inherited") {
+    InheritMocks inherit;
+    atomic<bool> started{false}, replaced{false};
+    int result = 0;
+    thread child{[&] {
+        started = true;
+        while(!replaced) this_thread::yield();
+        result = ut_premock_thread_target(1);
+    }};
+
+    while(!started) this_thread::yield();
+    REPLACE(thread_target, [](int) { return 42; });
+    replaced = true;
+    child.join();
+    REQUIRE(result == 2);
+}
+
+TEST_CASE("InheritMocks only affects the threads its own thread creates") {
+    REPLACE(thread_target, [](int) { return 42; });
+    atomic<bool> inheriting{false}, done{false};
+    thread other{[&] {
+        InheritMocks inherit;
+        inheriting = true;
+        while(!done) this_thread::yield();
+    }};
+
+    while(!inheriting) this_thread::yield();
+    const auto result = callInThread();
+    done = true;
+    other.join();
+    REQUIRE(result == 2);
+}
+
+TEST_CASE("MockSnapshot captures only the replaced mocks") {
+    REQUIRE(MockSnapshot{}.size() == 0);
+    REPLACE(thread_target, [](int) { return 42; });
+    const MockSnapshot snapshot;
+    REQUIRE(snapshot.size() == 1);
+
+    int result = 0;
+    thread{[&] {
+        snapshot.install();
+        result = ut_premock_thread_target(1);
+    }}.join();
+    REQUIRE(result == 42);
+}
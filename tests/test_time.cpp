@@ -0,0 +1,113 @@
+#include "catch.hpp"
+#include "premock_time.hpp"
+
+
+using namespace std;
+using namespace std::chrono;
+
+
+static nanoseconds elapsed(const timespec& start, const timespec& end) {
+    return seconds{end.tv_sec - start.tv_sec} + nanoseconds{end.tv_nsec - start.tv_nsec};
+}
+
+// production-like code that backs off exponentially for a long time
+static int retryWithBackoff(int attempts) {
+    useconds_t delay = 1000000;
+    for(int i = 0; i < attempts; ++i) {
+        mock_usleep(delay);
+        delay *= 2;
+    }
+    return attempts;
+}
+
+
+TEST_CASE("VirtualTime usleep advances the clock") {
+    VirtualTime time;
+    timespec start, end;
+    mock_clock_gettime(CLOCK_MONOTONIC, &start);
+    retryWithBackoff(8); // 255 seconds of real time
+    mock_clock_gettime(CLOCK_MONOTONIC, &end);
+    REQUIRE(elapsed(start, end) == seconds{255});
+    REQUIRE(time.clock().now() == seconds{255});
+}
+
+TEST_CASE("VirtualTime nanosleep advances the clock and zeroes the remaining time") {
+    VirtualTime time;
+    const timespec request{90, 500};
+    timespec remaining{1, 1};
+    REQUIRE(mock_nanosleep(&request, &remaining) == 0);
+    REQUIRE(remaining.tv_sec == 0);
+    REQUIRE(remaining.tv_nsec == 0);
+    REQUIRE(time.clock().now() == seconds{90} + nanoseconds{500});
+}
+
+TEST_CASE("VirtualTime nanosleep with invalid arguments") {
+    VirtualTime time;
+    const timespec request{0, 1000000000L};
+    REQUIRE(mock_nanosleep(&request, nullptr) == -1);
+    REQUIRE(errno == EINVAL);
+    REQUIRE(time.clock().now() == nanoseconds{0});
+}
+
+TEST_CASE("VirtualTime realtime clock is offset by the epoch") {
+    VirtualTime time{hours{24}};
+    time.clock().advance(milliseconds{1500});
+    timespec realtime, monotonic;
+    mock_clock_gettime(CLOCK_REALTIME, &realtime);
+    mock_clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    REQUIRE(realtime.tv_sec == 24 * 3600 + 1);
+    REQUIRE(realtime.tv_nsec == 500000000L);
+    REQUIRE(monotonic.tv_sec == 1);
+    REQUIRE(monotonic.tv_nsec == 500000000L);
+}
+
+TEST_CASE("VirtualTime select timeout fires immediately") {
+    VirtualTime time;
+    timeval timeout{30, 250};
+    REQUIRE(mock_select(0, nullptr, nullptr, nullptr, &timeout) == 0);
+    REQUIRE(timeout.tv_sec == 0);
+    REQUIRE(timeout.tv_usec == 0);
+    REQUIRE(time.clock().now() == seconds{30} + microseconds{250});
+}
+
+TEST_CASE("VirtualTime select returns ready file descriptors without advancing time") {
+    VirtualTime time;
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    REQUIRE(write(fds[1], "x", 1) == 1);
+
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(fds[0], &readFds);
+    timeval timeout{10, 0};
+    REQUIRE(mock_select(fds[0] + 1, &readFds, nullptr, nullptr, &timeout) == 1);
+    REQUIRE(FD_ISSET(fds[0], &readFds));
+    REQUIRE(time.clock().now() == nanoseconds{0});
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("VirtualTime clock shared between scopes") {
+    VirtualClock clock;
+    {
+        VirtualTime time{clock};
+        mock_usleep(10);
+    }
+    {
+        VirtualTime time{clock};
+        mock_usleep(5);
+    }
+    REQUIRE(clock.now() == microseconds{15});
+}
+
+TEST_CASE("VirtualTime restores the real implementations") {
+    {
+        VirtualTime time;
+        time.clock().advance(hours{1});
+    }
+    timespec start, end;
+    mock_clock_gettime(CLOCK_MONOTONIC, &start);
+    mock_clock_gettime(CLOCK_MONOTONIC, &end);
+    REQUIRE(elapsed(start, end) < hours{1});
+}
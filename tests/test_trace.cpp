@@ -0,0 +1,89 @@
+#include "catch.hpp"
+#include "premock_trace.hpp"
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+static thread_local function<int(int, const char*)> mock_traced = [](int i, const char*) { return i * 2; };
+static function<void(char*)> mock_traced_output = [](char* buf) { buf[0] = 'x'; };
+
+static size_t occurrences(const string& haystack, const string& needle) {
+    size_t count = 0;
+    for(auto pos = haystack.find(needle); pos != string::npos; pos = haystack.find(needle, pos + 1)) ++count;
+    return count;
+}
+
+
+TEST_CASE("TRACE_CALLS forwards and records every call") {
+    ChromeTrace trace;
+    {
+        auto t = TRACE_CALLS(traced, trace);
+        REQUIRE(mock_traced(2, "foo") == 4);
+        REQUIRE(mock_traced(3, "bar") == 6);
+    }
+    REQUIRE(mock_traced(4, "baz") == 8);
+
+    REQUIRE(trace.events() == 2);
+    const auto json = trace.json();
+    REQUIRE(json.find("{\"traceEvents\":[") == 0);
+    REQUIRE(occurrences(json, "\"name\":\"traced\"") == 2);
+    REQUIRE(occurrences(json, "\"ph\":\"X\"") == 2);
+    REQUIRE(json.find("\"args\"") == string::npos);
+}
+
+TEST_CASE("ChromeTrace can record formatted arguments") {
+    ChromeTrace trace{"", true};
+    auto t = TRACE_CALLS(traced, trace);
+    mock_traced(7, "say \"hi\"\n");
+    REQUIRE(trace.json().find("\"args\":{\"args\":\"(7, say \\\"hi\\\"\\n)\"}") != string::npos);
+}
+
+TEST_CASE("ChromeTrace does not print writable buffers as strings") {
+    ChromeTrace trace{"", true};
+    auto t = TRACE_CALLS(traced_output, trace);
+    char buf[1];
+    mock_traced_output(buf);
+    REQUIRE(buf[0] == 'x');
+    REQUIRE(trace.json().find("\"args\":{\"args\":\"(0x") != string::npos);
+}
+
+TEST_CASE("ChromeTrace gives each thread its own track") {
+    ChromeTrace trace;
+    auto t = TRACE_CALLS(traced, trace);
+    vector<thread> threads;
+    for(int i = 0; i < 4; ++i)
+        threads.emplace_back([&trace] {
+            // like DECL_MOCK mocks this one is thread local, so each thread traces its own
+            auto local = TRACE_CALLS(traced, trace);
+            for(int j = 0; j < 1500; ++j) mock_traced(j, "");
+        });
+    for(auto& thread: threads) thread.join();
+    mock_traced(1, "");
+
+    REQUIRE(trace.events() == 6001);
+    const auto json = trace.json();
+    for(int tid = 1; tid <= 5; ++tid)
+        REQUIRE(json.find("\"tid\":" + to_string(tid) + "}") != string::npos);
+}
+
+TEST_CASE("ChromeTrace writes its file on destruction") {
+    const string fileName = "/tmp/premock_test_trace.json";
+    {
+        ChromeTrace trace{fileName};
+        auto t = TRACE_CALLS(traced, trace);
+        mock_traced(1, "");
+    }
+    ifstream file{fileName};
+    const string contents{istreambuf_iterator<char>{file}, istreambuf_iterator<char>{}};
+    REQUIRE(occurrences(contents, "\"name\":\"traced\"") == 1);
+    REQUIRE(contents.find("]") != string::npos);
+    remove(fileName.c_str());
+}